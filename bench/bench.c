@@ -0,0 +1,451 @@
+// smol_bench: lexer, parser and VM throughput on a generated corpus.
+// Prints a JSON report; the corpus only depends on --seed and --scale so
+// reports from different versions can be diffed.
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "ast.h"
+#include "compiler.h"
+#include "fold.h"
+#include "lexer.h"
+#include "simd.h"
+#include "thread.h"
+#include "vm.h"
+
+#define BENCH_SCHEMA 1
+
+// Allocation counters, filled in when the link wraps malloc (GNU ld).
+// Atomic since the isolates phase allocates on several threads.
+static _Atomic uint64_t allocs = 0, allocBytes = 0;
+
+#ifdef SMOL_BENCH_WRAP_MALLOC
+extern void* __real_malloc(size_t size);
+extern void* __real_calloc(size_t count, size_t size);
+extern void* __real_realloc(void* p, size_t size);
+
+void* __wrap_malloc(size_t size) {
+	allocs++;
+	allocBytes += size;
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+	allocs++;
+	allocBytes += count * size;
+	return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* p, size_t size) {
+	allocs++;
+	allocBytes += size;
+	return __real_realloc(p, size);
+}
+#endif
+
+typedef struct Buffer_t {
+	char* data;
+	size_t length, capacity;
+} Buffer;
+
+static void _append(Buffer* b, const char* fmt, ...) {
+	va_list args;
+	for (;;) {
+		va_start(args, fmt);
+		size_t room = b->capacity - b->length;
+		int n = vsnprintf(b->data + b->length, room, fmt, args);
+		va_end(args);
+		if (n >= 0 && (size_t) n < room) {
+			b->length += n;
+			return;
+		}
+		b->capacity = b->capacity * 2 + (n > 0 ? n : 0) + 64;
+		b->data = (char*) realloc(b->data, b->capacity);
+	}
+}
+
+// Park-Miller, so the corpus is identical everywhere for a given seed.
+static uint32_t seed = 1;
+
+static uint32_t _rand(uint32_t n) {
+	seed = (uint32_t) ((uint64_t) seed * 48271 % 2147483647);
+	return seed % n;
+}
+
+static const char* BINARY_OPS[] = { "+", "-", "*", "/", "%", "<<", ">>", "&", "|", "^", "<", ">=", "==", "!=", "and", "or" };
+
+static void _gen_expr(Buffer* b, int depth) {
+	if (depth == 0) {
+		switch (_rand(3)) {
+			case 0: _append(b, "%u", _rand(100000)); break;
+			case 1: _append(b, "v%u", _rand(64)); break;
+			default: _append(b, "%u.%u", _rand(1000), _rand(100)); break;
+		}
+		return;
+	}
+	switch (_rand(8)) {
+		case 0:
+			_append(b, "%s", _rand(2) ? "-" : "!");
+			_gen_expr(b, depth - 1);
+			break;
+		case 1:
+			_append(b, "(");
+			_gen_expr(b, depth - 1);
+			_append(b, " ? ");
+			_gen_expr(b, depth / 2);
+			_append(b, " : ");
+			_gen_expr(b, depth / 2);
+			_append(b, ")");
+			break;
+		default:
+			_append(b, "(");
+			_gen_expr(b, depth - 1);
+			_append(b, " %s ", BINARY_OPS[_rand(sizeof(BINARY_OPS) / sizeof(BINARY_OPS[0]))]);
+			_gen_expr(b, _rand(3));
+			_append(b, ")");
+			break;
+	}
+}
+
+static void _gen_deep_expressions(Buffer* b, int scale) {
+	for (int i = 0; i < 400 * scale; i++) {
+		_append(b, "let e%d = ", i);
+		_gen_expr(b, 48);
+		_append(b, ";\n");
+	}
+}
+
+static void _gen_statements(Buffer* b, int scale) {
+	_append(b, "fun step(a, b = 1) {\n");
+	for (int i = 0; i < 40000 * scale; i++) {
+		switch (_rand(6)) {
+			case 0: _append(b, "\tlet x%d = a * %u + b;\n", i, _rand(100)); break;
+			case 1: _append(b, "\ta += x%u - %u;\n", _rand(i + 1), _rand(10)); break;
+			case 2: _append(b, "\tprint(a, b, %u);\n", _rand(1000)); break;
+			case 3: _append(b, "\tif a > %u { b = a; } elif a < 0 { b = -a; } else { b += 1; }\n", _rand(1000)); break;
+			case 4: _append(b, "\tfor i in 0..%u { a = a + i; }\n", _rand(50)); break;
+			default: _append(b, "\tb = a.length[%u](b);\n", _rand(8)); break;
+		}
+	}
+	_append(b, "\treturn a;\n}\n");
+}
+
+static void _gen_strings(Buffer* b, int scale) {
+	static const char* WORDS[] = { "alpha", "beta", "gamma", "delta\\n", "it\\'s", "tab\\there", "\\x41BC", "smol" };
+	for (int i = 0; i < 40000 * scale; i++) {
+		_append(b, "let s%d = '%s %u' + '%s';\n", i, WORDS[_rand(8)], _rand(1000), WORDS[_rand(8)]);
+	}
+}
+
+static void _gen_lists(Buffer* b, int scale) {
+	for (int i = 0; i < 40 * scale; i++) {
+		_append(b, "let l%d = [", i);
+		for (int j = 0; j < 4000; j++) {
+			if (j > 0) _append(b, ", ");
+			switch (_rand(4)) {
+				case 0: _append(b, "'item%u'", _rand(1000)); break;
+				case 1: _append(b, "[%u, %u]", _rand(100), _rand(100)); break;
+				default: _append(b, "%u", _rand(100000)); break;
+			}
+		}
+		_append(b, "];\n");
+	}
+}
+
+typedef struct Corpus_t {
+	const char* name;
+	void (*generate)(Buffer* b, int scale);
+} Corpus;
+
+static const Corpus CORPORA[] = {
+	{ "deep_expressions", _gen_deep_expressions },
+	{ "statements", _gen_statements },
+	{ "strings", _gen_strings },
+	{ "lists", _gen_lists }
+};
+
+// Fixed CPU-bound script for the VM figure.
+static const char* VM_SCRIPT =
+	"fun fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }\n"
+	"fun loops(n) {\n"
+	"\tlet total = 0;\n"
+	"\tfor i in 0..n { for j in n..0..-1 { total += i * j & 255; } }\n"
+	"\treturn total;\n"
+	"}\n"
+	"fun lists(n) {\n"
+	"\tlet xs = [];\n"
+	"\tfor i in 0..n { push(xs, i * 2); }\n"
+	"\tlet total = 0;\n"
+	"\tfor x, i in xs { total += x - xs[n - (i + 1)]; }\n"
+	"\treturn total;\n"
+	"}\n"
+	"let result = fib(24) + loops(1000) + lists(200000);\n";
+
+static double _now(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long _peak_rss_kb(void) {
+#ifndef _WIN32
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+#else
+	return -1;
+#endif
+}
+
+static uint64_t _count_nodes(Node* nd) {
+	if (nd == NULL) return 0;
+	uint64_t count = 1;
+	for (int i = 0; i < nd->childCount; i++) {
+		count += _count_nodes(nd->children[i]);
+	}
+	return count;
+}
+
+typedef struct Phase_t {
+	double seconds; // best run
+	uint64_t allocs, allocBytes; // per run
+} Phase;
+
+static void _phase_json(const char* name, Phase* phase, const char* unit, uint64_t items, int last) {
+	printf("      \"%s\": { \"seconds\": %.6f, \"%s_per_sec\": %.0f, \"allocs\": %llu, \"alloc_bytes\": %llu }%s\n",
+		name, phase->seconds, unit, phase->seconds > 0 ? items / phase->seconds : 0.0,
+		(unsigned long long) phase->allocs, (unsigned long long) phase->allocBytes, last ? "" : ",");
+}
+
+static void _bench_corpus(const Corpus* corpus, int scale, int iterations, int last) {
+	Buffer b = { NULL, 0, 0 };
+	_append(&b, "");
+	corpus->generate(&b, scale);
+
+	Phase lex = { 1e30, 0, 0 }, parse = { 1e30, 0, 0 };
+	int numTokens = 0;
+	uint64_t numNodes = 0;
+	int errors = 0;
+	for (int it = 0; it < iterations; it++) {
+		Interner strings;
+		interner_new(&strings);
+
+		Token* tokens = NULL;
+		uint64_t a0 = allocs, b0 = allocBytes;
+		double t0 = _now();
+		numTokens = lexer_lex(b.data, &strings, &tokens);
+		double t1 = _now();
+		lex.allocs = allocs - a0;
+		lex.allocBytes = allocBytes - b0;
+		if (t1 - t0 < lex.seconds) lex.seconds = t1 - t0;
+
+		Parser p;
+		a0 = allocs;
+		b0 = allocBytes;
+		t0 = _now();
+		parser_new(&p, tokens, numTokens);
+		Node* root = ast_parse_program(&p);
+		t1 = _now();
+		parse.allocs = allocs - a0;
+		parse.allocBytes = allocBytes - b0;
+		if (t1 - t0 < parse.seconds) parse.seconds = t1 - t0;
+		numNodes = _count_nodes(root);
+		errors = p.errors;
+
+		parser_free(&p);
+		free(tokens);
+		interner_free(&strings);
+	}
+
+	printf("    {\n");
+	printf("      \"name\": \"%s\",\n", corpus->name);
+	printf("      \"bytes\": %zu,\n", b.length);
+	printf("      \"tokens\": %d,\n", numTokens);
+	printf("      \"nodes\": %llu,\n", (unsigned long long) numNodes);
+	printf("      \"parse_errors\": %d,\n", errors);
+	_phase_json("lex", &lex, "tokens", (uint64_t) numTokens, 0);
+	_phase_json("parse", &parse, "nodes", numNodes, 1);
+	printf("    }%s\n", last ? "" : ",");
+	free(b.data);
+}
+
+static Program* _compile_vm_script(Interner* strings) {
+	Parser p;
+	Token* tokens = NULL;
+	int numTokens = lexer_lex(VM_SCRIPT, strings, &tokens);
+	parser_new(&p, tokens, numTokens);
+	Node* root = ast_parse_program(&p);
+	ast_fold(root, strings);
+	Program* program = compile_program(root, strings, NULL, NULL);
+	parser_free(&p);
+	free(tokens);
+	return program;
+}
+
+static void _bench_vm(int iterations) {
+	Phase run = { 1e30, 0, 0 };
+	uint64_t instructions = 0;
+	for (int it = 0; it < iterations; it++) {
+		Interner strings;
+		interner_new(&strings);
+		Program* program = _compile_vm_script(&strings);
+
+		SmolVM vm;
+		vm_new(&vm, program);
+		uint64_t a0 = allocs, b0 = allocBytes;
+		double t0 = _now();
+		if (!vm_run(&vm)) fprintf(stderr, "smol_bench: the VM script failed\n");
+		double t1 = _now();
+		run.allocs = allocs - a0;
+		run.allocBytes = allocBytes - b0;
+		if (t1 - t0 < run.seconds) run.seconds = t1 - t0;
+		instructions = vm.instructions;
+
+		vm_free(&vm);
+		program_free(program);
+		interner_free(&strings);
+	}
+
+	printf("  \"vm\": {\n");
+	printf("    \"instructions\": %llu,\n", (unsigned long long) instructions);
+	printf("    \"seconds\": %.6f,\n", run.seconds);
+	printf("    \"instructions_per_sec\": %.0f,\n", run.seconds > 0 ? instructions / run.seconds : 0.0);
+	printf("    \"allocs\": %llu,\n", (unsigned long long) run.allocs);
+	printf("    \"alloc_bytes\": %llu\n", (unsigned long long) run.allocBytes);
+	printf("  },\n");
+}
+
+typedef struct Isolate_t {
+	const Program* program;
+	uint64_t instructions;
+	int ok;
+} Isolate;
+
+static void* _isolate_main(void* arg) {
+	Isolate* iso = (Isolate*) arg;
+	SmolVM vm;
+	vm_new(&vm, iso->program);
+	iso->ok = vm_run(&vm);
+	iso->instructions = vm.instructions;
+	vm_free(&vm);
+	return NULL;
+}
+
+// The VM script's Program run at once on numThreads isolates.
+static void _bench_isolates(int iterations, int numThreads) {
+	Interner strings;
+	interner_new(&strings);
+	Program* program = _compile_vm_script(&strings);
+	Isolate* isolates = (Isolate*) malloc(sizeof(Isolate) * numThreads);
+	SmolThread* threads = (SmolThread*) malloc(sizeof(SmolThread) * numThreads);
+
+	double best = 1e30;
+	uint64_t instructions = 0;
+	int started = 0;
+	for (int it = 0; it < iterations; it++) {
+		double t0 = _now();
+		started = 0;
+		for (int i = 0; i < numThreads; i++) {
+			isolates[i].program = program;
+			if (thread_start(&threads[i], _isolate_main, &isolates[i])) started++;
+			else _isolate_main(&isolates[i]);
+		}
+		for (int i = 0; i < started; i++) thread_join(threads[i]);
+		double t1 = _now();
+		if (t1 - t0 < best) best = t1 - t0;
+		instructions = 0;
+		for (int i = 0; i < numThreads; i++) {
+			if (!isolates[i].ok) fprintf(stderr, "smol_bench: the VM script failed on an isolate\n");
+			instructions += isolates[i].instructions;
+		}
+	}
+
+	printf("  \"isolates\": {\n");
+	printf("    \"threads\": %d,\n", started > 0 ? numThreads : 1);
+	printf("    \"instructions\": %llu,\n", (unsigned long long) instructions);
+	printf("    \"seconds\": %.6f,\n", best);
+	printf("    \"instructions_per_sec\": %.0f\n", best > 0 ? instructions / best : 0.0);
+	printf("  },\n");
+
+	free(threads);
+	free(isolates);
+	program_free(program);
+	interner_free(&strings);
+}
+
+static void _usage(const char* prog) {
+	printf("Usage: %s [--scale N] [--iterations N] [--seed N] [--isolates N] [--dump DIR]\n", prog);
+	printf("Prints a JSON report; timings are the best of the iterations.\n");
+	printf("--isolates runs the VM script on N threads sharing one program (default 4).\n");
+	printf("--dump writes the generated corpus to DIR/<name>.smol instead.\n");
+}
+
+int main(int argc, char** argv) {
+	int scale = 1, iterations = 5, numIsolates = 4;
+	const char* dump = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) scale = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) iterations = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = (uint32_t) strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--isolates") == 0 && i + 1 < argc) numIsolates = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) dump = argv[++i];
+		else {
+			_usage(argv[0]);
+			return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+		}
+	}
+	if (scale < 1) scale = 1;
+	if (iterations < 1) iterations = 1;
+	if (numIsolates < 1) numIsolates = 1;
+	if (seed == 0) seed = 1;
+	uint32_t initialSeed = seed;
+	int numCorpora = (int) (sizeof(CORPORA) / sizeof(CORPORA[0]));
+
+	if (dump != NULL) {
+		for (int i = 0; i < numCorpora; i++) {
+			Buffer b = { NULL, 0, 0 };
+			_append(&b, "");
+			CORPORA[i].generate(&b, scale);
+			char path[1024];
+			snprintf(path, sizeof(path), "%s/%s.smol", dump, CORPORA[i].name);
+			FILE* fp = fopen(path, "wb");
+			if (fp == NULL) {
+				fprintf(stderr, "Could not write %s\n", path);
+				return 1;
+			}
+			fwrite(b.data, 1, b.length, fp);
+			fclose(fp);
+			free(b.data);
+		}
+		return 0;
+	}
+
+	printf("{\n");
+	printf("  \"schema\": %d,\n", BENCH_SCHEMA);
+	printf("  \"config\": { \"scale\": %d, \"iterations\": %d, \"seed\": %u, \"simd\": \"%s\" },\n", scale, iterations, initialSeed, simd_level());
+	printf("  \"corpora\": [\n");
+	for (int i = 0; i < numCorpora; i++) {
+		_bench_corpus(&CORPORA[i], scale, iterations, i == numCorpora - 1);
+	}
+	printf("  ],\n");
+	_bench_vm(iterations);
+	_bench_isolates(iterations, numIsolates);
+	printf("  \"allocs_counted\": %s,\n", allocs > 0 ? "true" : "false");
+	printf("  \"peak_rss_kb\": %ld\n", _peak_rss_kb());
+	printf("}\n");
+	return 0;
+}
@@ -1,8 +1,10 @@
 grammar smol;
 
-program : stmtList | funDeclStmt*;
+program : stmtList;
 
-block : stmt ';' | '{' stmtList '}';
+block : '{' stmtList '}';
+
+// ';' is optional after the last statement and after statements ending in a block
 stmtList : (stmt ';')*;
 
 stmt
@@ -12,7 +14,9 @@ stmt
 	| letStmt
 	| ifStatement
 	| forStatement
+	| funDeclStmt
 	| ID '(' funArgs? ')'
+	| assignment
 	;
 
 forStatement : 'for' args 'in' expr block;
@@ -25,7 +29,7 @@ elifStmt : 'elif' expr block;
 
 elseStmt : 'else' block;
 
-funDeclStmt : 'fun' ID '(' argsInit ')' block;
+funDeclStmt : 'fun' ID '(' argsInit? ')' block;
 
 letStmt : 'let' argsInit;
 
@@ -43,7 +47,11 @@ bitXOR : bitAND '^' bitXOR | bitAND;
 
 bitAND : comparison '&' bitAND | comparison;
 
-comparison : shifts COMPARE comparison | shifts;
+comparison : range COMPARE comparison | range;
+
+// start..end counts up by 1, start..end..step by step (negative counts
+// down); end is exclusive
+range : shifts ('..' shifts ('..' shifts)?)?;
 
 shifts : addSub ('<<' | '>>') shifts | addSub;
 
@@ -51,7 +59,7 @@ addSub : mulDiv ('+' | '-') addSub | mulDiv;
 
 mulDiv : factor ('*' | '/' | '%') mulDiv | factor;
 
-factor : ('-' | '+' | '!' | '~')? trail;
+factor : ('-' | '+' | '!' | '~') factor | trail;
 
 trail : atom trailer*;
 
@@ -65,7 +73,9 @@ args : ID (',' ID)*;
 
 funArgs : expr (',' expr)*;
 
-argAssign : ID ('=' expr)?;
+argAssign : ID (':' type)? ('=' expr)?;
+
+type : 'int' | 'double' | 'string' | 'bool';
 
 argsInit : argAssign (',' argAssign)*;
 
@@ -74,6 +84,7 @@ atom
 	| ID
 	| STRING
 	| BOOL
+	| 'nil'
 	| '(' expr ')'
 	| '[' funArgs? ']'
 	;
@@ -0,0 +1,38 @@
+#include "arena.h"
+
+#include <stdlib.h>
+
+#define ARENA_ALIGN(x) (((x) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+void arena_new(Arena* arena, size_t blockSize) {
+	arena->head = NULL;
+	arena->blockSize = blockSize > 0 ? blockSize : ARENA_DEFAULT_BLOCK_SIZE;
+}
+
+void arena_free(Arena* arena) {
+	ArenaBlock* block = arena->head;
+	while (block != NULL) {
+		ArenaBlock* next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->head = NULL;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+	size = ARENA_ALIGN(size);
+
+	ArenaBlock* block = arena->head;
+	if (block == NULL || block->used + size > block->size) {
+		size_t blockSize = size > arena->blockSize ? size : arena->blockSize;
+		block = (ArenaBlock*) malloc(sizeof(ArenaBlock) + blockSize);
+		block->size = blockSize;
+		block->used = 0;
+		block->next = arena->head;
+		arena->head = block;
+	}
+
+	void* ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
+}
@@ -0,0 +1,25 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_DEFAULT_BLOCK_SIZE 65536
+
+typedef struct ArenaBlock_t {
+	struct ArenaBlock_t* next;
+	size_t size, used;
+	char data[];
+} ArenaBlock;
+
+// Bump allocator: memory is handed out from large blocks and only released
+// all at once by arena_free.
+typedef struct Arena_t {
+	ArenaBlock* head;
+	size_t blockSize;
+} Arena;
+
+extern void arena_new(Arena* arena, size_t blockSize);
+extern void arena_free(Arena* arena);
+extern void* arena_alloc(Arena* arena, size_t size);
+
+#endif // ARENA_H
@@ -1,10 +1,11 @@
 #include "ast.h"
 
 #include <memory.h>
+#include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 
-static const char* AST_TYPES[] = {
+const char* AST_TYPES[] = {
 	"NT_UNKNOWN",
 	"NT_NUMBER",
 	"NT_STRING",
@@ -72,36 +73,32 @@ static const char* AST_TYPES[] = {
 
 	"NT_TRAIL",
 	"NT_PROGRAM",
-	"NT_FUN_CALL_STMT"
+	"NT_FUN_CALL_STMT",
+
+	"NT_NIL",
+	"NT_RANGE"
 };
 
-Node* node_new() {
-	Node* nd = (Node*) malloc(sizeof(Node));
+Node* node_new(Arena* arena) {
+	Node* nd = (Node*) arena_alloc(arena, sizeof(Node));
 	nd->type = NT_UNKNOWN;
 	nd->string = NULL;
-	nd->capacity = AST_NODE_CHILDREN_CAPACITY;
+	nd->capacity = 0;
 	nd->childCount = 0;
-	nd->children = (Node**) malloc(sizeof(Node*) * nd->capacity);
-	for (int i = 0; i < nd->capacity; i++) nd->children[i] = NULL;
+	nd->children = NULL;
+	nd->line = 0;
+	nd->annotation = 0;
 	return nd;
 }
 
-void node_free(Node* node) {
-	if (node == NULL) return;
-
-	for (int i = 0; i < node->childCount; i++) {
-		node_free(node->children[i]);
-	}
-	node->childCount = 0;
-	node->capacity = 0;
-	free(node->children);
-	free(node);
-}
-
-void node_push_child(Node* root, Node* child) {
+void node_push_child(Arena* arena, Node* root, Node* child) {
 	if (root->childCount >= root->capacity) {
-		root->capacity *= 2;
-		root->children = (Node**) realloc(root->children, sizeof(Node*) * root->capacity);
+		// the old block stays in the arena until the whole tree is released
+		int capacity = root->capacity > 0 ? root->capacity * 2 : AST_NODE_CHILDREN_CAPACITY;
+		Node** children = (Node**) arena_alloc(arena, sizeof(Node*) * capacity);
+		if (root->childCount > 0) memcpy(children, root->children, sizeof(Node*) * root->childCount);
+		root->children = children;
+		root->capacity = capacity;
 	}
 	root->children[root->childCount++] = child;
 }
@@ -110,35 +107,71 @@ void parser_new(Parser* p, Token* tokens, int numTokens) {
 	p->tokens = tokens;
 	p->pos = 0;
 	p->len = numTokens;
+	p->lexer = NULL;
+	p->ringHead = 0;
+	p->ringCount = 0;
+	p->errors = 0;
+	p->errorSink = NULL;
+	arena_new(&p->arena, AST_ARENA_BLOCK_SIZE);
 }
 
-int parser_accept(Parser* p, int type, const char* lexeme) {
-	if (p->pos >= p->len) return 0;
-	if (parser_current(p).type == type) {
-		if (lexeme != NULL) {
-			return strcasecmp(parser_current(p).lexeme, lexeme) == 0;
-		} else {
-			return 1;
-		}
-	}
-	return 0;
+void parser_new_stream(Parser* p, Lexer* lexer) {
+	parser_new(p, NULL, 0);
+	p->lexer = lexer;
 }
 
-int parser_expect(Parser* p, int type, const char* lexeme) {
-	if (parser_accept(p, type, lexeme)) {
+void parser_free(Parser* p) {
+	arena_free(&p->arena);
+}
+
+// line is the one of the construct's first token, taken before its
+// children are parsed.
+Node* parser_node(Parser* p, int line) {
+	Node* nd = node_new(&p->arena);
+	nd->line = line;
+	return nd;
+}
+
+int parser_accept(Parser* p, int type) {
+	return parser_current(p).type == type;
+}
+
+int parser_expect(Parser* p, int type) {
+	if (parser_accept(p, type)) {
 		return 1;
 	}
-	printf("(%d:%d) Expected a %s, got a %s.\n", parser_current(p).line, parser_current(p).column, TOKENS[type], TOKENS[parser_current(p).type]);
+	p->errors++;
+	Token tok = parser_current(p);
+	error_report(p->errorSink, "(%d:%d) Expected a %s, got a %s.", tok.line, tok.column, TOKENS[type], TOKENS[tok.type]);
 	return 0;
 }
 
 void parser_advance(Parser* p) {
-	if (p->pos >= p->len) return;
+	if (p->lexer != NULL) {
+		if (parser_current(p).type == TT_EOF) return;
+		p->ringHead = (p->ringHead + 1) % PARSER_LOOKAHEAD;
+		p->ringCount--;
+		return;
+	}
+	if (p->pos >= p->len - 1) return;
 	p->pos++;
 }
 
 Token parser_current(Parser* p) {
-	return p->tokens[p->pos];
+	return parser_peek(p, 0);
+}
+
+Token parser_peek(Parser* p, int n) {
+	if (p->lexer != NULL) {
+		// pull tokens on demand, the lexer keeps returning TT_EOF at the end
+		while (p->ringCount <= n) {
+			lexer_next(p->lexer, &p->ring[(p->ringHead + p->ringCount) % PARSER_LOOKAHEAD]);
+			p->ringCount++;
+		}
+		return p->ring[(p->ringHead + n) % PARSER_LOOKAHEAD];
+	}
+	int i = p->pos + n;
+	return p->tokens[i < p->len ? i : p->len - 1];
 }
 
 void _printpad(int pad) {
@@ -152,7 +185,10 @@ void ast_print(Node* root, int pad) {
 	switch (root->type) {
 		case NT_NUMBER: _printpad(pad + 2); printf("value = %f\n", root->value); break;
 		case NT_IDENTIFIER:
-		case NT_STRING: _printpad(pad + 2); printf("value = %s\n", root->string); break;
+		case NT_STRING:
+			_printpad(pad + 2); printf("value = %s\n", root->string);
+			if (root->annotation != 0) { _printpad(pad + 2); printf("type = %s\n", TOKENS[root->annotation]); }
+			break;
 		case NT_BOOL: _printpad(pad + 2); printf("value = %s\n", root->boolean ? "true" : "false"); break;
 		case NT_UNARY_MINUS:
 		case NT_UNARY_NOT:
@@ -185,8 +221,10 @@ void ast_print(Node* root, int pad) {
 		case NT_ASSIGN_SUB:
 		case NT_ASSIGN_MUL:
 		case NT_ASSIGN_DIV:
-			_printpad(pad + 2); printf("value = %s\n", root->string);
-			ast_print(root->children[0], pad + 2);
+			if (root->string != NULL) { _printpad(pad + 2); printf("value = %s\n", root->string); }
+			if (root->annotation != 0) { _printpad(pad + 2); printf("type = %s\n", TOKENS[root->annotation]); }
+			for (int i = 0; i < root->childCount; i++)
+				ast_print(root->children[i], pad + 2);
 			break;
 		case NT_ARGS:
 		case NT_FUN_ARGS:
@@ -200,13 +238,14 @@ void ast_print(Node* root, int pad) {
 		case NT_TRAIL:
 		case NT_LIST_ACCESS:
 		case NT_CALL:
-		case NT_FIELD_ACCESS:
 		case NT_PROGRAM:
 		case NT_LIST:
+		case NT_RANGE:
 		case NT_ARGS_INIT: {
 			for (int i = 0; i < root->childCount; i++)
 				ast_print(root->children[i], pad + 2);
 		} break;
+		case NT_FIELD_ACCESS: _printpad(pad + 2); printf("name = %s\n", root->string); break;
 		case NT_FUN_CALL_STMT: {
 			_printpad(pad + 2); printf("name = %s\n", root->string);
 			for (int i = 0; i < root->childCount; i++)
@@ -216,9 +255,10 @@ void ast_print(Node* root, int pad) {
 		case NT_FUN_DECL_STMT: {
 			_printpad(pad + 2); printf("name = %s\n", root->string);
 			ast_print(root->children[0], pad + 2);
+			ast_print(root->children[1], pad + 2);
 		} break;
 		case NT_RETURN:
-			ast_print(root->children[0], pad + 2);
+			if (root->childCount > 0) ast_print(root->children[0], pad + 2);
 			break;
 		default: break;
 	}
@@ -226,39 +266,47 @@ void ast_print(Node* root, int pad) {
 	printf("}\n");
 }
 
+// Reports a missing expression, unless what went wrong while parsing it
+// was reported already.
+static void _check_expr(Parser* p, Node* expr, int errors) {
+	if (expr != NULL || p->errors != errors) return;
+	p->errors++;
+	Token tok = parser_current(p);
+	error_report(p->errorSink, "(%d:%d) Expected an expression, got a %s.", tok.line, tok.column, TOKENS[tok.type]);
+}
+
 Node* ast_parse_trailer(Parser* p) {
-	if (parser_accept(p, TT_LBRACKET, NULL)) {
+	int line = parser_current(p).line;
+	if (parser_accept(p, TT_LBRACKET)) {
 		parser_advance(p);
 		Node* expr = ast_parse_expr(p);
-		if (parser_expect(p, TT_RBRACKET, NULL)) {
+		if (parser_expect(p, TT_RBRACKET)) {
 			parser_advance(p);
 		} else {
-			if (expr) node_free(expr);
 			return NULL;
 		}
-		Node* nd = node_new();
+		Node* nd = parser_node(p, line);
 		nd->type = NT_LIST_ACCESS;
-		node_push_child(nd, expr);
+		node_push_child(&p->arena, nd, expr);
 		return nd;
-	} else if (parser_accept(p, TT_LPAREN, NULL)) {
+	} else if (parser_accept(p, TT_LPAREN)) {
 		parser_advance(p);
 		Node* args = ast_parse_fun_args(p);
-		if (parser_expect(p, TT_RPAREN, NULL)) {
+		if (parser_expect(p, TT_RPAREN)) {
 			parser_advance(p);
 		} else {
-			if (args) node_free(args);
 			return NULL;
 		}
-		Node* nd = node_new();
+		Node* nd = parser_node(p, line);
 		nd->type = NT_CALL;
-		node_push_child(nd, args);
+		node_push_child(&p->arena, nd, args);
 		return nd;
-	} else if (parser_accept(p, TT_POINT, NULL)) {
+	} else if (parser_accept(p, TT_POINT)) {
 		parser_advance(p);
-		if (parser_expect(p, TT_ID, NULL)) {
-			Node* nd = node_new();
-			nd->type = NT_IDENTIFIER;
-			nd->string = parser_current(p).lexeme;
+		if (parser_expect(p, TT_ID)) {
+			Node* nd = parser_node(p, line);
+			nd->type = NT_FIELD_ACCESS;
+			nd->string = parser_current(p).string;
 			parser_advance(p);
 			return nd;
 		}
@@ -267,53 +315,58 @@ Node* ast_parse_trailer(Parser* p) {
 }
 
 Node* ast_parse_atom(Parser* p) {
-	if (parser_accept(p, TT_NUMBER, NULL)) {
-		Node* nd = node_new();
+	if (parser_accept(p, TT_NUMBER)) {
+		Node* nd = parser_node(p, parser_current(p).line);
 		nd->type = NT_NUMBER;
-		nd->value = strtod(parser_current(p).lexeme, NULL);
+		nd->value = parser_current(p).number;
 		parser_advance(p);
 		return nd;
-	} else if (parser_accept(p, TT_BOOL, NULL)) {
-		Node* nd = node_new();
+	} else if (parser_accept(p, TT_KW_TRUE) || parser_accept(p, TT_KW_FALSE)) {
+		Node* nd = parser_node(p, parser_current(p).line);
 		nd->type = NT_BOOL;
-		nd->boolean = strcmp(parser_current(p).lexeme, "true") == 0;
+		nd->boolean = parser_accept(p, TT_KW_TRUE);
 		parser_advance(p);
 		return nd;
-	} else if (parser_accept(p, TT_STRING, NULL)) {
-		Node* nd = node_new();
+	} else if (parser_accept(p, TT_KW_NIL)) {
+		Node* nd = parser_node(p, parser_current(p).line);
+		nd->type = NT_NIL;
+		parser_advance(p);
+		return nd;
+	} else if (parser_accept(p, TT_STRING)) {
+		Node* nd = parser_node(p, parser_current(p).line);
 		nd->type = NT_STRING;
-		nd->string = parser_current(p).lexeme;
+		nd->string = parser_current(p).string;
 		parser_advance(p);
 		return nd;
-	} else if (parser_accept(p, TT_LPAREN, NULL)) {
+	} else if (parser_accept(p, TT_LPAREN)) {
 		parser_advance(p);
+		int errors = p->errors;
 		Node* nd = ast_parse_expr(p);
-		if (parser_expect(p, TT_RPAREN, NULL)) {
+		if (p->errors == errors && parser_expect(p, TT_RPAREN)) {
 			parser_advance(p);
 			return nd;
 		}
-	} else if (parser_accept(p, TT_ID, NULL)) {
-		Node* nd = node_new();
+	} else if (parser_accept(p, TT_ID)) {
+		Node* nd = parser_node(p, parser_current(p).line);
 		nd->type = NT_IDENTIFIER;
-		nd->string = parser_current(p).lexeme;
+		nd->string = parser_current(p).string;
 		parser_advance(p);
 		return nd;
-	} else if (parser_accept(p, TT_LBRACKET, NULL)) {
-		parser_advance(p);
-		Node* nd = node_new();
+	} else if (parser_accept(p, TT_LBRACKET)) {
+		Node* nd = parser_node(p, parser_current(p).line);
 		nd->type = NT_LIST;
-		for (;;) {
-			node_push_child(nd, ast_parse_expr(p));
-			if (parser_accept(p, TT_RBRACKET, NULL)) break;
-			if (parser_expect(p, TT_COMMA, NULL)) {
+		parser_advance(p);
+		while (!parser_accept(p, TT_RBRACKET)) {
+			node_push_child(&p->arena, nd, ast_parse_expr(p));
+			if (parser_accept(p, TT_RBRACKET)) break;
+			if (parser_expect(p, TT_COMMA)) {
 				parser_advance(p);
-			}
+			} else break;
 		}
 
-		if (parser_expect(p, TT_RBRACKET, NULL)) {
+		if (parser_expect(p, TT_RBRACKET)) {
 			parser_advance(p);
 		} else {
-			node_free(nd);
 			return NULL;
 		}
 		return nd;
@@ -323,297 +376,195 @@ Node* ast_parse_atom(Parser* p) {
 }
 
 Node* ast_parse_trail(Parser* p) {
+	int line = parser_current(p).line;
 	Node* at = ast_parse_atom(p);
 	Node* trailer = ast_parse_trailer(p);
 	if (trailer == NULL) return at;
 
-	Node* nd = node_new();
+	// NT_TRAIL { atom, trailer, trailer... }
+	Node* nd = parser_node(p, line);
 	nd->type = NT_TRAIL;
-	node_push_child(nd, at);
-	node_push_child(nd, trailer);
-	return nd;;
-}
-
-Node* ast_parse_factor(Parser* p) {
-	if (parser_accept(p, TT_MINUS, NULL)) {
-		parser_advance(p);
-		Node* nd = node_new();
-		nd->type = NT_UNARY_MINUS;
-		node_push_child(nd, ast_parse_trail(p));
-		return nd;
-	} else if (parser_accept(p, TT_BITNOT, NULL)) {
-		parser_advance(p);
-		Node* nd = node_new();
-		nd->type = NT_UNARY_BITNOT;
-		node_push_child(nd, ast_parse_trail(p));
-	} else if (parser_accept(p, TT_EXCLAMATION, NULL)) {
-		parser_advance(p);
-		Node* nd = node_new();
-		nd->type = NT_UNARY_NOT;
-		node_push_child(nd, ast_parse_trail(p));
-	}
-	return ast_parse_trail(p);
-}
-
-Node* ast_parse_muldiv(Parser* p) {
-	Node* left = ast_parse_factor(p);
-	if (parser_accept(p, TT_ASTERISK, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_muldiv(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_MUL;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	} else if (parser_accept(p, TT_SLASH, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_muldiv(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_DIV;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	} else if (parser_accept(p, TT_PERCENT, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_muldiv(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_MOD;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	}
-	return left;
-}
-
-Node* ast_parse_addsub(Parser* p) {
-	Node* left = ast_parse_muldiv(p);
-	if (parser_accept(p, TT_PLUS, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_addsub(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_ADD;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	} else if (parser_accept(p, TT_MINUS, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_addsub(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_SUB;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	}
-	return left;
-}
-
-Node* ast_parse_shifts(Parser* p) {
-	Node* left = ast_parse_addsub(p);
-	if (parser_accept(p, TT_LSHIFT, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_shifts(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_LSH;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	} else if (parser_accept(p, TT_RSHIFT, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_shifts(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_RSH;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	}
-	return left;
-}
-
-Node* ast_parse_comparison(Parser* p) {
-	Node* left = ast_parse_shifts(p);
-	if (parser_accept(p, TT_GREATER, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_comparison(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_GREATER;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	} else if (parser_accept(p, TT_GREATEREQUALS, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_comparison(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_GREATEREQUALS;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	} else if (parser_accept(p, TT_LESS, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_comparison(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_LESS;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	} else if (parser_accept(p, TT_LESSEQUALS, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_comparison(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_LESSEQUALS;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	} else if (parser_accept(p, TT_COMPEQUALS, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_comparison(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_EQUALITY;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	} else if (parser_accept(p, TT_COMPNOTEQUALS, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_comparison(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_INEQUALITY;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
+	node_push_child(&p->arena, nd, at);
+	while (trailer != NULL) {
+		node_push_child(&p->arena, nd, trailer);
+		trailer = ast_parse_trailer(p);
 	}
-	return left;
+	return nd;
 }
 
-Node* ast_parse_bitand(Parser* p) {
-	Node* left = ast_parse_comparison(p);
-	if (parser_accept(p, TT_BITAND, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_bitand(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_BITAND;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	}
-	return left;
+Node* ast_parse_factor(Parser* p) {
+	int type = NT_UNKNOWN;
+	switch (parser_current(p).type) {
+		case TT_PLUS: parser_advance(p); return ast_parse_factor(p);
+		case TT_MINUS: type = NT_UNARY_MINUS; break;
+		case TT_BITNOT: type = NT_UNARY_BITNOT; break;
+		case TT_EXCLAMATION: type = NT_UNARY_NOT; break;
+		default: return ast_parse_trail(p);
+	}
+	Node* nd = parser_node(p, parser_current(p).line);
+	nd->type = type;
+	parser_advance(p);
+	int errors = p->errors;
+	Node* operand = ast_parse_factor(p);
+	_check_expr(p, operand, errors);
+	node_push_child(&p->arena, nd, operand);
+	return nd;
 }
 
-Node* ast_parse_bitxor(Parser* p) {
-	Node* left = ast_parse_bitand(p);
-	if (parser_accept(p, TT_BITXOR, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_bitxor(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_BITXOR;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	}
-	return left;
-}
+// Binding power of the binary operators, from logicOR (1) to mulDiv (10)
+// as in smol.g4. Every level is left associative.
+enum {
+	PREC_NONE = 0,
+	PREC_LOGICOR,
+	PREC_LOGICAND,
+	PREC_BITOR,
+	PREC_BITXOR,
+	PREC_BITAND,
+	PREC_COMPARISON,
+	PREC_RANGE,
+	PREC_SHIFTS,
+	PREC_ADDSUB,
+	PREC_MULDIV,
+	PREC_MAX
+};
 
-Node* ast_parse_bitor(Parser* p) {
-	Node* left = ast_parse_bitxor(p);
-	if (parser_accept(p, TT_BITOR, NULL)) {
-		parser_advance(p);
-		Node* right = ast_parse_bitor(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_BITOR;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	}
-	return left;
-}
+typedef struct BinaryOp_t {
+	unsigned char prec;
+	unsigned char type; // NT_BINARY_*, NT_RANGE for '..'
+} BinaryOp;
+
+static const BinaryOp BINARY_OPS[TT_KW_NIL + 1] = {
+	[TT_KW_OR] = { PREC_LOGICOR, NT_BINARY_LOGICOR },
+	[TT_KW_AND] = { PREC_LOGICAND, NT_BINARY_LOGICAND },
+	[TT_BITOR] = { PREC_BITOR, NT_BINARY_BITOR },
+	[TT_BITXOR] = { PREC_BITXOR, NT_BINARY_BITXOR },
+	[TT_BITAND] = { PREC_BITAND, NT_BINARY_BITAND },
+	[TT_GREATER] = { PREC_COMPARISON, NT_BINARY_GREATER },
+	[TT_GREATEREQUALS] = { PREC_COMPARISON, NT_BINARY_GREATEREQUALS },
+	[TT_LESS] = { PREC_COMPARISON, NT_BINARY_LESS },
+	[TT_LESSEQUALS] = { PREC_COMPARISON, NT_BINARY_LESSEQUALS },
+	[TT_COMPEQUALS] = { PREC_COMPARISON, NT_BINARY_EQUALITY },
+	[TT_COMPNOTEQUALS] = { PREC_COMPARISON, NT_BINARY_INEQUALITY },
+	[TT_DOTS] = { PREC_RANGE, NT_RANGE },
+	[TT_LSHIFT] = { PREC_SHIFTS, NT_BINARY_LSH },
+	[TT_RSHIFT] = { PREC_SHIFTS, NT_BINARY_RSH },
+	[TT_PLUS] = { PREC_ADDSUB, NT_BINARY_ADD },
+	[TT_MINUS] = { PREC_ADDSUB, NT_BINARY_SUB },
+	[TT_ASTERISK] = { PREC_MULDIV, NT_BINARY_MUL },
+	[TT_SLASH] = { PREC_MULDIV, NT_BINARY_DIV },
+	[TT_PERCENT] = { PREC_MULDIV, NT_BINARY_MOD }
+};
 
-Node* ast_parse_logicand(Parser* p) {
-	Node* left = ast_parse_bitor(p);
-	if (parser_accept(p, TT_KEYWORD, "and")) {
-		parser_advance(p);
-		Node* right = ast_parse_logicand(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_LOGICAND;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
-	}
-	return left;
-}
+// Precedence climbing over the binary levels of smol.g4, parsing operators
+// that bind at least as tightly as minPrec. Right operands are parsed one
+// level up, so `10 - 3 - 2` is `(10 - 3) - 2`. A range is not chained:
+// `a..b..c` is a range with a step and never takes a third '..'.
+Node* ast_parse_binary(Parser* p, int minPrec) {
+	int line = parser_current(p).line;
+	int errors = p->errors;
+	Node* left = ast_parse_factor(p);
+	_check_expr(p, left, errors);
+	if (left == NULL) return NULL;
+	int ranged = 0;
+	for (;;) {
+		int tt = parser_current(p).type;
+		BinaryOp op = tt <= TT_KW_NIL ? BINARY_OPS[tt] : BINARY_OPS[0];
+		if (op.prec == PREC_NONE || op.prec < minPrec) return left;
+		if (op.type == NT_RANGE && ranged) return left;
+		parser_advance(p);
+
+		if (op.type == NT_RANGE) {
+			// range : shifts ('..' shifts ('..' shifts)?)?
+			Node* nd = parser_node(p, line);
+			nd->type = NT_RANGE;
+			node_push_child(&p->arena, nd, left);
+			Node* end = ast_parse_binary(p, PREC_SHIFTS);
+			node_push_child(&p->arena, nd, end);
+			if (parser_accept(p, TT_DOTS)) {
+				parser_advance(p);
+				Node* step = ast_parse_binary(p, PREC_SHIFTS);
+				node_push_child(&p->arena, nd, step);
+			}
+			left = nd;
+			ranged = 1;
+			continue;
+		}
 
-Node* ast_parse_logicor(Parser* p) {
-	Node* left = ast_parse_logicand(p);
-	if (parser_accept(p, TT_KEYWORD, "or")) {
-		parser_advance(p);
-		Node* right = ast_parse_logicor(p);
-		Node* nd = node_new();
-		nd->type = NT_BINARY_LOGICOR;
-		node_push_child(nd, left);
-		node_push_child(nd, right);
-		return nd;
+		Node* right = ast_parse_binary(p, op.prec + 1);
+		Node* nd = parser_node(p, line);
+		nd->type = op.type;
+		node_push_child(&p->arena, nd, left);
+		node_push_child(&p->arena, nd, right);
+		left = nd;
 	}
-	return left;
 }
 
 Node* ast_parse_expr(Parser* p) {
-	Node* cond = ast_parse_logicor(p);
-	if (parser_accept(p, TT_QUESTION, NULL)) {
+	int line = parser_current(p).line;
+	Node* cond = ast_parse_binary(p, PREC_LOGICOR);
+	if (parser_accept(p, TT_QUESTION)) {
 		parser_advance(p);
 		Node* ctrue = ast_parse_expr(p);
-		if (parser_expect(p, TT_COLON, NULL)) {
+		if (parser_expect(p, TT_COLON)) {
 			parser_advance(p);
 			Node* cfalse = ast_parse_expr(p);
 
-			Node* nd = node_new();
+			Node* nd = parser_node(p, line);
 			nd->type = NT_TERNARY;
-			node_push_child(nd, cond);
-			node_push_child(nd, ctrue);
-			node_push_child(nd, cfalse);
+			node_push_child(&p->arena, nd, cond);
+			node_push_child(&p->arena, nd, ctrue);
+			node_push_child(&p->arena, nd, cfalse);
 			return nd;
 		}
 	}
 	return cond;
 }
 
+// NT_ASSIGN* { target, value }
 Node* ast_parse_assignment(Parser* p) {
+	int line = parser_current(p).line;
 	Node* lvalue = ast_parse_expr(p);
-	if (parser_accept(p, TT_EQUALS, NULL)) {
-		Node* nd = node_new();
-		nd->type = NT_ASSIGN;
-		node_push_child(nd, ast_parse_assignment(p));
-		return nd;
-	} else if (parser_accept(p, TT_PLUSEQUALS, NULL)) {
-		Node* nd = node_new();
-		nd->type = NT_ASSIGN_ADD;
-		node_push_child(nd, ast_parse_expr(p));
-		return nd;
-	} else if (parser_accept(p, TT_MINUSEQUALS, NULL)) {
-		Node* nd = node_new();
-		nd->type = NT_ASSIGN_SUB;
-		node_push_child(nd, ast_parse_expr(p));
-		return nd;
-	} else if (parser_accept(p, TT_MULEQUALS, NULL)) {
-		Node* nd = node_new();
-		nd->type = NT_ASSIGN_MUL;
-		node_push_child(nd, ast_parse_expr(p));
-		return nd;
-	} else if (parser_accept(p, TT_DIVEQUALS, NULL)) {
-		Node* nd = node_new();
-		nd->type = NT_ASSIGN_DIV;
-		node_push_child(nd, ast_parse_expr(p));
-		return nd;
-	}
-	return lvalue;
+	int type = NT_UNKNOWN;
+	switch (parser_current(p).type) {
+		case TT_EQUALS: type = NT_ASSIGN; break;
+		case TT_PLUSEQUALS: type = NT_ASSIGN_ADD; break;
+		case TT_MINUSEQUALS: type = NT_ASSIGN_SUB; break;
+		case TT_MULEQUALS: type = NT_ASSIGN_MUL; break;
+		case TT_DIVEQUALS: type = NT_ASSIGN_DIV; break;
+		default: return lvalue;
+	}
+	parser_advance(p);
+
+	Node* nd = parser_node(p, line);
+	nd->type = type;
+	node_push_child(&p->arena, nd, lvalue);
+	Node* value = type == NT_ASSIGN ? ast_parse_assignment(p) : ast_parse_expr(p);
+	node_push_child(&p->arena, nd, value);
+	return nd;
 }
 
 Node* ast_parse_arg_assign(Parser* p) {
-	if (parser_expect(p, TT_ID, NULL)) {
-		Node* nd = node_new();
+	if (parser_expect(p, TT_ID)) {
+		Node* nd = parser_node(p, parser_current(p).line);
 		nd->type = NT_IDENTIFIER;
-		nd->string = parser_current(p).lexeme;
+		nd->string = parser_current(p).string;
 		parser_advance(p);
-		if (parser_accept(p, TT_EQUALS, NULL)) {
+		if (parser_accept(p, TT_COLON)) {
+			parser_advance(p);
+			Token tok = parser_current(p);
+			if (tok.type == TT_KW_INT || tok.type == TT_KW_DOUBLE || tok.type == TT_KW_STRING || tok.type == TT_KW_BOOL) {
+				nd->annotation = tok.type;
+				parser_advance(p);
+			} else {
+				p->errors++;
+				error_report(p->errorSink, "(%d:%d) Expected a type, got a %s.", tok.line, tok.column, TOKENS[tok.type]);
+			}
+		}
+		if (parser_accept(p, TT_EQUALS)) {
 			parser_advance(p);
 			nd->type = NT_ASSIGN;
-			node_push_child(nd, ast_parse_expr(p));
+			Node* value = ast_parse_expr(p);
+			node_push_child(&p->arena, nd, value);
 		}
 		return nd;
 	}
@@ -621,33 +572,27 @@ Node* ast_parse_arg_assign(Parser* p) {
 }
 
 Node* ast_parse_args_init(Parser* p) {
-	Node* nd = node_new();
+	Node* nd = parser_node(p, parser_current(p).line);
 	nd->type = NT_ARGS_INIT;
 	// get first
+	if (parser_accept(p, TT_RPAREN)) return nd;
+
 	Node* first = ast_parse_arg_assign(p);
 	if (first != NULL) {
-		node_push_child(nd, first);
-		for (;;) {
-			if (parser_accept(p, TT_SEMICOLON, NULL)) {
-				break;
-			} else if (parser_accept(p, TT_RBRACKET, NULL)) {
-				break;
-			}
-			
-			if (parser_expect(p, TT_COMMA, NULL)) {
-				parser_advance(p);
-			} else break;
-			node_push_child(nd, ast_parse_arg_assign(p));
+		node_push_child(&p->arena, nd, first);
+		while (parser_accept(p, TT_COMMA)) {
+			parser_advance(p);
+			node_push_child(&p->arena, nd, ast_parse_arg_assign(p));
 		}
 	}
 	return nd;
 }
 
 Node* ast_parse_identifier(Parser* p) {
-	if (parser_expect(p, TT_ID, NULL)) {
-		Node* nd = node_new();
+	if (parser_expect(p, TT_ID)) {
+		Node* nd = parser_node(p, parser_current(p).line);
 		nd->type = NT_IDENTIFIER;
-		nd->string = parser_current(p).lexeme;
+		nd->string = parser_current(p).string;
 		parser_advance(p);
 		return nd;
 	}
@@ -655,13 +600,13 @@ Node* ast_parse_identifier(Parser* p) {
 }
 
 Node* ast_parse_args(Parser* p) {
-	Node* nd = node_new();
+	Node* nd = parser_node(p, parser_current(p).line);
 	nd->type = NT_ARGS;
-	while (parser_accept(p, TT_ID, NULL)) {
-		node_push_child(nd, ast_parse_identifier(p));
-		if (parser_accept(p, TT_EOF, NULL)) break;
-		if (parser_accept(p, TT_KEYWORD, NULL)) break;
-		if (parser_expect(p, TT_COMMA, NULL)) {
+	while (parser_accept(p, TT_ID)) {
+		node_push_child(&p->arena, nd, ast_parse_identifier(p));
+		if (parser_accept(p, TT_EOF)) break;
+		if (TT_IS_KEYWORD(parser_current(p).type)) break;
+		if (parser_expect(p, TT_COMMA)) {
 			parser_advance(p);
 		}
 	}
@@ -669,13 +614,13 @@ Node* ast_parse_args(Parser* p) {
 }
 
 Node* ast_parse_fun_args(Parser* p) {
-	Node* nd = node_new();
+	Node* nd = parser_node(p, parser_current(p).line);
 	nd->type = NT_FUN_ARGS;
-	while (!parser_accept(p, TT_EOF, NULL) && !parser_accept(p, TT_RPAREN, NULL)) {
-		node_push_child(nd, ast_parse_expr(p));
-		if (parser_accept(p, TT_RPAREN, NULL)) break;
-		if (parser_accept(p, TT_EOF, NULL)) break;
-		if (parser_expect(p, TT_COMMA, NULL)) {
+	while (!parser_accept(p, TT_EOF) && !parser_accept(p, TT_RPAREN)) {
+		node_push_child(&p->arena, nd, ast_parse_expr(p));
+		if (parser_accept(p, TT_RPAREN)) break;
+		if (parser_accept(p, TT_EOF)) break;
+		if (parser_expect(p, TT_COMMA)) {
 			parser_advance(p);
 		}
 	}
@@ -683,141 +628,156 @@ Node* ast_parse_fun_args(Parser* p) {
 }
 
 Node* ast_parse_let_stmt(Parser* p) {
-	if (parser_accept(p, TT_KEYWORD, "let")) {
-		parser_advance(p);
-		Node* nd = node_new();
+	if (parser_accept(p, TT_KW_LET)) {
+		Node* nd = parser_node(p, parser_current(p).line);
 		nd->type = NT_LET_STMT;
-		node_push_child(nd, ast_parse_args_init(p));
+		parser_advance(p);
+		node_push_child(&p->arena, nd, ast_parse_args_init(p));
 		return nd;
 	}
 	return NULL;
 }
 
 Node* ast_parse_fun_def_stmt(Parser* p) {
-	if (parser_accept(p, TT_KEYWORD, "fun")) {
+	if (parser_accept(p, TT_KW_FUN)) {
+		int line = parser_current(p).line;
 		parser_advance(p);
-		if (parser_expect(p, TT_ID, NULL)) {
-			Node* nd = node_new();
+		if (parser_expect(p, TT_ID)) {
+			Node* nd = parser_node(p, line);
 			nd->type = NT_FUN_DECL_STMT;
-			nd->string = parser_current(p).lexeme;
+			nd->string = parser_current(p).string;
 			parser_advance(p);
-			if (parser_expect(p, TT_LPAREN, NULL)) {
+			if (parser_expect(p, TT_LPAREN)) {
 				parser_advance(p);
-				node_push_child(nd, ast_parse_args(p));
-				if (parser_expect(p, TT_RPAREN, NULL)) {
+				node_push_child(&p->arena, nd, ast_parse_args_init(p));
+				if (parser_expect(p, TT_RPAREN)) {
 					parser_advance(p);
+					Node* body = ast_parse_block(p);
+					if (body == NULL) return NULL;
+					node_push_child(&p->arena, nd, body);
 					return nd;
-				} else node_free(nd);
-			} else node_free(nd);
+				}
+			}
 		}
 	}
 	return NULL;
 }
 
 Node* ast_parse_stmt(Parser* p) {
-	if (parser_accept(p, TT_KEYWORD, "return")) {
-		parser_advance(p);
-		Node* nd = node_new();
+	if (parser_accept(p, TT_KW_RETURN)) {
+		Node* nd = parser_node(p, parser_current(p).line);
 		nd->type = NT_RETURN;
-		if (!parser_accept(p, TT_SEMICOLON, NULL)) {
-			node_push_child(nd, ast_parse_expr(p));
+		parser_advance(p);
+		if (!parser_accept(p, TT_SEMICOLON) && !parser_accept(p, TT_RBRACE) && !parser_accept(p, TT_EOF)) {
+			node_push_child(&p->arena, nd, ast_parse_expr(p));
 		}
 		return nd;
-	} else if (parser_accept(p, TT_KEYWORD, "continue")) {
-		Node* nd = node_new();
+	} else if (parser_accept(p, TT_KW_CONTINUE)) {
+		Node* nd = parser_node(p, parser_current(p).line);
 		nd->type = NT_CONTINUE;
+		parser_advance(p);
 		return nd;
-	} else if (parser_accept(p, TT_KEYWORD, "break")) {
-		Node* nd = node_new();
+	} else if (parser_accept(p, TT_KW_BREAK)) {
+		Node* nd = parser_node(p, parser_current(p).line);
 		nd->type = NT_BREAK;
+		parser_advance(p);
 		return nd;
-	} else if (parser_accept(p, TT_KEYWORD, "let")) {
+	} else if (parser_accept(p, TT_KW_LET)) {
 		return ast_parse_let_stmt(p);
-	} else if (parser_accept(p, TT_KEYWORD, "fun")) {
+	} else if (parser_accept(p, TT_KW_FUN)) {
 		return ast_parse_fun_def_stmt(p);
-	} else if (parser_accept(p, TT_KEYWORD, "if")) {
+	} else if (parser_accept(p, TT_KW_IF)) {
 		return ast_parse_if_stmt(p);
-	} else if (parser_accept(p, TT_KEYWORD, "for")) {
+	} else if (parser_accept(p, TT_KW_FOR)) {
 		return ast_parse_for_stmt(p);
-	} else if (parser_accept(p, TT_ID, NULL)) {
+	} else if (parser_accept(p, TT_ID) && parser_peek(p, 1).type == TT_LPAREN) {
 		return ast_parse_fun_call_stmt(p);
 	}
-	return ast_parse_expr(p);
+	return ast_parse_assignment(p);
 }
 
 Node* ast_parse_stmt_list(Parser* p) {
-	Node* nd = node_new();
+	Node* nd = parser_node(p, parser_current(p).line);
 	nd->type = NT_STMT_LIST;
-	while (!parser_accept(p, TT_EOF, NULL) && !parser_accept(p, TT_RBRACE, NULL)) {
-		node_push_child(nd, ast_parse_stmt(p));
-		if (parser_accept(p, TT_EOF, NULL)) break;
-		if (parser_accept(p, TT_RBRACE, NULL)) {
+	while (!parser_accept(p, TT_EOF) && !parser_accept(p, TT_RBRACE)) {
+		int errors = p->errors;
+		Node* stmt = ast_parse_stmt(p);
+		node_push_child(&p->arena, nd, stmt);
+		if (parser_accept(p, TT_SEMICOLON)) {
 			parser_advance(p);
-			break;
+			continue;
 		}
-		if (!parser_expect(p, TT_SEMICOLON, NULL)) break;
-		parser_advance(p);
+
+		// the last statement and the ones ending in a block don't need a ';'
+		if (parser_accept(p, TT_EOF) || parser_accept(p, TT_RBRACE)) break;
+		if (stmt != NULL && (stmt->type == NT_IF_STMT || stmt->type == NT_FOR_STMT || stmt->type == NT_FUN_DECL_STMT)) continue;
+		// a broken statement was reported already
+		if (p->errors == errors) parser_expect(p, TT_SEMICOLON);
+		break;
 	}
 	return nd;
 }
 
 Node* ast_parse_block(Parser* p) {
-	if (parser_expect(p, TT_LBRACE, NULL)) {
+	if (parser_expect(p, TT_LBRACE)) {
 		parser_advance(p);
 		Node* stmts = ast_parse_stmt_list(p);
-		if (parser_expect(p, TT_RBRACE, NULL)) {
+		if (parser_expect(p, TT_RBRACE)) {
 			parser_advance(p);
 			return stmts;
-		} else node_free(stmts);
+		}
 	}
 	return NULL;
 }
 
 Node* ast_parse_if(Parser* p) {
-	if (parser_expect(p, TT_KEYWORD, "if")) {
+	if (parser_expect(p, TT_KW_IF)) {
+		int line = parser_current(p).line;
 		parser_advance(p);
 		Node* cond = ast_parse_expr(p);
-		if (parser_expect(p, TT_LBRACE, NULL) && cond != NULL) {
+		if (parser_expect(p, TT_LBRACE) && cond != NULL) {
 			Node* body = ast_parse_block(p);
 			if (body != NULL) {
-				Node* nd = node_new();
+				Node* nd = parser_node(p, line);
 				nd->type = NT_IF;
-				node_push_child(nd, cond);
-				node_push_child(nd, body);
+				node_push_child(&p->arena, nd, cond);
+				node_push_child(&p->arena, nd, body);
 				return nd;
 			}
-		} else node_free(cond);
+		}
 	}
 	return NULL;
 }
 
 Node* ast_parse_elif(Parser* p) {
-	if (parser_expect(p, TT_KEYWORD, "elif")) {
+	if (parser_expect(p, TT_KW_ELIF)) {
+		int line = parser_current(p).line;
 		parser_advance(p);
 		Node* cond = ast_parse_expr(p);
-		if (parser_expect(p, TT_LBRACE, NULL) && cond != NULL) {
+		if (parser_expect(p, TT_LBRACE) && cond != NULL) {
 			Node* body = ast_parse_block(p);
 			if (body != NULL) {
-				Node* nd = node_new();
+				Node* nd = parser_node(p, line);
 				nd->type = NT_ELSEIF;
-				node_push_child(nd, cond);
-				node_push_child(nd, body);
+				node_push_child(&p->arena, nd, cond);
+				node_push_child(&p->arena, nd, body);
 				return nd;
 			}
-		} else node_free(cond);
+		}
 	}
 	return NULL;
 }
 
 Node* ast_parse_else(Parser* p) {
-	if (parser_expect(p, TT_KEYWORD, "else")) {
+	if (parser_expect(p, TT_KW_ELSE)) {
+		int line = parser_current(p).line;
 		parser_advance(p);
-		if (parser_expect(p, TT_LBRACE, NULL)) {
+		if (parser_expect(p, TT_LBRACE)) {
 			Node* body = ast_parse_block(p);
 			if (body != NULL) {
-				Node* nd = node_new();
+				Node* nd = parser_node(p, line);
 				nd->type = NT_ELSE;
-				node_push_child(nd, body);
+				node_push_child(&p->arena, nd, body);
 				return nd;
 			}
 		}
@@ -826,22 +786,21 @@ Node* ast_parse_else(Parser* p) {
 }
 
 Node* ast_parse_if_stmt(Parser* p) {
-	if (parser_accept(p, TT_KEYWORD, "if")) {
-		Node* nd = node_new();
+	if (parser_accept(p, TT_KW_IF)) {
+		Node* nd = parser_node(p, parser_current(p).line);
 		nd->type = NT_IF_STMT;
-		node_push_child(nd, ast_parse_if(p));
+		node_push_child(&p->arena, nd, ast_parse_if(p));
 
 		if (nd->children[0] == NULL) {
-			node_free(nd);
 			return NULL;
 		}
 
-		while (parser_accept(p, TT_KEYWORD, "elif")) {
-			node_push_child(nd, ast_parse_elif(p));
+		while (parser_accept(p, TT_KW_ELIF)) {
+			node_push_child(&p->arena, nd, ast_parse_elif(p));
 		}
 
-		if (parser_accept(p, TT_KEYWORD, "else")) {
-			node_push_child(nd, ast_parse_else(p));
+		if (parser_accept(p, TT_KW_ELSE)) {
+			node_push_child(&p->arena, nd, ast_parse_else(p));
 		}
 
 		return nd;
@@ -850,63 +809,63 @@ Node* ast_parse_if_stmt(Parser* p) {
 }
 
 Node* ast_parse_for_stmt(Parser* p) {
-	if (parser_accept(p, TT_KEYWORD, "for")) {
+	if (parser_accept(p, TT_KW_FOR)) {
+		int line = parser_current(p).line;
 		parser_advance(p);
 		Node* args = ast_parse_args(p);
 		if (args == NULL) {
 			return NULL;
 		}
 
-		if (parser_expect(p, TT_KEYWORD, "in")) {
+		if (parser_expect(p, TT_KW_IN)) {
 			parser_advance(p);
 			Node* expr = ast_parse_expr(p);
 			if (expr == NULL) {
-				node_free(args);
 				return NULL;
 			}
 			Node* block = ast_parse_block(p);
 			if (block == NULL) {
-				node_free(args);
 				return NULL;
 			}
 
-			Node* nd = node_new();
+			Node* nd = parser_node(p, line);
 			nd->type = NT_FOR_STMT;
-			node_push_child(nd, args);
-			node_push_child(nd, expr);
-			node_push_child(nd, block);
+			node_push_child(&p->arena, nd, args);
+			node_push_child(&p->arena, nd, expr);
+			node_push_child(&p->arena, nd, block);
 			return nd;
-		} else node_free(args);
+		}
 	}
 	return NULL;
 }
 
 Node* ast_parse_fun_call_stmt(Parser* p) {
-	if (parser_expect(p, TT_ID, NULL)) {
-		Node* nd = node_new();
+	if (parser_expect(p, TT_ID)) {
+		Node* nd = parser_node(p, parser_current(p).line);
 		nd->type = NT_FUN_CALL_STMT;
-		nd->string = parser_current(p).lexeme;
+		nd->string = parser_current(p).string;
 		parser_advance(p);
-		if (parser_expect(p, TT_LPAREN, NULL)) {
+		if (parser_expect(p, TT_LPAREN)) {
 			parser_advance(p);
 			Node* args = ast_parse_fun_args(p);
 			if (args != NULL) {
-				node_push_child(nd, args);
+				node_push_child(&p->arena, nd, args);
 			}
 
-			if (parser_expect(p, TT_RPAREN, NULL)) {
+			if (parser_expect(p, TT_RPAREN)) {
 				parser_advance(p);
 				return nd;
 			}
-			node_free(nd);
-		} else node_free(nd);
+		}
 	}
 	return NULL;
 }
 
 Node* ast_parse_program(Parser* p) {
-	Node* nd = node_new();
+	Node* nd = parser_node(p, parser_current(p).line);
 	nd->type = NT_PROGRAM;
-	node_push_child(nd, ast_parse_stmt_list(p));
+	node_push_child(&p->arena, nd, ast_parse_stmt_list(p));
+	// the statement list stops early at a stray '}'
+	if (p->errors == 0) parser_expect(p, TT_EOF);
 	return nd;
 }
\ No newline at end of file
@@ -2,8 +2,11 @@
 #define AST_H
 
 #include "lexer.h"
+#include "arena.h"
+#include "error.h"
 
-#define AST_NODE_CHILDREN_CAPACITY 10
+#define AST_NODE_CHILDREN_CAPACITY 4
+#define AST_ARENA_BLOCK_SIZE 65536
 
 typedef struct Node_t {
 	enum {
@@ -76,51 +79,67 @@ typedef struct Node_t {
 
 		NT_PROGRAM,
 
-		NT_FUN_CALL_STMT
+		NT_FUN_CALL_STMT,
+
+		NT_NIL,
+		NT_RANGE // start, end, optional step
 
 		// TODO: Add More
 	} type;
 
 	union {
 		double value;
-		char* string;
+		const char* string; // interned
 		int boolean;
 	};
 
 	struct Node_t** children;
 	int childCount;
 	int capacity;
+	int line;
+	int annotation; // TT_KW_INT and so on after `name:`, 0 without
 } Node;
 
-extern Node* node_new();
-extern void node_free(Node* node);
-extern void node_push_child(Node* root, Node* child);
+extern const char* AST_TYPES[];
+
+// Nodes and their children arrays live in the parser's arena and are all
+// released together by parser_free.
+extern Node* node_new(Arena* arena);
+extern void node_push_child(Arena* arena, Node* root, Node* child);
+
+#define PARSER_LOOKAHEAD 4
 
+// Parses either a pre-lexed token array (ending with TT_EOF) or, when created
+// with parser_new_stream, tokens pulled from a Lexer through a small ring.
 typedef struct Parser_t {
 	Token* tokens;
 	int pos, len;
+
+	Lexer* lexer;
+	Token ring[PARSER_LOOKAHEAD];
+	int ringHead, ringCount;
+
+	Arena arena;
+	int errors;
+	ErrorSink* errorSink; // NULL prints them
 } Parser;
 
 extern void parser_new(Parser* p, Token* tokens, int numTokens);
-extern int parser_accept(Parser* p, int type, const char* lexeme);
-extern int parser_expect(Parser* p, int type, const char* lexeme);
+extern void parser_new_stream(Parser* p, Lexer* lexer);
+extern void parser_free(Parser* p);
+extern Node* parser_node(Parser* p, int line);
+extern int parser_accept(Parser* p, int type);
+extern int parser_expect(Parser* p, int type);
 extern void parser_advance(Parser* p);
 extern Token parser_current(Parser* p);
+extern Token parser_peek(Parser* p, int n);
 
 extern Node* ast_parse_trailer(Parser* p);
 
 extern Node* ast_parse_atom(Parser* p);
 extern Node* ast_parse_trail(Parser* p);
 extern Node* ast_parse_factor(Parser* p);
-extern Node* ast_parse_muldiv(Parser* p);
-extern Node* ast_parse_addsub(Parser* p);
-extern Node* ast_parse_shifts(Parser* p);
-extern Node* ast_parse_comparison(Parser* p);
-extern Node* ast_parse_bitand(Parser* p);
-extern Node* ast_parse_bitor(Parser* p);
-extern Node* ast_parse_bitxor(Parser* p);
-extern Node* ast_parse_logicand(Parser* p);
-extern Node* ast_parse_logicor(Parser* p);
+extern Node* ast_parse_binary(Parser* p, int minPrec);
 extern Node* ast_parse_expr(Parser* p);
 extern Node* ast_parse_assignment(Parser* p);
 
@@ -0,0 +1,245 @@
+#include "build.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "fold.h"
+#include "pool.h"
+
+static Program* _compile_tokens(Token* tokens, int numTokens, Interner* strings, ErrorSink* errors, const CompileOptions* options) {
+	Parser p;
+	parser_new(&p, tokens, numTokens);
+	p.errorSink = errors;
+	Node* root = ast_parse_program(&p);
+	Program* program = NULL;
+	if (p.errors == 0) {
+		ast_fold(root, strings);
+		program = compile_program(root, strings, errors, options);
+	}
+	parser_free(&p);
+	return program;
+}
+
+Program* build_compile(const char* data, size_t size, Interner* strings, ErrorSink* errors, const CompileOptions* options) {
+	Token* tokens;
+	int numTokens = lexer_lex_buffer(data, (int) size, strings, &tokens);
+	Program* program = _compile_tokens(tokens, numTokens, strings, errors, options);
+	free(tokens);
+	return program;
+}
+
+void build_unit_new(BuildUnit* unit, const char* path, const char* data, size_t size, const char* cachePath) {
+	unit->path = path;
+	unit->data = data;
+	unit->size = size;
+	unit->cachePath = cachePath;
+	interner_new(&unit->strings);
+	error_sink_new(&unit->errors, NULL);
+	unit->program = NULL;
+	unit->tokens = NULL;
+	unit->numTokens = 0;
+	unit->chunks = NULL;
+	unit->numChunks = 0;
+	unit->remaining = 0;
+	mutex_new(&unit->lock);
+	unit->split = 0;
+	memset(&unit->options, 0, sizeof(CompileOptions));
+}
+
+void build_unit_free(BuildUnit* unit) {
+	program_free(unit->program);
+	unit->program = NULL;
+	error_sink_free(&unit->errors);
+	interner_free(&unit->strings);
+	mutex_free(&unit->lock);
+}
+
+// Token indices where chunks start: top level `fun`s after a complete
+// statement, at least target tokens apart. Returns the number of chunks,
+// 1 when the script can't be split.
+static int _find_chunks(Token* tokens, int numTokens, int target, int** starts) {
+	int count = 1, cap = 16;
+	*starts = (int*) malloc(sizeof(int) * cap);
+	(*starts)[0] = 0;
+	int depth = 0;
+	for (int i = 0; i < numTokens; i++) {
+		switch (tokens[i].type) {
+			case TT_LBRACE: case TT_LPAREN: case TT_LBRACKET: depth++; break;
+			case TT_RBRACE: case TT_RPAREN: case TT_RBRACKET:
+				// a stray closer ends the program early, leave that to one parser
+				if (--depth < 0) return 1;
+				break;
+			case TT_KW_FUN: {
+				int prev = i > 0 ? tokens[i - 1].type : TT_EOF;
+				if (depth != 0 || i - (*starts)[count - 1] < target) break;
+				if (prev != TT_SEMICOLON && prev != TT_RBRACE) break;
+				if (count == cap) {
+					cap *= 2;
+					*starts = (int*) realloc(*starts, sizeof(int) * cap);
+				}
+				(*starts)[count++] = i;
+			} break;
+		}
+	}
+	return count;
+}
+
+static void _unit_finish(BuildUnit* unit) {
+	if (unit->program != NULL && unit->cachePath != NULL) {
+		cache_write(unit->program, unit->cachePath, cache_hash(unit->data, unit->size), unit->size);
+	}
+}
+
+// Runs on the thread that finished the last chunk.
+static void _unit_assemble(BuildUnit* unit) {
+	unit->strings.lock = NULL;
+
+	// parse errors in order; the statement list of the whole script would
+	// have stopped where a chunk's did
+	int errors = 0;
+	for (int i = 0; i < unit->numChunks; i++) {
+		BuildChunk* chunk = &unit->chunks[i];
+		errors += chunk->parser.errors;
+		error_sink_append(&unit->errors, &chunk->errors);
+		if (!chunk->complete) break;
+	}
+
+	if (errors == 0) {
+		Parser* first = &unit->chunks[0].parser;
+		Node* root = node_new(&first->arena);
+		root->type = NT_PROGRAM;
+		root->line = unit->chunks[0].root->line;
+		Node* stmts = node_new(&first->arena);
+		stmts->type = NT_STMT_LIST;
+		stmts->line = root->line;
+		node_push_child(&first->arena, root, stmts);
+
+		int numPre = 0;
+		for (int i = 0; i < unit->numChunks; i++) {
+			numPre += unit->chunks[i].numPre;
+		}
+		Precompiled* pre = (Precompiled*) malloc(sizeof(Precompiled) * (numPre > 0 ? numPre : 1));
+		numPre = 0;
+		for (int i = 0; i < unit->numChunks; i++) {
+			BuildChunk* chunk = &unit->chunks[i];
+			Node* list = chunk->root->children[0];
+			for (int j = 0; j < list->childCount; j++) {
+				node_push_child(&first->arena, stmts, list->children[j]);
+			}
+			memcpy(pre + numPre, chunk->pre, sizeof(Precompiled) * chunk->numPre);
+			numPre += chunk->numPre;
+			chunk->numPre = 0;
+		}
+
+		unit->program = compile_program_with(root, &unit->strings, &unit->errors, pre, numPre, &unit->options);
+		for (int i = 0; i < numPre; i++) {
+			precompiled_free(&pre[i]);
+		}
+		free(pre);
+	}
+
+	for (int i = 0; i < unit->numChunks; i++) {
+		BuildChunk* chunk = &unit->chunks[i];
+		for (int j = 0; j < chunk->numPre; j++) {
+			precompiled_free(&chunk->pre[j]);
+		}
+		free(chunk->pre);
+		parser_free(&chunk->parser);
+		error_sink_free(&chunk->errors);
+		free(chunk->tokens);
+	}
+	free(unit->chunks);
+	unit->chunks = NULL;
+	free(unit->tokens);
+	unit->tokens = NULL;
+	_unit_finish(unit);
+}
+
+static void _chunk_task(Pool* pool, void* arg) {
+	(void) pool;
+	BuildChunk* chunk = (BuildChunk*) arg;
+	BuildUnit* unit = chunk->unit;
+
+	parser_new(&chunk->parser, chunk->tokens, chunk->numTokens);
+	chunk->parser.errorSink = &chunk->errors;
+	chunk->root = ast_parse_program(&chunk->parser);
+	chunk->complete = parser_accept(&chunk->parser, TT_EOF);
+
+	if (chunk->parser.errors == 0) {
+		// the interner is locked while chunks run
+		ast_fold(chunk->root, &unit->strings);
+		Node* list = chunk->root->children[0];
+		chunk->pre = (Precompiled*) malloc(sizeof(Precompiled) * (list->childCount > 0 ? list->childCount : 1));
+		for (int i = 0; i < list->childCount; i++) {
+			Node* stmt = list->children[i];
+			if (stmt == NULL || stmt->type != NT_FUN_DECL_STMT) continue;
+			compile_function(&chunk->pre[chunk->numPre++], stmt, &unit->strings, &unit->options);
+		}
+	}
+
+	mutex_lock(&unit->lock);
+	int last = --unit->remaining == 0;
+	mutex_unlock(&unit->lock);
+	if (last) _unit_assemble(unit);
+}
+
+static void _unit_task(Pool* pool, void* arg) {
+	BuildUnit* unit = (BuildUnit*) arg;
+	if (unit->cachePath != NULL) {
+		unit->program = cache_load(unit->cachePath, cache_hash(unit->data, unit->size), unit->size, &unit->strings);
+		if (unit->program != NULL) return;
+	}
+
+	unit->numTokens = lexer_lex_buffer(unit->data, (int) unit->size, &unit->strings, &unit->tokens);
+
+	int* starts = NULL;
+	int numChunks = 1;
+	if (unit->split && pool->numWorkers > 1 && unit->numTokens >= 2 * BUILD_CHUNK_MIN_TOKENS) {
+		int target = unit->numTokens / (pool->numWorkers * 4);
+		numChunks = _find_chunks(unit->tokens, unit->numTokens, target > BUILD_CHUNK_MIN_TOKENS ? target : BUILD_CHUNK_MIN_TOKENS, &starts);
+	}
+
+	if (numChunks <= 1) {
+		free(starts);
+		unit->program = _compile_tokens(unit->tokens, unit->numTokens, &unit->strings, &unit->errors, &unit->options);
+		free(unit->tokens);
+		unit->tokens = NULL;
+		_unit_finish(unit);
+		return;
+	}
+
+	unit->chunks = (BuildChunk*) calloc(numChunks, sizeof(BuildChunk));
+	unit->numChunks = numChunks;
+	unit->remaining = numChunks;
+	for (int i = 0; i < numChunks; i++) {
+		BuildChunk* chunk = &unit->chunks[i];
+		int start = starts[i];
+		int end = i + 1 < numChunks ? starts[i + 1] : unit->numTokens - 1;
+		chunk->unit = unit;
+		chunk->numTokens = end - start + 1;
+		chunk->tokens = (Token*) malloc(sizeof(Token) * chunk->numTokens);
+		memcpy(chunk->tokens, unit->tokens + start, sizeof(Token) * (end - start));
+		// ends where the next chunk starts
+		chunk->tokens[end - start] = unit->tokens[end];
+		chunk->tokens[end - start].type = TT_EOF;
+		error_sink_new(&chunk->errors, NULL);
+	}
+	free(starts);
+
+	// chunks fold concurrently, which interns
+	unit->strings.lock = &unit->lock;
+	for (int i = 0; i < numChunks; i++) {
+		pool_submit(pool, _chunk_task, &unit->chunks[i]);
+	}
+}
+
+void build_run(BuildUnit* units, int numUnits, int numThreads, int split) {
+	Pool pool;
+	pool_new(&pool, numThreads);
+	for (int i = 0; i < numUnits; i++) {
+		units[i].split = split;
+		pool_submit(&pool, _unit_task, &units[i]);
+	}
+	pool_free(&pool);
+}
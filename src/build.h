@@ -0,0 +1,66 @@
+#ifndef BUILD_H
+#define BUILD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compiler.h"
+#include "error.h"
+#include "intern.h"
+#include "thread.h"
+
+// Lexes, parses, folds and compiles source on the calling thread. Sessions
+// share no state, so threads may compile at once as long as each has its
+// own strings and errors.
+extern Program* build_compile(const char* data, size_t size, Interner* strings, ErrorSink* errors, const CompileOptions* options);
+
+// Split scripts get chunks of about this many tokens or more.
+#define BUILD_CHUNK_MIN_TOKENS 4096
+
+struct BuildUnit_t;
+
+// A run of top level statements starting at a `fun`, parsed and compiled
+// on its own.
+typedef struct BuildChunk_t {
+	struct BuildUnit_t* unit;
+	Token* tokens; // [start, end) of the unit's tokens plus a TT_EOF
+	int numTokens;
+	Parser parser;
+	ErrorSink errors;
+	Node* root;
+	int complete; // the statement list reached the end of the chunk
+	Precompiled* pre;
+	int numPre;
+} BuildChunk;
+
+// One script compiled by build_run, with its own strings and errors.
+typedef struct BuildUnit_t {
+	const char* path;
+	const char* data; // owned by the caller
+	size_t size;
+	const char* cachePath; // .smolc to load or write, NULL for none
+
+	Interner strings;
+	ErrorSink errors; // buffered, flush after build_run
+	Program* program; // NULL when it failed
+
+	Token* tokens;
+	int numTokens;
+	BuildChunk* chunks;
+	int numChunks, remaining;
+	SmolMutex lock;
+	int split;
+	CompileOptions options; // all zeros until the caller sets them
+} BuildUnit;
+
+extern void build_unit_new(BuildUnit* unit, const char* path, const char* data, size_t size, const char* cachePath);
+// Frees the program too, unless the caller took it (set unit->program to NULL).
+extern void build_unit_free(BuildUnit* unit);
+
+// Compiles the units on a work-stealing pool of numThreads threads. With
+// split, large scripts are also cut at top level `fun`s and their chunks
+// parsed and compiled in parallel; programs and errors are the same as
+// compiling each script by itself.
+extern void build_run(BuildUnit* units, int numUnits, int numThreads, int split);
+
+#endif // BUILD_H
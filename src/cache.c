@@ -0,0 +1,319 @@
+#define _POSIX_C_SOURCE 200809L
+#include "cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+uint64_t cache_hash(const char* data, size_t size) {
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (unsigned char) data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static void _pad(FILE* fp, long align) {
+	static const char zeros[8] = { 0 };
+	long pos = ftell(fp);
+	if (pos % align != 0) fwrite(zeros, 1, align - pos % align, fp);
+}
+
+// Gives str the next string index unless it already has one.
+static void _collect_string(const char* str, int* indices, const char** order, uint32_t* count) {
+	if (str == NULL || indices[intern_id(str)] >= 0) return;
+	indices[intern_id(str)] = (int) *count;
+	order[(*count)++] = str;
+}
+
+int cache_write(Program* prog, const char* path, uint64_t sourceHash, uint64_t sourceSize) {
+	// string indices by intern id, in first use order
+	int numIds = interner_ids(prog->strings);
+	int* indices = (int*) malloc(sizeof(int) * (numIds > 0 ? numIds : 1));
+	const char** order = (const char**) malloc(sizeof(const char*) * (numIds > 0 ? numIds : 1));
+	for (int i = 0; i < numIds; i++) indices[i] = -1;
+	uint32_t numStrings = 0;
+	for (int i = 0; i < prog->numGlobals; i++) {
+		_collect_string(prog->globals[i], indices, order, &numStrings);
+	}
+	for (int i = 0; i < prog->numFunctions; i++) {
+		Function* fn = prog->functions[i];
+		_collect_string(fn->name, indices, order, &numStrings);
+		for (int j = 0; j < fn->numConstants; j++) {
+			if (obj_is(fn->constants[j], OT_STRING)) _collect_string((const char*) obj_as_ptr(fn->constants[j]), indices, order, &numStrings);
+		}
+	}
+
+	// concurrent runs each write their own file, the rename is atomic
+	size_t tmpLen = strlen(path) + 32;
+	char* tmp = (char*) malloc(tmpLen);
+#ifndef _WIN32
+	snprintf(tmp, tmpLen, "%s.%ld.tmp", path, (long) getpid());
+#else
+	snprintf(tmp, tmpLen, "%s.tmp", path);
+#endif
+
+	int ok = 0;
+	FILE* fp = fopen(tmp, "wb");
+	if (fp != NULL) {
+		SmolcHeader header;
+		memset(&header, 0, sizeof(header));
+		header.magic = SMOLC_MAGIC;
+		header.version = SMOLC_VERSION;
+		header.numOpcodes = IT_COUNT;
+		header.numStrings = numStrings;
+		header.sourceHash = sourceHash;
+		header.sourceSize = sourceSize;
+		header.numFunctions = (uint32_t) prog->numFunctions;
+		header.numGlobals = (uint32_t) prog->numGlobals;
+		fwrite(&header, sizeof(header), 1, fp);
+
+		for (uint32_t i = 0; i < numStrings; i++) {
+			uint32_t length = (uint32_t) intern_length(order[i]);
+			fwrite(&length, sizeof(length), 1, fp);
+			fwrite(order[i], 1, length + 1, fp);
+			_pad(fp, 4);
+		}
+		for (int i = 0; i < prog->numGlobals; i++) {
+			uint32_t index = (uint32_t) indices[intern_id(prog->globals[i])];
+			fwrite(&index, sizeof(index), 1, fp);
+		}
+
+		for (int i = 0; i < prog->numFunctions; i++) {
+			Function* fn = prog->functions[i];
+			SmolcFunction info;
+			info.name = fn->name != NULL ? (uint32_t) indices[intern_id(fn->name)] : SMOLC_NONE;
+			info.numParams = (uint32_t) fn->numParams;
+			info.numRegisters = (uint32_t) fn->numRegisters;
+			info.codeLen = (uint32_t) fn->codeLen;
+			info.numConstants = (uint32_t) fn->numConstants;
+			fwrite(&info, sizeof(info), 1, fp);
+			fwrite(fn->code, sizeof(Instruction), fn->codeLen, fp);
+			fwrite(fn->lines, sizeof(int), fn->codeLen, fp);
+			_pad(fp, 8);
+
+			for (int j = 0; j < fn->numConstants; j++) {
+				Object k = fn->constants[j];
+				SmolcConstant out;
+				memset(&out, 0, sizeof(out));
+				out.type = (uint32_t) obj_type(k);
+				switch (obj_type(k)) {
+					case OT_NUMBER: out.number = obj_as_number(k); break;
+					case OT_BOOL: out.number = obj_as_bool(k); break;
+					case OT_STRING: out.index = (uint32_t) indices[intern_id((const char*) obj_as_ptr(k))]; break;
+					case OT_FUNCTION: out.index = (uint32_t) ((Function*) obj_as_ptr(k))->index; break;
+					default: break;
+				}
+				fwrite(&out, sizeof(out), 1, fp);
+			}
+		}
+		ok = !ferror(fp);
+		ok = fclose(fp) == 0 && ok;
+		if (ok) ok = rename(tmp, path) == 0;
+		if (!ok) remove(tmp);
+	}
+
+	free(tmp);
+	free(indices);
+	free(order);
+	return ok;
+}
+
+// Bounds checked reader over the mapped file.
+typedef struct CacheReader_t {
+	const char* data;
+	size_t size, pos;
+} CacheReader;
+
+static const void* _take(CacheReader* r, size_t size, size_t align) {
+	size_t pos = (r->pos + align - 1) / align * align;
+	if (pos > r->size || r->size - pos < size) return NULL;
+	r->pos = pos + size;
+	return r->data + pos;
+}
+
+typedef struct Fixup_t {
+	Function* fn;
+	int slot;
+	uint32_t index;
+} Fixup;
+
+// Whether ins at pc only names registers, constants, globals and jump
+// targets the function has, so running a tampered file can't reach outside
+// them. What the registers hold is checked by the instructions using them,
+// FORITER included. Quickened opcodes are never written.
+static int _valid_instruction(Instruction ins, uint32_t pc, const SmolcFunction* info, const SmolcConstant* constants, int numGlobals) {
+	uint32_t regs = info->numRegisters;
+	uint32_t a = INS_A(ins), b = INS_B(ins), c = INS_C(ins), bx = INS_BX(ins);
+	int64_t target = (int64_t) pc + 1 + INS_SBX(ins);
+	int jumps = target >= 0 && target < (int64_t) info->codeLen;
+	switch (INS_OP(ins)) {
+		case IT_NOP: return 1;
+		case IT_LOADNIL:
+		case IT_LOADBOOL:
+		case IT_NEWLIST: return a < regs;
+		case IT_LOADK: return a < regs && bx < info->numConstants;
+		case IT_GETGLOBAL:
+		case IT_SETGLOBAL: return a < regs && (int) bx < numGlobals;
+		case IT_MOVE:
+		case IT_APPEND:
+		case IT_NEG:
+		case IT_NOT:
+		case IT_BITNOT:
+		case IT_NEGN:
+		case IT_BITNOTI: return a < regs && b < regs;
+		case IT_RANGE: return a < regs && b + 2 < regs;
+		case IT_GETFIELD: return a < regs && b < regs && c < info->numConstants && constants[c].type == OT_STRING;
+		case IT_SETFIELD: return a < regs && b < info->numConstants && constants[b].type == OT_STRING && c < regs;
+		case IT_JMP: return jumps;
+		case IT_JMPIF:
+		case IT_JMPIFNOT:
+		case IT_JMPNOTNIL: return a < regs && jumps;
+		case IT_FORPREP: return a + 1 < regs;
+		case IT_FORITER:
+		case IT_RANGEPREP:
+		case IT_RANGELOOP: return a + 3 < regs && jumps;
+		case IT_CALL:
+		case IT_TAILCALL: return a + b < regs;
+		case IT_RETURN: return b == 0 || a < regs;
+		case IT_CHECK: return a < regs && b < TY_COUNT;
+		default:
+			// the three register arithmetic and comparison forms
+			if (INS_OP(ins) >= IT_COUNT) return 0;
+			return a < regs && b < regs && c < regs;
+	}
+}
+
+static Program* _load(CacheReader* r, uint64_t sourceHash, uint64_t sourceSize, Interner* strings) {
+	const SmolcHeader* header = (const SmolcHeader*) _take(r, sizeof(SmolcHeader), 8);
+	if (header == NULL || header->magic != SMOLC_MAGIC || header->version != SMOLC_VERSION || header->numOpcodes != IT_COUNT) return NULL;
+	if (header->sourceHash != sourceHash || header->sourceSize != sourceSize) return NULL;
+	// each string takes at least its length and terminator
+	if (header->numStrings > (r->size - r->pos) / (sizeof(uint32_t) + 1)) return NULL;
+
+	const char** table = (const char**) malloc(sizeof(const char*) * (header->numStrings > 0 ? header->numStrings : 1));
+	for (uint32_t i = 0; i < header->numStrings; i++) {
+		const uint32_t* length = (const uint32_t*) _take(r, sizeof(uint32_t), 4);
+		const char* data = length != NULL ? (const char*) _take(r, (size_t) *length + 1, 1) : NULL;
+		if (data == NULL || *length > (uint32_t) INT32_MAX) {
+			free(table);
+			return NULL;
+		}
+		table[i] = interner_intern(strings, data, (int) *length);
+	}
+
+	Program* prog = program_new(strings);
+	Fixup* fixups = NULL;
+	int numFixups = 0, fixupsCap = 0;
+	int ok = 1;
+	const uint32_t* globals = NULL;
+	if (header->numGlobals <= VM_MAX_GLOBALS) globals = (const uint32_t*) _take(r, sizeof(uint32_t) * header->numGlobals, 4);
+	if (globals == NULL) ok = 0;
+	for (uint32_t i = 0; i < header->numGlobals && ok; i++) {
+		// names are unique, so each lands in its own slot
+		ok = globals[i] < header->numStrings && program_global(prog, table[globals[i]]) == (int) i;
+	}
+	for (uint32_t i = 0; i < header->numFunctions && ok; i++) {
+		const SmolcFunction* info = (const SmolcFunction*) _take(r, sizeof(SmolcFunction), 4);
+		if (info == NULL || (info->name != SMOLC_NONE && info->name >= header->numStrings) ||
+			info->numRegisters > VM_MAX_REGISTERS || info->numParams > info->numRegisters ||
+			info->numConstants > VM_MAX_CONSTANTS || info->codeLen > (uint32_t) INT32_MAX / sizeof(Instruction)) {
+			ok = 0;
+			break;
+		}
+		const Instruction* code = (const Instruction*) _take(r, sizeof(Instruction) * info->codeLen, 4);
+		const int* lines = (const int*) _take(r, sizeof(int) * info->codeLen, 4);
+		const SmolcConstant* constants = (const SmolcConstant*) _take(r, sizeof(SmolcConstant) * info->numConstants, 8);
+		if (code == NULL || lines == NULL || constants == NULL || info->codeLen == 0 || INS_OP(code[info->codeLen - 1]) != IT_RETURN) {
+			ok = 0;
+			break;
+		}
+
+		Function* fn = function_new(info->name != SMOLC_NONE ? table[info->name] : NULL);
+		program_add_function(prog, fn);
+		free(fn->code);
+		free(fn->lines);
+		fn->code = (Instruction*) code;
+		fn->lines = (int*) lines;
+		for (uint32_t pc = 0; pc < info->codeLen && ok; pc++) {
+			ok = _valid_instruction(code[pc], pc, info, constants, prog->numGlobals);
+		}
+		fn->codeLen = fn->codeCap = (int) info->codeLen;
+		fn->mapped = 1;
+		fn->numParams = (int) info->numParams;
+		fn->numRegisters = (int) info->numRegisters;
+
+		for (uint32_t j = 0; j < info->numConstants && ok; j++) {
+			const SmolcConstant* k = &constants[j];
+			Object value = obj_nil();
+			switch (k->type) {
+				case OT_NIL: break;
+				case OT_NUMBER: value = obj_number(k->number); break;
+				case OT_BOOL: value = obj_bool(k->number != 0); break;
+				case OT_STRING:
+					if (k->index >= header->numStrings) ok = 0;
+					else value = obj_ptr(OT_STRING, table[k->index]);
+					break;
+				case OT_FUNCTION:
+					// functions can refer to later ones, fixed up below
+					if (k->index >= header->numFunctions) ok = 0;
+					else {
+						if (numFixups >= fixupsCap) {
+							fixupsCap = fixupsCap > 0 ? fixupsCap * 2 : 16;
+							fixups = (Fixup*) realloc(fixups, sizeof(Fixup) * fixupsCap);
+						}
+						fixups[numFixups].fn = fn;
+						fixups[numFixups].slot = fn->numConstants;
+						fixups[numFixups].index = k->index;
+						numFixups++;
+					}
+					break;
+				default: ok = 0; break;
+			}
+			if (fn->numConstants >= fn->constantsCap) {
+				fn->constantsCap *= 2;
+				fn->constants = (Object*) realloc(fn->constants, sizeof(Object) * fn->constantsCap);
+			}
+			fn->constants[fn->numConstants++] = value;
+		}
+	}
+	free(table);
+
+	for (int i = 0; i < numFixups && ok; i++) {
+		Fixup* fix = &fixups[i];
+		fix->fn->constants[fix->slot] = obj_ptr(OT_FUNCTION, prog->functions[fix->index]);
+	}
+	free(fixups);
+
+	if (!ok || prog->numFunctions == 0) {
+		program_free(prog);
+		return NULL;
+	}
+	return prog;
+}
+
+Program* cache_load(const char* path, uint64_t sourceHash, uint64_t sourceSize, Interner* strings) {
+	SourceFile* image = (SourceFile*) malloc(sizeof(SourceFile));
+	if (!source_open(image, path) || image->data == NULL) {
+		free(image);
+		return NULL;
+	}
+
+	CacheReader r;
+	r.data = image->data;
+	r.size = image->size;
+	r.pos = 0;
+	Program* prog = _load(&r, sourceHash, sourceSize, strings);
+	if (prog == NULL) {
+		source_close(image);
+		free(image);
+		return NULL;
+	}
+	prog->image = image;
+	return prog;
+}
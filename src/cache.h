@@ -0,0 +1,64 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vm.h"
+
+// .smolc: a compiled Program saved next to its script. Everything is in the
+// writer's byte order (a foreign file fails the magic check), sections are
+// 4-byte aligned and constants 8-byte aligned:
+//
+//   SmolcHeader
+//   numStrings x { uint32 length; char data[length]; '\0'; padding }
+//   uint32 globals[numGlobals] // string index of each global slot's name
+//   numFunctions x {
+//     SmolcFunction
+//     Instruction code[codeLen]
+//     int32 lines[codeLen]
+//     padding
+//     SmolcConstant constants[numConstants]
+//   }
+//
+// Bump SMOLC_VERSION whenever the layout or the meaning of any instruction
+// changes; a header that doesn't match is ignored and the script recompiled.
+#define SMOLC_MAGIC 0x434C4D53 // "SMLC"
+#define SMOLC_VERSION 5
+#define SMOLC_NONE 0xFFFFFFFFu
+
+typedef struct SmolcHeader_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numOpcodes; // IT_COUNT of the writer
+	uint32_t numStrings;
+	uint64_t sourceHash;
+	uint64_t sourceSize;
+	uint32_t numFunctions;
+	uint32_t numGlobals;
+} SmolcHeader;
+
+typedef struct SmolcFunction_t {
+	uint32_t name; // string index or SMOLC_NONE
+	uint32_t numParams, numRegisters;
+	uint32_t codeLen, numConstants;
+} SmolcFunction;
+
+typedef struct SmolcConstant_t {
+	uint32_t type; // OT_*
+	uint32_t index; // string or function index
+	double number; // OT_NUMBER, OT_BOOL
+} SmolcConstant;
+
+// 64-bit FNV-1a of the script source.
+extern uint64_t cache_hash(const char* data, size_t size);
+
+// Writes prog to path atomically, returns 0 on failure.
+extern int cache_write(Program* prog, const char* path, uint64_t sourceHash, uint64_t sourceSize);
+
+// Maps path and returns its Program, with code and line tables pointing
+// into the mapping, or NULL if it is missing, stale or malformed. Strings
+// are interned into strings.
+extern Program* cache_load(const char* path, uint64_t sourceHash, uint64_t sourceSize, Interner* strings);
+
+#endif // CACHE_H
@@ -0,0 +1,1356 @@
+#include "compiler.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+static void _stmt(Compiler* c, Node* nd);
+static int _expr(Compiler* c, Node* nd, int dst);
+static int _inline(Compiler* c, Node* nd, const char* name, Node* args, int dst, int* type);
+
+static void _error_at(Compiler* c, int line, const char* fmt, va_list args) {
+	// compiling the callee itself reports the errors of an inlined body
+	if (c->fs == NULL || c->fs->inl == NULL) {
+		char msg[256];
+		vsnprintf(msg, sizeof(msg), fmt, args);
+		error_report(c->errorSink, "(%d) %s", line, msg);
+	}
+	c->errors++;
+}
+
+static void _error(Compiler* c, Node* nd, const char* fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	_error_at(c, nd != NULL ? nd->line : 0, fmt, args);
+	va_end(args);
+}
+
+static void _error_line(Compiler* c, int line, const char* fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	_error_at(c, line, fmt, args);
+	va_end(args);
+}
+
+static void _note(Compiler* c, Node* nd, const char* fmt, ...) {
+	if (!c->options.reportInlining) return;
+	char msg[256];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	va_end(args);
+	error_note(c->errorSink, "(%d) %s", nd != NULL ? nd->line : 0, msg);
+}
+
+static void _flag_global(Compiler* c, int slot, int flag) {
+	if (slot >= c->globalFlagsCap) {
+		int cap = c->globalFlagsCap > 0 ? c->globalFlagsCap : 64;
+		while (cap <= slot) cap *= 2;
+		c->globalFlags = (char*) realloc(c->globalFlags, cap);
+		memset(c->globalFlags + c->globalFlagsCap, 0, cap - c->globalFlagsCap);
+		c->globalFlagsCap = cap;
+	}
+	c->globalFlags[slot] |= flag;
+}
+
+static int _emit(Compiler* c, Node* nd, Instruction ins) {
+	if (INS_OP(ins) == IT_SETGLOBAL && c->fs->parent == NULL) _flag_global(c, INS_BX(ins), GLOBAL_MAIN_ASSIGNED);
+	return function_emit(c->fs->fn, ins, nd != NULL ? nd->line : 0);
+}
+
+static void _patch(Compiler* c, Node* nd, int pc, int target) {
+	int offset = target - (pc + 1);
+	if (offset < -INS_SBX_BIAS || offset > 0xFFFF - INS_SBX_BIAS) {
+		_error(c, nd, "Jump is too long.");
+		return;
+	}
+	Instruction ins = c->fs->fn->code[pc];
+	c->fs->fn->code[pc] = INS_ASBX(INS_OP(ins), INS_A(ins), offset);
+}
+
+static void _patch_here(Compiler* c, Node* nd, int pc) {
+	_patch(c, nd, pc, c->fs->fn->codeLen);
+}
+
+static int _reserve(Compiler* c, Node* nd, int n) {
+	FunctionState* fs = c->fs;
+	int reg = fs->freeReg;
+	if (reg + n > VM_MAX_REGISTERS) {
+		_error(c, nd, "Function needs more than %d registers.", VM_MAX_REGISTERS);
+		return 0;
+	}
+	fs->freeReg += n;
+	if (fs->freeReg > fs->fn->numRegisters) fs->fn->numRegisters = fs->freeReg;
+	return reg;
+}
+
+static int _constant(Compiler* c, Node* nd, Object value) {
+	int k = function_constant(c->fs->fn, value);
+	if (k < 0) {
+		_error(c, nd, "Function has more than %d constants.", VM_MAX_CONSTANTS);
+		return 0;
+	}
+	return k;
+}
+
+static int _string_constant(Compiler* c, Node* nd, const char* str) {
+	return _constant(c, nd, obj_ptr(OT_STRING, str));
+}
+
+static int _global(Compiler* c, Node* nd, const char* name) {
+	int slot = program_global(c->program, name);
+	if (slot < 0) {
+		_error(c, nd, "Program has more than %d globals.", VM_MAX_GLOBALS);
+		return 0;
+	}
+	return slot;
+}
+
+static Local* _lookup(FunctionState* fs, const char* name) {
+	for (int i = fs->numLocals - 1; i >= fs->localsFloor; i--) {
+		if (fs->locals[i].name == name) return &fs->locals[i];
+	}
+	return NULL;
+}
+
+static int _find_local(FunctionState* fs, const char* name) {
+	Local* local = _lookup(fs, name);
+	return local != NULL ? local->reg : -1;
+}
+
+static void _declare_local(Compiler* c, Node* nd, const char* name, int reg, int type) {
+	FunctionState* fs = c->fs;
+	if (fs->numLocals >= COMPILER_MAX_LOCALS) {
+		_error(c, nd, "Too many local variables.");
+		return;
+	}
+	Local* local = &fs->locals[fs->numLocals++];
+	local->name = name;
+	local->reg = reg;
+	local->depth = fs->depth;
+	local->type = type;
+}
+
+static int _is_global_scope(Compiler* c) {
+	return c->fs->parent == NULL && c->fs->depth == 0;
+}
+
+static void _begin_scope(Compiler* c) {
+	c->fs->depth++;
+}
+
+static void _end_scope(Compiler* c) {
+	FunctionState* fs = c->fs;
+	fs->depth--;
+	while (fs->numLocals > 0 && fs->locals[fs->numLocals - 1].depth > fs->depth) {
+		fs->numLocals--;
+	}
+}
+
+static void _fs_init(FunctionState* fs, Function* fn, FunctionState* parent) {
+	fs->fn = fn;
+	fs->numLocals = 0;
+	fs->depth = 0;
+	fs->localsFloor = 0;
+	fs->freeReg = 0;
+	fs->loop = NULL;
+	fs->inl = NULL;
+	fs->tailCall = NULL;
+	fs->parent = parent;
+}
+
+static int _annotation(Node* nd) {
+	switch (nd->annotation) {
+		case TT_KW_INT: return TY_INT;
+		case TT_KW_DOUBLE: return TY_DOUBLE;
+		case TT_KW_STRING: return TY_STRING;
+		case TT_KW_BOOL: return TY_BOOL;
+		default: return TY_ANY;
+	}
+}
+
+static int _is_number(int type) {
+	return type == TY_INT || type == TY_DOUBLE;
+}
+
+// Checks a value of type in reg against the declared type of name: while
+// compiling when the type is known, else at run time.
+static void _check_type(Compiler* c, Node* nd, const char* name, int reg, int type, int declared) {
+	if (declared == TY_ANY || type == declared || (type == TY_INT && declared == TY_DOUBLE)) return;
+	if (type == TY_ANY) _emit(c, nd, INS_ABC(IT_CHECK, reg, declared, 0));
+	else _error(c, nd, "Cannot assign a %s to %s '%s'.", TYPES[type], TYPES[declared], name);
+}
+
+// Whether anything in nd assigns to name, which then can't keep a type
+// inferred for it.
+static int _assigns(Node* nd, const char* name) {
+	if (nd == NULL) return 0;
+	if (nd->type >= NT_ASSIGN && nd->type <= NT_ASSIGN_DIV && nd->childCount > 0 &&
+		nd->children[0] != NULL && nd->children[0]->type == NT_IDENTIFIER && nd->children[0]->string == name) return 1;
+	for (int i = 0; i < nd->childCount; i++) {
+		if (_assigns(nd->children[i], name)) return 1;
+	}
+	return 0;
+}
+
+// Returns a register holding the value of nd, without a copy for locals,
+// and its type in type.
+static int _expr_typed(Compiler* c, Node* nd, int* type) {
+	if (nd != NULL && nd->type == NT_IDENTIFIER) {
+		Local* local = _lookup(c->fs, nd->string);
+		if (local != NULL) {
+			*type = local->type;
+			return local->reg;
+		}
+	}
+	int reg = _reserve(c, nd, 1);
+	*type = _expr(c, nd, reg);
+	return reg;
+}
+
+static int _expr_any(Compiler* c, Node* nd) {
+	int type;
+	return _expr_typed(c, nd, &type);
+}
+
+static int _binary_op(int type) {
+	switch (type) {
+		case NT_BINARY_ADD: case NT_ASSIGN_ADD: return IT_ADD;
+		case NT_BINARY_SUB: case NT_ASSIGN_SUB: return IT_SUB;
+		case NT_BINARY_MUL: case NT_ASSIGN_MUL: return IT_MUL;
+		case NT_BINARY_DIV: case NT_ASSIGN_DIV: return IT_DIV;
+		case NT_BINARY_MOD: return IT_MOD;
+		case NT_BINARY_LSH: return IT_LSH;
+		case NT_BINARY_RSH: return IT_RSH;
+		case NT_BINARY_BITAND: return IT_BITAND;
+		case NT_BINARY_BITOR: return IT_BITOR;
+		case NT_BINARY_BITXOR: return IT_BITXOR;
+		case NT_BINARY_EQUALITY: return IT_EQ;
+		case NT_BINARY_INEQUALITY: return IT_NE;
+		case NT_BINARY_LESS: return IT_LT;
+		case NT_BINARY_LESSEQUALS: return IT_LE;
+		case NT_BINARY_GREATER: return IT_GT;
+		case NT_BINARY_GREATEREQUALS: return IT_GE;
+		default: return -1;
+	}
+}
+
+// Picks the unchecked form of a binary op for operands of the given types,
+// or keeps op, and sets type to the type of the result.
+static int _typed_op(int op, int left, int right, int* type) {
+	int numbers = _is_number(left) && _is_number(right);
+	int ints = left == TY_INT && right == TY_INT;
+	*type = TY_ANY;
+	switch (op) {
+		case IT_ADD:
+			if (numbers) {
+				*type = ints ? TY_INT : TY_DOUBLE;
+				return IT_ADDN;
+			}
+			if ((left == TY_STRING && (right == TY_STRING || _is_number(right))) || (_is_number(left) && right == TY_STRING)) *type = TY_STRING;
+			return op;
+		case IT_SUB:
+		case IT_MUL:
+		case IT_DIV:
+		case IT_MOD:
+			// anything else fails
+			*type = TY_DOUBLE;
+			if (!numbers) return op;
+			if (ints && op != IT_DIV) *type = TY_INT;
+			switch (op) {
+				case IT_SUB: return IT_SUBN;
+				case IT_MUL: return IT_MULN;
+				case IT_DIV: return IT_DIVN;
+				default: return IT_MODN;
+			}
+		case IT_LSH: *type = TY_INT; return numbers ? IT_LSHI : op;
+		case IT_RSH: *type = TY_INT; return numbers ? IT_RSHI : op;
+		case IT_BITAND: *type = TY_INT; return numbers ? IT_BITANDI : op;
+		case IT_BITOR: *type = TY_INT; return numbers ? IT_BITORI : op;
+		case IT_BITXOR: *type = TY_INT; return numbers ? IT_BITXORI : op;
+		case IT_EQ: *type = TY_BOOL; return numbers ? IT_EQN : op;
+		case IT_NE: *type = TY_BOOL; return numbers ? IT_NEN : op;
+		case IT_LT: *type = TY_BOOL; return numbers ? IT_LTN : op;
+		case IT_LE: *type = TY_BOOL; return numbers ? IT_LEN : op;
+		case IT_GT: *type = TY_BOOL; return numbers ? IT_GTN : op;
+		case IT_GE: *type = TY_BOOL; return numbers ? IT_GEN : op;
+		default: return op;
+	}
+}
+
+// Calls the function in reg with the arguments in args (NT_FUN_ARGS, may be
+// NULL); reg must be the topmost reserved register. The result lands in reg,
+// op is IT_CALL or IT_TAILCALL.
+static void _call(Compiler* c, Node* nd, Node* args, int reg, int op) {
+	int count = args != NULL ? args->childCount : 0;
+	if (count > 255) {
+		_error(c, nd, "Too many arguments.");
+		return;
+	}
+	for (int i = 0; i < count; i++) {
+		_expr(c, args->children[i], _reserve(c, nd, 1));
+	}
+	_emit(c, nd, INS_ABC(op, reg, count, 0));
+	c->fs->freeReg = reg + 1;
+}
+
+// Field names past the 8-bit operand range are looked up by index instead.
+static int _field_key(Compiler* c, Node* nd, int* k) {
+	*k = _string_constant(c, nd, nd->string);
+	if (*k <= 0xFF) return 1;
+	int reg = _reserve(c, nd, 1);
+	_emit(c, nd, INS_ABX(IT_LOADK, reg, *k));
+	*k = reg;
+	return 0;
+}
+
+// Applies a trailer to the value in reg, leaving the result in reg.
+static void _trailer(Compiler* c, Node* nd, int reg) {
+	int saved = c->fs->freeReg;
+	switch (nd->type) {
+		case NT_LIST_ACCESS: {
+			int key = _expr_any(c, nd->children[0]);
+			_emit(c, nd, INS_ABC(IT_GETINDEX, reg, reg, key));
+		} break;
+		case NT_FIELD_ACCESS: {
+			int k;
+			if (_field_key(c, nd, &k)) _emit(c, nd, INS_ABC(IT_GETFIELD, reg, reg, k));
+			else _emit(c, nd, INS_ABC(IT_GETINDEX, reg, reg, k));
+		} break;
+		case NT_CALL: _call(c, nd, nd->children[0], reg, IT_CALL); break;
+		default: _error(c, nd, "Unexpected %s in trailer.", AST_TYPES[nd->type]); break;
+	}
+	c->fs->freeReg = saved;
+}
+
+// Evaluates the atom and the first count - 1 trailers of a NT_TRAIL into a
+// fresh register, or into dst when that is just an inlined call and dst
+// isn't -1. The value's type goes to type when that isn't NULL.
+static int _trail(Compiler* c, Node* nd, int count, int dst, int* type) {
+	int known = TY_ANY;
+	int reg, i = 1;
+	Node* atom = nd->children[0];
+	if (count > 1 && atom != NULL && atom->type == NT_IDENTIFIER && nd->children[1]->type == NT_CALL) {
+		Node* call = nd->children[1];
+		int into = count == 2 && dst >= 0 ? dst : _reserve(c, nd, 1);
+		if (_inline(c, call, atom->string, call->children[0], into, &known)) i = 2;
+		// a call needs the topmost register
+		reg = i == 1 && into == dst ? _reserve(c, nd, 1) : into;
+	} else reg = _reserve(c, nd, 1);
+	if (i == 1) _expr(c, atom, reg);
+	for (; i < count; i++) {
+		_trailer(c, nd->children[i], reg);
+		known = TY_ANY;
+	}
+	if (type != NULL) *type = known;
+	return reg;
+}
+
+// Whether a local lives in reg, which an inlined body's parameters may share.
+static int _is_local_reg(FunctionState* fs, int reg) {
+	for (int i = 0; i < fs->numLocals; i++) {
+		if (fs->locals[i].reg == reg) return 1;
+	}
+	return 0;
+}
+
+// Evaluates start, end and step of a NT_RANGE into base..base + 2, and
+// their types into types.
+static void _range_operands(Compiler* c, Node* nd, int base, int* types) {
+	types[0] = _expr(c, nd->children[0], base);
+	types[1] = _expr(c, nd->children[1], base + 1);
+	if (nd->childCount > 2) types[2] = _expr(c, nd->children[2], base + 2);
+	else {
+		_emit(c, nd, INS_ABX(IT_LOADK, base + 2, _constant(c, nd, obj_number(1))));
+		types[2] = TY_INT;
+	}
+}
+
+// Compiles nd into dst and returns the type of its value, TY_ANY when that
+// isn't known.
+static int _expr(Compiler* c, Node* nd, int dst) {
+	if (nd == NULL) {
+		_error(c, nd, "Invalid expression.");
+		return TY_ANY;
+	}
+
+	FunctionState* fs = c->fs;
+	int saved = fs->freeReg;
+	int type = TY_ANY;
+	switch (nd->type) {
+		case NT_NUMBER: {
+			_emit(c, nd, INS_ABX(IT_LOADK, dst, _constant(c, nd, obj_number(nd->value))));
+			type = nd->value == floor(nd->value) && fabs(nd->value) < 9223372036854775808.0 ? TY_INT : TY_DOUBLE;
+		} break;
+		case NT_STRING: {
+			_emit(c, nd, INS_ABX(IT_LOADK, dst, _string_constant(c, nd, nd->string)));
+			type = TY_STRING;
+		} break;
+		case NT_BOOL: {
+			_emit(c, nd, INS_ABC(IT_LOADBOOL, dst, nd->boolean ? 1 : 0, 0));
+			type = TY_BOOL;
+		} break;
+		case NT_NIL: _emit(c, nd, INS_ABC(IT_LOADNIL, dst, 0, 0)); break;
+		case NT_IDENTIFIER: {
+			Local* local = _lookup(fs, nd->string);
+			if (local == NULL) _emit(c, nd, INS_ABX(IT_GETGLOBAL, dst, _global(c, nd, nd->string)));
+			else {
+				if (local->reg != dst) _emit(c, nd, INS_ABC(IT_MOVE, dst, local->reg, 0));
+				type = local->type;
+			}
+		} break;
+		case NT_LIST: {
+			_emit(c, nd, INS_ABC(IT_NEWLIST, dst, 0, 0));
+			for (int i = 0; i < nd->childCount; i++) {
+				int reg = _expr_any(c, nd->children[i]);
+				_emit(c, nd, INS_ABC(IT_APPEND, dst, reg, 0));
+				fs->freeReg = saved;
+			}
+		} break;
+		case NT_UNARY_MINUS:
+		case NT_UNARY_NOT:
+		case NT_UNARY_BITNOT: {
+			int operand;
+			int reg = _expr_typed(c, nd->children[0], &operand);
+			int op;
+			if (nd->type == NT_UNARY_MINUS) {
+				op = _is_number(operand) ? IT_NEGN : IT_NEG;
+				type = operand == TY_INT ? TY_INT : TY_DOUBLE;
+			} else if (nd->type == NT_UNARY_NOT) {
+				op = IT_NOT;
+				type = TY_BOOL;
+			} else {
+				op = _is_number(operand) ? IT_BITNOTI : IT_BITNOT;
+				type = TY_INT;
+			}
+			_emit(c, nd, INS_ABC(op, dst, reg, 0));
+		} break;
+		case NT_BINARY_LOGICAND:
+		case NT_BINARY_LOGICOR: {
+			// the result is the last operand evaluated
+			int left = _expr(c, nd->children[0], dst);
+			int jmp = _emit(c, nd, INS_ASBX(nd->type == NT_BINARY_LOGICAND ? IT_JMPIFNOT : IT_JMPIF, dst, 0));
+			int right = _expr(c, nd->children[1], dst);
+			_patch_here(c, nd, jmp);
+			if (left == right) type = left;
+		} break;
+		case NT_TERNARY: {
+			int cond = _expr_any(c, nd->children[0]);
+			int jmpElse = _emit(c, nd, INS_ASBX(IT_JMPIFNOT, cond, 0));
+			fs->freeReg = saved;
+			int then = _expr(c, nd->children[1], dst);
+			int jmpEnd = _emit(c, nd, INS_ASBX(IT_JMP, 0, 0));
+			_patch_here(c, nd, jmpElse);
+			int otherwise = _expr(c, nd->children[2], dst);
+			_patch_here(c, nd, jmpEnd);
+			if (then == otherwise) type = then;
+		} break;
+		case NT_RANGE: {
+			// outside of a for loop a range is a list
+			int reg = _reserve(c, nd, 3);
+			int types[3];
+			_range_operands(c, nd, reg, types);
+			_emit(c, nd, INS_ABC(IT_RANGE, dst, reg, 0));
+		} break;
+		case NT_TRAIL: {
+			int reg = _trail(c, nd, nd->childCount, _is_local_reg(fs, dst) ? -1 : dst, &type);
+			if (reg != dst) _emit(c, nd, INS_ABC(IT_MOVE, dst, reg, 0));
+		} break;
+		default: {
+			int op = _binary_op(nd->type);
+			if (op < 0) {
+				_error(c, nd, "Unexpected %s in expression.", AST_TYPES[nd->type]);
+				break;
+			}
+			int leftType, rightType;
+			int left = _expr_typed(c, nd->children[0], &leftType);
+			int right = _expr_typed(c, nd->children[1], &rightType);
+			_emit(c, nd, INS_ABC(_typed_op(op, leftType, rightType, &type), dst, left, right));
+		} break;
+	}
+	fs->freeReg = saved;
+	return type;
+}
+
+// Expressions that write their destination before reading all operands
+// can't target a local they read from.
+static int _writes_early(Node* nd) {
+	if (nd == NULL) return 0;
+	switch (nd->type) {
+		case NT_LIST:
+		case NT_BINARY_LOGICAND:
+		case NT_BINARY_LOGICOR:
+		case NT_TERNARY: return 1;
+		default: return 0;
+	}
+}
+
+static void _assign(Compiler* c, Node* nd) {
+	FunctionState* fs = c->fs;
+	int saved = fs->freeReg;
+	Node* target = nd->children[0];
+	Node* value = nd->children[1];
+	int op = nd->type == NT_ASSIGN ? -1 : _binary_op(nd->type);
+
+	if (target == NULL) {
+		_error(c, nd, "Invalid assignment target.");
+	} else if (target->type == NT_IDENTIFIER) {
+		Local* local = _lookup(fs, target->string);
+		if (local != NULL) {
+			int type;
+			if (op >= 0) {
+				int right;
+				int reg = _expr_typed(c, value, &right);
+				_emit(c, nd, INS_ABC(_typed_op(op, local->type, right, &type), local->reg, local->reg, reg));
+			} else if (_writes_early(value)) {
+				int tmp = _reserve(c, nd, 1);
+				type = _expr(c, value, tmp);
+				_emit(c, nd, INS_ABC(IT_MOVE, local->reg, tmp, 0));
+			} else type = _expr(c, value, local->reg);
+			_check_type(c, nd, local->name, local->reg, type, local->type);
+		} else {
+			int slot = _global(c, target, target->string);
+			if (op >= 0) {
+				int tmp = _reserve(c, nd, 1);
+				_emit(c, nd, INS_ABX(IT_GETGLOBAL, tmp, slot));
+				_emit(c, nd, INS_ABC(op, tmp, tmp, _expr_any(c, value)));
+				_emit(c, nd, INS_ABX(IT_SETGLOBAL, tmp, slot));
+			} else _emit(c, nd, INS_ABX(IT_SETGLOBAL, _expr_any(c, value), slot));
+		}
+	} else if (target->type == NT_TRAIL && target->children[target->childCount - 1]->type != NT_CALL) {
+		Node* last = target->children[target->childCount - 1];
+		int obj = _trail(c, target, target->childCount - 1, -1, NULL);
+
+		int key, byField = 0;
+		if (last->type == NT_FIELD_ACCESS) byField = _field_key(c, last, &key);
+		else key = _expr_any(c, last->children[0]);
+
+		int val;
+		if (op >= 0) {
+			val = _reserve(c, nd, 1);
+			_emit(c, nd, INS_ABC(byField ? IT_GETFIELD : IT_GETINDEX, val, obj, key));
+			_emit(c, nd, INS_ABC(op, val, val, _expr_any(c, value)));
+		} else val = _expr_any(c, value);
+		_emit(c, nd, INS_ABC(byField ? IT_SETFIELD : IT_SETINDEX, obj, key, val));
+	} else {
+		_error(c, nd, "Invalid assignment target.");
+	}
+	fs->freeReg = saved;
+}
+
+static void _let(Compiler* c, Node* nd) {
+	Node* args = nd->children[0];
+	for (int i = 0; i < args->childCount; i++) {
+		Node* arg = args->children[i];
+		if (arg == NULL) continue;
+		Node* value = arg->type == NT_ASSIGN ? arg->children[0] : NULL;
+		int declared = _annotation(arg);
+		if (declared != TY_ANY && value == NULL) _error(c, arg, "'%s' is declared %s but has no value.", arg->string, TYPES[declared]);
+
+		int saved = c->fs->freeReg;
+		// declared after its initializer, which still sees outer names
+		int reg = _reserve(c, arg, 1);
+		if (value != NULL) _check_type(c, arg, arg->string, reg, _expr(c, value, reg), declared);
+		else _emit(c, arg, INS_ABC(IT_LOADNIL, reg, 0, 0));
+		if (_is_global_scope(c)) {
+			int slot = _global(c, arg, arg->string);
+			_flag_global(c, slot, GLOBAL_DECLARED);
+			_emit(c, arg, INS_ABX(IT_SETGLOBAL, reg, slot));
+			c->fs->freeReg = saved;
+		} else _declare_local(c, arg, arg->string, reg, declared);
+	}
+}
+
+static void _block(Compiler* c, Node* nd) {
+	if (nd == NULL) return;
+	int saved = c->fs->freeReg;
+	_begin_scope(c);
+	for (int i = 0; i < nd->childCount; i++) {
+		_stmt(c, nd->children[i]);
+	}
+	_end_scope(c);
+	c->fs->freeReg = saved;
+}
+
+// Fills in the defaults of the parameters in base.., and checks the annotated
+// ones unless known, the types of the arguments when inlining, shows that
+// they hold.
+static void _prologue(Compiler* c, Node* params, int base, const int* known) {
+	// missing arguments are nil, defaults replace them
+	for (int i = 0; i < params->childCount; i++) {
+		Node* param = params->children[i];
+		if (param == NULL || param->type != NT_ASSIGN) continue;
+		int skip = _emit(c, param, INS_ASBX(IT_JMPNOTNIL, base + i, 0));
+		int type = _expr(c, param->children[0], base + i);
+		// checked below with the arguments otherwise
+		if (type != TY_ANY) _check_type(c, param, param->string, base + i, type, _annotation(param));
+		_patch_here(c, param, skip);
+	}
+	// the body trusts the annotated parameters from here on
+	for (int i = 0; i < params->childCount; i++) {
+		Node* param = params->children[i];
+		if (param == NULL || _annotation(param) == TY_ANY) continue;
+		int type = known != NULL ? known[i] : TY_ANY;
+		if (type == _annotation(param) || (type == TY_INT && _annotation(param) == TY_DOUBLE)) continue;
+		_emit(c, param, INS_ABC(IT_CHECK, base + i, _annotation(param), 0));
+	}
+}
+
+// Compiles the function nd declares, the caller binds it to its name.
+static Function* _fun_body(Compiler* c, Node* nd) {
+	Function* fn = function_new(nd->string);
+	program_add_function(c->program, fn);
+
+	FunctionState fs;
+	_fs_init(&fs, fn, c->fs);
+	c->fs = &fs;
+
+	Node* params = nd->children[0];
+	fn->numParams = params->childCount;
+	for (int i = 0; i < params->childCount; i++) {
+		Node* param = params->children[i];
+		if (param == NULL) continue;
+		_declare_local(c, param, param->string, _reserve(c, param, 1), _annotation(param));
+	}
+	_prologue(c, params, 0, NULL);
+
+	_block(c, nd->children[1]);
+	_emit(c, nd, INS_ABC(IT_RETURN, 0, 0, 0));
+	c->fs = fs.parent;
+	return fn;
+}
+
+static void _fun_bind(Compiler* c, Node* nd, Function* fn) {
+	int saved = c->fs->freeReg;
+	int reg = _reserve(c, nd, 1);
+	_emit(c, nd, INS_ABX(IT_LOADK, reg, _constant(c, nd, obj_ptr(OT_FUNCTION, fn))));
+	int slot = _global(c, nd, nd->string);
+	_flag_global(c, slot, GLOBAL_DECLARED);
+	_emit(c, nd, INS_ABX(IT_SETGLOBAL, reg, slot));
+	c->fs->freeReg = saved;
+}
+
+static int _main_assigned(Compiler* c, const char* name) {
+	int slot = program_find_global(c->program, name);
+	return slot >= 0 && slot < c->globalFlagsCap && (c->globalFlags[slot] & GLOBAL_MAIN_ASSIGNED);
+}
+
+// The function a call of name with argc arguments can inline here, else
+// NULL and, when the call is worth a note, why in why.
+static const Inlinable* _inline_callee(Compiler* c, const char* name, int argc, const char** why) {
+	FunctionState* fs = c->fs;
+	*why = NULL;
+	const Inlinable* in = NULL;
+	for (int i = 0; i < c->numInlinable && in == NULL; i++) {
+		if (c->inlinable[i].name == name) in = &c->inlinable[i];
+	}
+	if (in == NULL || _lookup(fs, name) != NULL || argc > 255) return NULL;
+
+	int depth = 0;
+	for (InlineState* inl = fs->inl; inl != NULL; inl = inl->parent, depth++) {
+		if (inl->callee == in) {
+			*why = "it is inlined here already";
+			return NULL;
+		}
+	}
+	if (depth >= COMPILER_MAX_INLINE_DEPTH) {
+		*why = "too many calls are inlined into each other";
+		return NULL;
+	}
+	int numParams = in->decl->children[0]->childCount;
+	if (fs->freeReg + (argc > numParams ? argc : numParams) + 2 * COMPILER_INLINE_BUDGET > VM_MAX_REGISTERS ||
+		fs->numLocals + COMPILER_INLINE_BUDGET > COMPILER_MAX_LOCALS || fs->fn->numConstants + COMPILER_INLINE_BUDGET > VM_MAX_CONSTANTS) {
+		*why = "the caller is too large";
+		return NULL;
+	}
+	// a call before the definition would fail, and the top level code must
+	// not read globals before it defines them
+	if (!_main_assigned(c, name)) {
+		*why = "it isn't defined yet";
+		return NULL;
+	}
+	if (fs->parent == NULL) {
+		for (int i = 0; i < in->numReads; i++) {
+			if (!_main_assigned(c, in->reads[i]) && vm_find_native(in->reads[i]) == NULL) {
+				*why = "it reads globals that aren't defined yet";
+				return NULL;
+			}
+		}
+	}
+	return in;
+}
+
+static void _note_site(Compiler* c, Node* nd, const char* name, const char* why) {
+	// sites in an inlined body are in its copy in the function compiled
+	char caller[128];
+	const char* fn = c->fs->fn->name;
+	if (c->fs->inl == NULL && fn != NULL) snprintf(caller, sizeof(caller), "'%s'", fn);
+	else if (c->fs->inl == NULL) snprintf(caller, sizeof(caller), "the top level");
+	else if (fn != NULL) snprintf(caller, sizeof(caller), "the copy of '%s' in '%s'", c->fs->inl->callee->name, fn);
+	else snprintf(caller, sizeof(caller), "the copy of '%s' in the top level", c->fs->inl->callee->name);
+	if (why != NULL) _note(c, nd, "Didn't inline '%s' into %s: %s.", name, caller, why);
+	else _note(c, nd, "Inlined '%s' into %s.", name, caller);
+}
+
+// Compiles a call of name with args (may be NULL) into dst as the callee's
+// body when it can: arguments go to fresh registers its parameters take
+// over, and returns store to dst and jump past the end.
+static int _inline(Compiler* c, Node* nd, const char* name, Node* args, int dst, int* type) {
+	FunctionState* fs = c->fs;
+	int argc = args != NULL ? args->childCount : 0;
+	const char* why;
+	const Inlinable* in = _inline_callee(c, name, argc, &why);
+	if (in == NULL) {
+		if (why != NULL) _note_site(c, nd, name, why);
+		return 0;
+	}
+	int tail = nd == fs->tailCall;
+
+	Node* params = in->decl->children[0];
+	Node* body = in->decl->children[1];
+	int saved = fs->freeReg;
+	int base = _reserve(c, nd, params->childCount);
+	int known[COMPILER_INLINE_BUDGET];
+	Local* aliases[COMPILER_INLINE_BUDGET];
+	for (int i = 0; i < argc; i++) {
+		Node* arg = args->children[i];
+		if (i < params->childCount) {
+			// a local the body neither sees nor assigns needs no copy, which
+			// defaults and checks would write or read in base + i
+			Node* param = params->children[i];
+			aliases[i] = arg != NULL && arg->type == NT_IDENTIFIER ? _lookup(fs, arg->string) : NULL;
+			if (aliases[i] != NULL && (param == NULL || param->type != NT_IDENTIFIER || _annotation(param) != TY_ANY || _assigns(body, param->string))) aliases[i] = NULL;
+			if (aliases[i] != NULL) known[i] = aliases[i]->type;
+			else known[i] = _expr(c, arg, base + i);
+		} else {
+			// evaluated for their effects only
+			_expr(c, arg, _reserve(c, nd, 1));
+			fs->freeReg = base + params->childCount;
+		}
+	}
+	for (int i = argc; i < params->childCount; i++) {
+		_emit(c, nd, INS_ABC(IT_LOADNIL, base + i, 0, 0));
+		known[i] = TY_ANY;
+		aliases[i] = NULL;
+	}
+
+	InlineState inl;
+	inl.callee = in;
+	inl.result = dst;
+	inl.type = TY_COUNT;
+	inl.tail = tail;
+	inl.last = body != NULL && body->childCount > 0 ? body->children[body->childCount - 1] : NULL;
+	inl.numJumps = 0;
+	inl.parent = fs->inl;
+	int floor = fs->localsFloor;
+	LoopState* loop = fs->loop;
+	_begin_scope(c);
+	fs->localsFloor = fs->numLocals;
+	fs->loop = NULL;
+	fs->inl = &inl;
+
+	for (int i = 0; i < params->childCount; i++) {
+		Node* param = params->children[i];
+		if (param == NULL) continue;
+		// like loop variables, parameters the body never assigns keep the
+		// type of their argument
+		int type = _annotation(param);
+		if (type == TY_ANY && !_assigns(body, param->string)) type = known[i];
+		_declare_local(c, param, param->string, aliases[i] != NULL ? aliases[i]->reg : base + i, type);
+	}
+	_prologue(c, params, base, known);
+	_block(c, body);
+	if (inl.last == NULL || inl.last->type != NT_RETURN) {
+		_emit(c, nd, INS_ABC(IT_LOADNIL, dst, 0, 0));
+		inl.type = TY_ANY;
+	}
+	for (int i = 0; i < inl.numJumps; i++) {
+		_patch_here(c, nd, inl.jumps[i]);
+	}
+
+	fs->inl = inl.parent;
+	fs->loop = loop;
+	fs->localsFloor = floor;
+	_end_scope(c);
+	fs->freeReg = saved;
+	// TY_COUNT when the body always tail calls
+	*type = inl.type < TY_COUNT ? inl.type : TY_ANY;
+	_note_site(c, nd, name, NULL);
+	return 1;
+}
+
+// Whether a return here leaves the frame, unlike the top level's.
+static int _in_tail(Compiler* c) {
+	return c->fs->parent != NULL && (c->fs->inl == NULL || c->fs->inl->tail);
+}
+
+// Whether return nd can hand this frame over to the call nd ends with.
+static int _is_tail_call(Compiler* c, Node* nd) {
+	if (!_in_tail(c) || nd->type != NT_TRAIL || nd->childCount < 2) return 0;
+	Node* call = nd->children[nd->childCount - 1];
+	if (call == NULL || call->type != NT_CALL) return 0;
+	Node* atom = nd->children[0];
+	if (nd->childCount > 2 || atom == NULL || atom->type != NT_IDENTIFIER) return 1;
+	// inlining it is cheaper still
+	const char* why;
+	Node* args = call->children[0];
+	if (_inline_callee(c, atom->string, args != NULL ? args->childCount : 0, &why) != NULL) return 0;
+	if (why != NULL) _note_site(c, call, atom->string, why);
+	return 1;
+}
+
+static void _if_stmt(Compiler* c, Node* nd) {
+	int* ends = (int*) malloc(sizeof(int) * nd->childCount);
+	int numEnds = 0;
+	for (int i = 0; i < nd->childCount; i++) {
+		Node* branch = nd->children[i];
+		if (branch == NULL) continue;
+		if (branch->type == NT_ELSE) {
+			_block(c, branch->children[0]);
+			continue;
+		}
+
+		int saved = c->fs->freeReg;
+		int cond = _expr_any(c, branch->children[0]);
+		int next = _emit(c, branch->children[0], INS_ASBX(IT_JMPIFNOT, cond, 0));
+		c->fs->freeReg = saved;
+		_block(c, branch->children[1]);
+		if (i < nd->childCount - 1) ends[numEnds++] = _emit(c, branch, INS_ASBX(IT_JMP, 0, 0));
+		_patch_here(c, branch, next);
+	}
+	for (int i = 0; i < numEnds; i++) {
+		_patch_here(c, nd, ends[i]);
+	}
+	free(ends);
+}
+
+static void _loop_begin(Compiler* c, LoopState* loop, int continueTarget) {
+	loop->continueTarget = continueTarget;
+	loop->numBreaks = 0;
+	loop->numContinues = 0;
+	loop->parent = c->fs->loop;
+	c->fs->loop = loop;
+}
+
+// Patches the loop's breaks to the current pc.
+static void _loop_end(Compiler* c, Node* nd, LoopState* loop) {
+	for (int i = 0; i < loop->numBreaks; i++) {
+		_patch_here(c, nd, loop->breaks[i]);
+	}
+	c->fs->loop = loop->parent;
+}
+
+// for a, i in list { ... }: a is the element and the optional i its index.
+static void _for_list(Compiler* c, Node* nd, Node* vars) {
+	FunctionState* fs = c->fs;
+	// iterable, counter, element, index
+	int base = _reserve(c, nd, 4);
+	_expr(c, nd->children[1], base);
+	_emit(c, nd, INS_ABC(IT_FORPREP, base, 0, 0));
+
+	int start = fs->fn->codeLen;
+	int exit = _emit(c, nd, INS_ASBX(IT_FORITER, base, 0));
+	for (int i = 0; i < vars->childCount; i++) {
+		const char* name = vars->children[i]->string;
+		int type = i > 0 && !_assigns(nd->children[2], name) ? TY_INT : TY_ANY;
+		_declare_local(c, vars->children[i], name, base + 2 + i, type);
+	}
+
+	LoopState loop;
+	_loop_begin(c, &loop, start);
+	_block(c, nd->children[2]);
+	_patch(c, nd, _emit(c, nd, INS_ASBX(IT_JMP, 0, 0)), start);
+	_patch_here(c, nd, exit);
+	_loop_end(c, nd, &loop);
+}
+
+// for v, i in a..b..s { ... } counts in registers instead of building the
+// list: value, limit, step, the variable v and, when asked for, index i.
+static void _for_range(Compiler* c, Node* nd, Node* vars) {
+	FunctionState* fs = c->fs;
+	Node* range = nd->children[1];
+	int base = _reserve(c, nd, vars->childCount > 1 ? 6 : 4);
+	int operands[3];
+	_range_operands(c, range, base, operands);
+	// RANGEPREP fails on anything but numbers
+	int valueType = operands[0] == TY_INT && operands[2] == TY_INT ? TY_INT : TY_DOUBLE;
+	if (vars->childCount > 1) {
+		// index starts one below, the body increments it first
+		_emit(c, nd, INS_ABX(IT_LOADK, base + 4, _constant(c, nd, obj_number(-1))));
+		_emit(c, nd, INS_ABX(IT_LOADK, base + 5, _constant(c, nd, obj_number(1))));
+	}
+	int exit = _emit(c, nd, INS_ASBX(IT_RANGEPREP, base, 0));
+
+	int body = fs->fn->codeLen;
+	int types[2];
+	for (int i = 0; i < vars->childCount; i++) {
+		types[i] = _assigns(nd->children[2], vars->children[i]->string) ? TY_ANY : i == 0 ? valueType : TY_INT;
+	}
+	if (vars->childCount > 1) _emit(c, nd, INS_ABC(types[1] == TY_INT ? IT_ADDN : IT_ADD, base + 4, base + 4, base + 5));
+	for (int i = 0; i < vars->childCount; i++) {
+		_declare_local(c, vars->children[i], vars->children[i]->string, base + 3 + i, types[i]);
+	}
+
+	LoopState loop;
+	_loop_begin(c, &loop, -1);
+	_block(c, nd->children[2]);
+	for (int i = 0; i < loop.numContinues; i++) {
+		_patch_here(c, nd, loop.continues[i]);
+	}
+	_patch(c, nd, _emit(c, nd, INS_ASBX(IT_RANGELOOP, base, 0)), body);
+	_patch_here(c, nd, exit);
+	_loop_end(c, nd, &loop);
+}
+
+static void _for_stmt(Compiler* c, Node* nd) {
+	int saved = c->fs->freeReg;
+	Node* vars = nd->children[0];
+	if (vars->childCount < 1 || vars->childCount > 2) {
+		_error(c, nd, "A for loop takes one or two variables.");
+		return;
+	}
+
+	_begin_scope(c);
+	if (nd->children[1] != NULL && nd->children[1]->type == NT_RANGE) _for_range(c, nd, vars);
+	else _for_list(c, nd, vars);
+	_end_scope(c);
+	c->fs->freeReg = saved;
+}
+
+static void _stmt(Compiler* c, Node* nd) {
+	if (nd == NULL) {
+		_error(c, nd, "Invalid statement.");
+		return;
+	}
+
+	FunctionState* fs = c->fs;
+	int saved = fs->freeReg;
+	switch (nd->type) {
+		case NT_LET_STMT: _let(c, nd); break;
+		case NT_FUN_DECL_STMT: _fun_bind(c, nd, _fun_body(c, nd)); break;
+		case NT_IF_STMT: _if_stmt(c, nd); break;
+		case NT_FOR_STMT: _for_stmt(c, nd); break;
+		case NT_STMT_LIST: _block(c, nd); break;
+		case NT_ASSIGN:
+		case NT_ASSIGN_ADD:
+		case NT_ASSIGN_SUB:
+		case NT_ASSIGN_MUL:
+		case NT_ASSIGN_DIV: _assign(c, nd); break;
+		case NT_RETURN: {
+			Node* value = nd->childCount > 0 ? nd->children[0] : NULL;
+			// a body inlined for the call returned here may tail call too
+			if (value != NULL && value->type == NT_TRAIL && value->childCount == 2 && _in_tail(c)) fs->tailCall = value->children[1];
+			if (value != NULL && _is_tail_call(c, value)) {
+				Node* call = value->children[value->childCount - 1];
+				_call(c, call, call->children[0], _trail(c, value, value->childCount - 1, -1, NULL), IT_TAILCALL);
+			} else if (fs->inl != NULL) {
+				int type = TY_ANY;
+				if (value != NULL) type = _expr(c, value, fs->inl->result);
+				else _emit(c, nd, INS_ABC(IT_LOADNIL, fs->inl->result, 0, 0));
+				fs->inl->type = fs->inl->type == TY_COUNT || fs->inl->type == type ? type : TY_ANY;
+				// the last statement falls through to the end
+				if (nd != fs->inl->last) {
+					if (fs->inl->numJumps >= COMPILER_MAX_JUMPS) _error(c, nd, "Too many 'return's in one function.");
+					else fs->inl->jumps[fs->inl->numJumps++] = _emit(c, nd, INS_ASBX(IT_JMP, 0, 0));
+				}
+			} else if (value != NULL) _emit(c, nd, INS_ABC(IT_RETURN, _expr_any(c, value), 1, 0));
+			else _emit(c, nd, INS_ABC(IT_RETURN, 0, 0, 0));
+			fs->tailCall = NULL;
+			fs->freeReg = saved;
+		} break;
+		case NT_CONTINUE: {
+			if (fs->loop == NULL) _error(c, nd, "'continue' outside of a loop.");
+			else if (fs->loop->continueTarget >= 0) _patch(c, nd, _emit(c, nd, INS_ASBX(IT_JMP, 0, 0)), fs->loop->continueTarget);
+			else if (fs->loop->numContinues >= COMPILER_MAX_JUMPS) _error(c, nd, "Too many 'continue's in one loop.");
+			else fs->loop->continues[fs->loop->numContinues++] = _emit(c, nd, INS_ASBX(IT_JMP, 0, 0));
+		} break;
+		case NT_BREAK: {
+			if (fs->loop == NULL) _error(c, nd, "'break' outside of a loop.");
+			else if (fs->loop->numBreaks >= COMPILER_MAX_JUMPS) _error(c, nd, "Too many 'break's in one loop.");
+			else fs->loop->breaks[fs->loop->numBreaks++] = _emit(c, nd, INS_ASBX(IT_JMP, 0, 0));
+		} break;
+		case NT_FUN_CALL_STMT: {
+			int reg = _reserve(c, nd, 1);
+			Node* args = nd->childCount > 0 ? nd->children[0] : NULL;
+			int type;
+			if (!_inline(c, nd, nd->string, args, reg, &type)) {
+				int local = _find_local(fs, nd->string);
+				if (local >= 0) _emit(c, nd, INS_ABC(IT_MOVE, reg, local, 0));
+				else _emit(c, nd, INS_ABX(IT_GETGLOBAL, reg, _global(c, nd, nd->string)));
+				_call(c, nd, args, reg, IT_CALL);
+			}
+			fs->freeReg = saved;
+		} break;
+		default: {
+			// expression statement, the value is dropped
+			_expr(c, nd, _reserve(c, nd, 1));
+			fs->freeReg = saved;
+		} break;
+	}
+}
+
+static void _compiler_init(Compiler* c, Interner* strings, ErrorSink* errors, const CompileOptions* options) {
+	c->program = program_new(strings);
+	if (options != NULL) c->options = *options;
+	else memset(&c->options, 0, sizeof(CompileOptions));
+	c->fs = NULL;
+	c->errors = 0;
+	c->errorSink = errors;
+	c->inlinable = NULL;
+	c->numInlinable = 0;
+	c->globalFlags = NULL;
+	c->globalFlagsCap = 0;
+}
+
+static void _compiler_free(Compiler* c) {
+	free(c->inlinable);
+	free(c->globalFlags);
+}
+
+void compile_function(Precompiled* pre, Node* decl, Interner* strings, const CompileOptions* options) {
+	pre->decl = decl;
+	error_sink_new(&pre->errors, NULL);
+
+	Compiler c;
+	_compiler_init(&c, strings, &pre->errors, options);
+	// only the function's own state is used, its parent just marks it as nested
+	FunctionState top;
+	_fs_init(&top, NULL, NULL);
+	c.fs = &top;
+	_fun_body(&c, decl);
+	pre->globalFlags = c.globalFlags;
+	pre->globalFlagsCap = c.globalFlagsCap;
+	c.globalFlags = NULL;
+	_compiler_free(&c);
+
+	pre->functions = c.program;
+	if (c.errors > 0) {
+		program_free(c.program);
+		pre->functions = NULL;
+	}
+}
+
+void precompiled_free(Precompiled* pre) {
+	program_free(pre->functions);
+	pre->functions = NULL;
+	error_sink_free(&pre->errors);
+	free(pre->globalFlags);
+	pre->globalFlags = NULL;
+}
+
+static int _is_inlinable(Compiler* c, const char* name) {
+	for (int i = 0; i < c->numInlinable; i++) {
+		if (c->inlinable[i].name == name) return 1;
+	}
+	return 0;
+}
+
+static int _has_inline_site(Compiler* c, Node* nd) {
+	if (nd == NULL) return 0;
+	if (nd->type == NT_FUN_CALL_STMT && _is_inlinable(c, nd->string)) return 1;
+	if (nd->type == NT_TRAIL && nd->childCount > 1 && nd->children[0] != NULL && nd->children[0]->type == NT_IDENTIFIER &&
+		nd->children[1]->type == NT_CALL && _is_inlinable(c, nd->children[0]->string)) return 1;
+	for (int i = 0; i < nd->childCount; i++) {
+		if (_has_inline_site(c, nd->children[i])) return 1;
+	}
+	return 0;
+}
+
+static int _count_nodes(Node* nd) {
+	if (nd == NULL) return 0;
+	int count = 1;
+	for (int i = 0; i < nd->childCount; i++) {
+		count += _count_nodes(nd->children[i]);
+	}
+	return count;
+}
+
+// Whether nd reads or calls name.
+static int _mentions(Node* nd, const char* name) {
+	if (nd == NULL) return 0;
+	if ((nd->type == NT_IDENTIFIER || nd->type == NT_FUN_CALL_STMT) && nd->string == name) return 1;
+	for (int i = 0; i < nd->childCount; i++) {
+		if (_mentions(nd->children[i], name)) return 1;
+	}
+	return 0;
+}
+
+static int _declares_functions(Node* nd) {
+	if (nd == NULL) return 0;
+	if (nd->type == NT_FUN_DECL_STMT) return 1;
+	for (int i = 0; i < nd->childCount; i++) {
+		if (_declares_functions(nd->children[i])) return 1;
+	}
+	return 0;
+}
+
+static void _count_write(Compiler* c, const char* name, int* writes) {
+	for (int i = 0; i < c->numInlinable; i++) {
+		if (c->inlinable[i].name == name) writes[i]++;
+	}
+}
+
+// Counts the assignments to the names of the candidates in writes. Only top
+// level lets declare globals, other assignments count whatever they target.
+static void _count_writes(Compiler* c, Node* nd, int top, int* writes) {
+	if (nd == NULL) return;
+	switch (nd->type) {
+		case NT_FUN_DECL_STMT: {
+			_count_write(c, nd->string, writes);
+			Node* params = nd->children[0];
+			for (int i = 0; i < params->childCount; i++) {
+				Node* param = params->children[i];
+				if (param != NULL && param->type == NT_ASSIGN) _count_writes(c, param->children[0], 0, writes);
+			}
+			_count_writes(c, nd->children[1], 0, writes);
+		} return;
+		case NT_LET_STMT: {
+			Node* args = nd->children[0];
+			for (int i = 0; i < args->childCount; i++) {
+				Node* arg = args->children[i];
+				if (arg == NULL) continue;
+				if (top) _count_write(c, arg->string, writes);
+				if (arg->type == NT_ASSIGN) _count_writes(c, arg->children[0], 0, writes);
+			}
+		} return;
+		case NT_ASSIGN:
+		case NT_ASSIGN_ADD:
+		case NT_ASSIGN_SUB:
+		case NT_ASSIGN_MUL:
+		case NT_ASSIGN_DIV: {
+			Node* target = nd->children[0];
+			if (target != NULL && target->type == NT_IDENTIFIER) _count_write(c, target->string, writes);
+		} break;
+		default: break;
+	}
+	for (int i = 0; i < nd->childCount; i++) {
+		_count_writes(c, nd->children[i], 0, writes);
+	}
+}
+
+static int _has_name(const char** names, int count, const char* name) {
+	for (int i = 0; i < count; i++) {
+		if (names[i] == name) return 1;
+	}
+	return 0;
+}
+
+// Adds the names nd reads that aren't locals in declared to in->reads, in
+// a body small enough to fit both arrays.
+static void _collect_reads(Inlinable* in, Node* nd, const char** declared, int* numDeclared) {
+	if (nd == NULL) return;
+	switch (nd->type) {
+		case NT_IDENTIFIER:
+		case NT_FUN_CALL_STMT: {
+			if (!_has_name(declared, *numDeclared, nd->string) && !_has_name(in->reads, in->numReads, nd->string)) {
+				in->reads[in->numReads++] = nd->string;
+			}
+		} break;
+		case NT_STMT_LIST: {
+			int saved = *numDeclared;
+			for (int i = 0; i < nd->childCount; i++) {
+				_collect_reads(in, nd->children[i], declared, numDeclared);
+			}
+			*numDeclared = saved;
+		} return;
+		case NT_LET_STMT: {
+			Node* args = nd->children[0];
+			for (int i = 0; i < args->childCount; i++) {
+				Node* arg = args->children[i];
+				if (arg == NULL) continue;
+				if (arg->type == NT_ASSIGN) _collect_reads(in, arg->children[0], declared, numDeclared);
+				declared[(*numDeclared)++] = arg->string;
+			}
+		} return;
+		case NT_FOR_STMT: {
+			_collect_reads(in, nd->children[1], declared, numDeclared);
+			int saved = *numDeclared;
+			Node* vars = nd->children[0];
+			for (int i = 0; i < vars->childCount; i++) {
+				declared[(*numDeclared)++] = vars->children[i]->string;
+			}
+			_collect_reads(in, nd->children[2], declared, numDeclared);
+			*numDeclared = saved;
+		} return;
+		default: break;
+	}
+	for (int i = 0; i < nd->childCount; i++) {
+		_collect_reads(in, nd->children[i], declared, numDeclared);
+	}
+}
+
+// Picks the top level functions whose calls can be replaced with their
+// body: small ones nothing else assigns to, which neither call themselves
+// nor declare functions.
+static void _find_inlinable(Compiler* c, Node* stmts) {
+	int count = 0;
+	for (int i = 0; i < stmts->childCount; i++) {
+		if (stmts->children[i] != NULL && stmts->children[i]->type == NT_FUN_DECL_STMT) count++;
+	}
+	if (count == 0) return;
+	c->inlinable = (Inlinable*) calloc(count, sizeof(Inlinable));
+	for (int i = 0; i < stmts->childCount; i++) {
+		Node* stmt = stmts->children[i];
+		if (stmt == NULL || stmt->type != NT_FUN_DECL_STMT) continue;
+		c->inlinable[c->numInlinable].name = stmt->string;
+		c->inlinable[c->numInlinable++].decl = stmt;
+	}
+	int* writes = (int*) calloc(count, sizeof(int));
+	for (int i = 0; i < stmts->childCount; i++) {
+		_count_writes(c, stmts->children[i], 1, writes);
+	}
+
+	int kept = 0;
+	for (int i = 0; i < count; i++) {
+		Inlinable in = c->inlinable[i];
+		Node* params = in.decl->children[0];
+		Node* body = in.decl->children[1];
+		int size = _count_nodes(params) + _count_nodes(body);
+		if (writes[i] > 1) _note(c, in.decl, "'%s' is not inlined: it is assigned elsewhere.", in.name);
+		else if (_mentions(params, in.name) || _mentions(body, in.name)) _note(c, in.decl, "'%s' is not inlined: it is recursive.", in.name);
+		else if (_declares_functions(body)) _note(c, in.decl, "'%s' is not inlined: it declares functions.", in.name);
+		else if (size > COMPILER_INLINE_BUDGET) _note(c, in.decl, "'%s' is not inlined: it has %d nodes, more than %d.", in.name, size, COMPILER_INLINE_BUDGET);
+		else {
+			const char* declared[COMPILER_INLINE_BUDGET];
+			int numDeclared = 0;
+			for (int j = 0; j < params->childCount; j++) {
+				if (params->children[j] != NULL) declared[numDeclared++] = params->children[j]->string;
+			}
+			for (int j = 0; j < params->childCount; j++) {
+				Node* param = params->children[j];
+				if (param != NULL && param->type == NT_ASSIGN) _collect_reads(&in, param->children[0], declared, &numDeclared);
+			}
+			_collect_reads(&in, body, declared, &numDeclared);
+			_note(c, in.decl, "'%s' can be inlined (%d nodes).", in.name, size);
+			c->inlinable[kept++] = in;
+		}
+	}
+	c->numInlinable = kept;
+	free(writes);
+}
+
+// Moves a precompiled function and its nested ones into the program, in
+// the order compiling it in place would have added them.
+static void _fun_adopt(Compiler* c, Precompiled* pre) {
+	// it was compiled without knowing what calls can inline
+	if (_has_inline_site(c, pre->decl)) {
+		_fun_bind(c, pre->decl, _fun_body(c, pre->decl));
+		return;
+	}
+	c->errors += pre->errors.count;
+	error_sink_append(c->errorSink, &pre->errors);
+	if (pre->functions == NULL) return;
+
+	// its global slots were numbered on their own, taking them over in
+	// order numbers them as compiling in place would have
+	Program* from = pre->functions;
+	int* slots = (int*) malloc(sizeof(int) * (from->numGlobals > 0 ? from->numGlobals : 1));
+	for (int i = 0; i < from->numGlobals; i++) {
+		slots[i] = _global(c, pre->decl, from->globals[i]);
+		// the `fun`s nested in it
+		if (i < pre->globalFlagsCap && (pre->globalFlags[i] & GLOBAL_DECLARED)) _flag_global(c, slots[i], GLOBAL_DECLARED);
+	}
+	for (int i = 0; i < from->numFunctions; i++) {
+		Function* fn = from->functions[i];
+		for (int pc = 0; pc < fn->codeLen; pc++) {
+			Instruction ins = fn->code[pc];
+			if (INS_OP(ins) == IT_GETGLOBAL || INS_OP(ins) == IT_SETGLOBAL) fn->code[pc] = INS_ABX(INS_OP(ins), INS_A(ins), slots[INS_BX(ins)]);
+		}
+		program_add_function(c->program, fn);
+	}
+	free(slots);
+	Function* fn = from->functions[0];
+	from->numFunctions = 0;
+	program_free(from);
+	pre->functions = NULL;
+	_fun_bind(c, pre->decl, fn);
+}
+
+// Reports globals used but never declared by a `let` or `fun`, and globals
+// the top level code reads before it assigns them when no function
+// assigns them.
+static void _check_globals(Compiler* c) {
+	Program* prog = c->program;
+	int n = prog->numGlobals > 0 ? prog->numGlobals : 1;
+	int* mainDef = (int*) malloc(sizeof(int) * n); // first top level pc assigning it
+	char* defined = (char*) calloc(n, 1); // 1 at the top level, 2 in a function
+	char* reported = (char*) calloc(n, 1);
+	for (int i = 0; i < prog->numGlobals; i++) {
+		mainDef[i] = -1;
+		_flag_global(c, i, 0);
+		if (vm_find_native(prog->globals[i]) != NULL) {
+			defined[i] = 2;
+			_flag_global(c, i, GLOBAL_DECLARED);
+		}
+	}
+	for (int f = 0; f < prog->numFunctions; f++) {
+		Function* fn = prog->functions[f];
+		for (int pc = 0; pc < fn->codeLen; pc++) {
+			if (INS_OP(fn->code[pc]) != IT_SETGLOBAL) continue;
+			int slot = INS_BX(fn->code[pc]);
+			if (f > 0) defined[slot] = 2;
+			else {
+				if (mainDef[slot] < 0) mainDef[slot] = pc;
+				if (defined[slot] == 0) defined[slot] = 1;
+			}
+		}
+	}
+	for (int f = 0; f < prog->numFunctions; f++) {
+		Function* fn = prog->functions[f];
+		for (int pc = 0; pc < fn->codeLen; pc++) {
+			int op = INS_OP(fn->code[pc]);
+			if (op != IT_GETGLOBAL && op != IT_SETGLOBAL) continue;
+			int slot = INS_BX(fn->code[pc]);
+			if (reported[slot]) continue;
+			// assigning a global doesn't declare it
+			if (!(c->globalFlags[slot] & GLOBAL_DECLARED)) {
+				_error_line(c, fn->lines[pc], "Undefined variable '%s'.", prog->globals[slot]);
+				reported[slot] = 1;
+			} else if (op == IT_GETGLOBAL && f == 0 && defined[slot] == 1 && pc < mainDef[slot]) {
+				_error_line(c, fn->lines[pc], "'%s' is used before it is defined on line %d.", prog->globals[slot], fn->lines[mainDef[slot]]);
+				reported[slot] = 1;
+			}
+		}
+	}
+	free(mainDef);
+	free(defined);
+	free(reported);
+}
+
+Program* compile_program(Node* root, Interner* strings, ErrorSink* errors, const CompileOptions* options) {
+	return compile_program_with(root, strings, errors, NULL, 0, options);
+}
+
+Program* compile_program_with(Node* root, Interner* strings, ErrorSink* errors, Precompiled* pre, int numPre, const CompileOptions* options) {
+	Compiler c;
+	_compiler_init(&c, strings, errors, options);
+
+	Function* main = function_new(NULL);
+	program_add_function(c.program, main);
+
+	FunctionState fs;
+	_fs_init(&fs, main, NULL);
+	c.fs = &fs;
+
+	Node* stmts = root != NULL && root->childCount > 0 ? root->children[0] : NULL;
+	int next = 0;
+	if (stmts != NULL) {
+		_find_inlinable(&c, stmts);
+		for (int i = 0; i < stmts->childCount; i++) {
+			Node* stmt = stmts->children[i];
+			if (next < numPre && pre[next].decl == stmt) _fun_adopt(&c, &pre[next++]);
+			else _stmt(&c, stmt);
+		}
+	}
+	_emit(&c, root, INS_ABC(IT_RETURN, 0, 0, 0));
+	if (c.errors == 0) _check_globals(&c);
+	_compiler_free(&c);
+
+	if (c.errors > 0) {
+		program_free(c.program);
+		return NULL;
+	}
+	return c.program;
+}
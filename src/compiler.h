@@ -0,0 +1,122 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "ast.h"
+#include "vm.h"
+
+#define COMPILER_MAX_LOCALS 256
+#define COMPILER_MAX_JUMPS 256
+// syntax tree nodes, parameters included, of the functions calls may inline
+#define COMPILER_INLINE_BUDGET 40
+#define COMPILER_MAX_INLINE_DEPTH 3
+
+typedef struct Local_t {
+	const char* name; // interned
+	int reg, depth;
+	int type; // what every store to it is checked against, TY_ANY for anything
+} Local;
+
+typedef struct LoopState_t {
+	int continueTarget; // -1 until known, continues are patched later
+	int breaks[COMPILER_MAX_JUMPS];
+	int numBreaks;
+	int continues[COMPILER_MAX_JUMPS];
+	int numContinues;
+	struct LoopState_t* parent;
+} LoopState;
+
+// A top level function whose calls may be replaced with its body.
+typedef struct Inlinable_t {
+	const char* name; // interned
+	Node* decl; // its NT_FUN_DECL_STMT
+	const char* reads[COMPILER_INLINE_BUDGET]; // globals the body reads
+	int numReads;
+} Inlinable;
+
+// A body being inlined: its returns store to result and jump to the end.
+typedef struct InlineState_t {
+	const Inlinable* callee;
+	int result;
+	int type; // of what the returns so far store, TY_COUNT before the first
+	int tail; // the caller returns the result, so calls it returns can be tail calls
+	Node* last; // the body's last statement, a return there needs no jump
+	int jumps[COMPILER_MAX_JUMPS];
+	int numJumps;
+	struct InlineState_t* parent;
+} InlineState;
+
+typedef struct FunctionState_t {
+	Function* fn;
+	Local locals[COMPILER_MAX_LOCALS];
+	int numLocals, depth;
+	int localsFloor; // locals below belong to the caller of an inlined body
+	int freeReg;
+	LoopState* loop;
+	InlineState* inl;
+	Node* tailCall; // the NT_CALL the return being compiled returns
+	struct FunctionState_t* parent;
+} FunctionState;
+
+// What compiling does besides compiling, NULL stands for all zeros.
+typedef struct CompileOptions_t {
+	int reportInlining; // note each inlining decision in the sink
+} CompileOptions;
+
+// Compiler.globalFlags
+#define GLOBAL_MAIN_ASSIGNED 0x01 // the top level code assigned it already
+#define GLOBAL_DECLARED 0x02 // by a top level `let` or a `fun`
+
+typedef struct Compiler_t {
+	Program* program;
+	CompileOptions options;
+	FunctionState* fs;
+	int errors;
+	ErrorSink* errorSink;
+	Inlinable* inlinable;
+	int numInlinable;
+	char* globalFlags; // GLOBAL_* by global slot
+	int globalFlagsCap;
+} Compiler;
+
+// Compiles a tree from ast_parse_program into register based bytecode.
+// Top level `let`s and every `fun` are globals, numbered into the
+// Program's slots; everything else declared inside a block or function
+// lives in a register. Using a global no `let` or `fun` declares (besides
+// the built-in natives), assigning included, or reading one the top level
+// code only assigns further down, is an error.
+//
+// `let` and `fun` parameters may be annotated with a type (`let n: int = 0`,
+// `fun f(x: double)`). Stores to annotated locals are checked when compiling
+// if the value's type is known and at run time otherwise, parameters once on
+// entry. Arithmetic and comparisons on operands of known types compile to
+// the unchecked opcodes, which compute what the checked ones would: ints
+// are doubles, and only bitwise ops and shifts convert them to 64 bits. For
+// loops over a range type their variables themselves when the body doesn't
+// assign them.
+// On top level `let`s, which are globals, only the initial value is checked.
+//
+// Calls of small top level functions nothing else assigns to, which don't
+// call themselves or declare functions, are replaced with their body, and
+// `return f(...)` in a function reuses its frame for the call.
+// Returns NULL on errors, which go to the sink (NULL prints them).
+// Compiling doesn't intern, so sessions sharing `strings` may run on
+// several threads.
+extern Program* compile_program(Node* root, Interner* strings, ErrorSink* errors, const CompileOptions* options);
+
+// A top level `fun` compiled ahead of the rest of the program, possibly on
+// another thread.
+typedef struct Precompiled_t {
+	Node* decl; // an NT_FUN_DECL_STMT of the program's statement list
+	Program* functions; // the function then its nested ones, NULL on errors
+	ErrorSink errors; // buffered until the program adopts the function
+	char* globalFlags; // of the slots of functions, by their own numbering
+	int globalFlagsCap;
+} Precompiled;
+
+extern void compile_function(Precompiled* pre, Node* decl, Interner* strings, const CompileOptions* options);
+extern void precompiled_free(Precompiled* pre);
+// Like compile_program, taking pre (in statement order) instead of
+// compiling those declarations. Output and errors match compile_program.
+extern Program* compile_program_with(Node* root, Interner* strings, ErrorSink* errors, Precompiled* pre, int numPre, const CompileOptions* options);
+
+#endif // COMPILER_H
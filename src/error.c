@@ -0,0 +1,77 @@
+#include "error.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+void error_sink_new(ErrorSink* sink, FILE* out) {
+	sink->out = out;
+	sink->text = NULL;
+	sink->length = 0;
+	sink->capacity = 0;
+	sink->count = 0;
+}
+
+void error_sink_free(ErrorSink* sink) {
+	free(sink->text);
+	sink->text = NULL;
+	sink->length = 0;
+	sink->capacity = 0;
+}
+
+static void _append(ErrorSink* sink, const char* text, size_t len) {
+	if (sink->length + len + 1 > sink->capacity) {
+		sink->capacity = (sink->length + len + 1) * 2;
+		sink->text = (char*) realloc(sink->text, sink->capacity);
+	}
+	memcpy(sink->text + sink->length, text, len);
+	sink->length += len;
+	sink->text[sink->length] = '\0';
+}
+
+static void _report(ErrorSink* sink, int count, const char* fmt, va_list args) {
+	if (sink == NULL || sink->out != NULL) {
+		FILE* out = sink != NULL ? sink->out : stdout;
+		vfprintf(out, fmt, args);
+		fputc('\n', out);
+		if (sink != NULL) sink->count += count;
+		return;
+	}
+
+	char buf[512];
+	int n = vsnprintf(buf, sizeof(buf), fmt, args);
+	if (n < 0) return;
+	if ((size_t) n >= sizeof(buf)) n = sizeof(buf) - 1;
+	buf[n++] = '\n';
+	_append(sink, buf, n);
+	sink->count += count;
+}
+
+void error_report(ErrorSink* sink, const char* fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	_report(sink, 1, fmt, args);
+	va_end(args);
+}
+
+void error_note(ErrorSink* sink, const char* fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	_report(sink, 0, fmt, args);
+	va_end(args);
+}
+
+void error_sink_append(ErrorSink* dst, ErrorSink* src) {
+	if (src->length > 0) {
+		if (dst == NULL || dst->out != NULL) fwrite(src->text, 1, src->length, dst != NULL ? dst->out : stdout);
+		else _append(dst, src->text, src->length);
+	}
+	if (dst != NULL) dst->count += src->count;
+	src->length = 0;
+	src->count = 0;
+}
+
+void error_sink_flush(ErrorSink* sink, FILE* out) {
+	if (sink->length > 0) fwrite(sink->text, 1, sink->length, out);
+	sink->length = 0;
+}
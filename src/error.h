@@ -0,0 +1,29 @@
+#ifndef ERROR_H
+#define ERROR_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Where a compile session reports its errors. Sinks with an output print
+// right away; the others buffer the text, so sessions running on other
+// threads can be reported in order afterwards. A NULL sink prints to stdout.
+typedef struct ErrorSink_t {
+	FILE* out;
+	char* text;
+	size_t length, capacity;
+	int count;
+} ErrorSink;
+
+extern void error_sink_new(ErrorSink* sink, FILE* out);
+extern void error_sink_free(ErrorSink* sink);
+
+// Reports one error, fmt is the whole line without the newline.
+extern void error_report(ErrorSink* sink, const char* fmt, ...);
+// Like error_report, for lines that aren't errors.
+extern void error_note(ErrorSink* sink, const char* fmt, ...);
+// Moves the buffered text of src into dst.
+extern void error_sink_append(ErrorSink* dst, ErrorSink* src);
+// Writes the buffered text to out and empties the buffer.
+extern void error_sink_flush(ErrorSink* sink, FILE* out);
+
+#endif // ERROR_H
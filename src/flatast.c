@@ -0,0 +1,168 @@
+#include "flatast.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+void flat_ast_build(FlatAst* ast, Node* root) {
+	// breadth first: queue[i] is the source of flat node i
+	uint32_t count = 0, capacity = 64;
+	Node** queue = (Node**) malloc(sizeof(Node*) * capacity);
+	queue[count++] = root;
+	for (uint32_t i = 0; i < count; i++) {
+		Node* nd = queue[i];
+		if (nd == NULL) continue;
+		if (count + nd->childCount > capacity) {
+			while (count + nd->childCount > capacity) capacity *= 2;
+			queue = (Node**) realloc(queue, sizeof(Node*) * capacity);
+		}
+		for (int j = 0; j < nd->childCount; j++) {
+			queue[count++] = nd->children[j];
+		}
+	}
+
+	ast->count = count;
+	ast->types = (uint8_t*) malloc(sizeof(uint8_t) * count);
+	ast->payloads = (FlatPayload*) malloc(sizeof(FlatPayload) * count);
+	ast->firstChild = (uint32_t*) malloc(sizeof(uint32_t) * count);
+	ast->childCount = (uint32_t*) malloc(sizeof(uint32_t) * count);
+	ast->lines = (int*) malloc(sizeof(int) * count);
+	ast->annotations = (uint8_t*) malloc(sizeof(uint8_t) * count);
+
+	uint32_t tail = 1;
+	for (uint32_t i = 0; i < count; i++) {
+		Node* nd = queue[i];
+		if (nd == NULL) {
+			ast->types[i] = NT_UNKNOWN;
+			ast->payloads[i].string = NULL;
+			ast->firstChild[i] = FLAT_AST_NULL;
+			ast->childCount[i] = 0;
+			ast->lines[i] = 0;
+			ast->annotations[i] = 0;
+			continue;
+		}
+
+		ast->types[i] = (uint8_t) nd->type;
+		switch (nd->type) {
+			case NT_NUMBER: ast->payloads[i].value = nd->value; break;
+			case NT_BOOL: ast->payloads[i].boolean = nd->boolean; break;
+			default: ast->payloads[i].string = nd->string; break;
+		}
+		ast->firstChild[i] = nd->childCount > 0 ? tail : FLAT_AST_NULL;
+		ast->childCount[i] = nd->childCount;
+		ast->lines[i] = nd->line;
+		ast->annotations[i] = (uint8_t) nd->annotation;
+		tail += nd->childCount;
+	}
+	free(queue);
+}
+
+void flat_ast_free(FlatAst* ast) {
+	free(ast->types);
+	free(ast->payloads);
+	free(ast->firstChild);
+	free(ast->childCount);
+	free(ast->lines);
+	free(ast->annotations);
+	ast->types = NULL;
+	ast->payloads = NULL;
+	ast->firstChild = NULL;
+	ast->childCount = NULL;
+	ast->lines = NULL;
+	ast->annotations = NULL;
+	ast->count = 0;
+}
+
+uint32_t flat_ast_child(const FlatAst* ast, uint32_t node, uint32_t i) {
+	if (i >= ast->childCount[node]) return FLAT_AST_NULL;
+	return ast->firstChild[node] + i;
+}
+
+static void _printpad(int pad) {
+	for (int i = 0; i < pad; i++) printf(" ");
+}
+
+// How many of its children ast_print shows for a node.
+static uint32_t _shown_children(const FlatAst* ast, uint32_t node) {
+	uint32_t count = ast->childCount[node];
+	switch (ast->types[node]) {
+		case NT_UNARY_MINUS:
+		case NT_UNARY_NOT:
+		case NT_UNARY_BITNOT:
+		case NT_LET_STMT:
+		case NT_RETURN: return count < 1 ? count : 1;
+		case NT_FUN_DECL_STMT: return count < 2 ? count : 2;
+		case NT_NUMBER:
+		case NT_STRING:
+		case NT_BOOL:
+		case NT_IDENTIFIER:
+		case NT_FIELD_ACCESS:
+		case NT_CONTINUE:
+		case NT_BREAK:
+		case NT_NIL:
+		case NT_UNKNOWN: return 0;
+		default: return count;
+	}
+}
+
+static void _print_head(const FlatAst* ast, uint32_t node, int pad) {
+	FlatPayload payload = ast->payloads[node];
+	int annotation = ast->annotations[node];
+	_printpad(pad);
+	printf("%s {\n", AST_TYPES[ast->types[node]]);
+	switch (ast->types[node]) {
+		case NT_NUMBER: _printpad(pad + 2); printf("value = %f\n", payload.value); break;
+		case NT_BOOL: _printpad(pad + 2); printf("value = %s\n", payload.boolean ? "true" : "false"); break;
+		case NT_IDENTIFIER:
+		case NT_STRING:
+			_printpad(pad + 2); printf("value = %s\n", payload.string);
+			if (annotation != 0) { _printpad(pad + 2); printf("type = %s\n", TOKENS[annotation]); }
+			break;
+		case NT_ASSIGN:
+		case NT_ASSIGN_ADD:
+		case NT_ASSIGN_SUB:
+		case NT_ASSIGN_MUL:
+		case NT_ASSIGN_DIV:
+			if (payload.string != NULL) { _printpad(pad + 2); printf("value = %s\n", payload.string); }
+			if (annotation != 0) { _printpad(pad + 2); printf("type = %s\n", TOKENS[annotation]); }
+			break;
+		case NT_FIELD_ACCESS:
+		case NT_FUN_CALL_STMT:
+		case NT_FUN_DECL_STMT: _printpad(pad + 2); printf("name = %s\n", payload.string); break;
+		default: break;
+	}
+}
+
+typedef struct PrintStep_t {
+	uint32_t node;
+	int pad;
+	int close; // print the node's closing brace
+} PrintStep;
+
+void flat_ast_print(const FlatAst* ast, uint32_t node, int pad) {
+	if (node >= ast->count) return;
+	int count = 1, capacity = 64;
+	PrintStep* stack = (PrintStep*) malloc(sizeof(PrintStep) * capacity);
+	stack[0] = (PrintStep) { node, pad, 0 };
+	while (count > 0) {
+		PrintStep step = stack[--count];
+		if (step.close) {
+			_printpad(step.pad);
+			printf("}\n");
+			continue;
+		}
+		if (ast->types[step.node] == NT_UNKNOWN) continue;
+		_print_head(ast, step.node, step.pad);
+
+		uint32_t shown = _shown_children(ast, step.node);
+		if (count + (int) shown + 1 > capacity) {
+			while (count + (int) shown + 1 > capacity) capacity *= 2;
+			stack = (PrintStep*) realloc(stack, sizeof(PrintStep) * capacity);
+		}
+		stack[count++] = (PrintStep) { step.node, step.pad, 1 };
+		// pushed last to first so the first child prints first
+		for (uint32_t i = shown; i > 0; i--) {
+			stack[count++] = (PrintStep) { ast->firstChild[step.node] + i - 1, step.pad + 2, 0 };
+		}
+	}
+	free(stack);
+}
@@ -0,0 +1,38 @@
+#ifndef FLATAST_H
+#define FLATAST_H
+
+#include <stdint.h>
+
+#include "ast.h"
+
+#define FLAT_AST_NULL 0xFFFFFFFFu
+
+typedef union FlatPayload_t {
+	double value;
+	const char* string; // interned
+	int boolean;
+} FlatPayload;
+
+// Compact, index based copy of a Node tree. Nodes are laid out breadth first,
+// so a node's children are contiguous at [firstChild, firstChild + childCount)
+// and every parent comes before its children. Node 0 is the root. NULL
+// children are kept as NT_UNKNOWN nodes so child indices still match.
+typedef struct FlatAst_t {
+	uint8_t* types;
+	FlatPayload* payloads;
+	uint32_t* firstChild;
+	uint32_t* childCount;
+	int* lines;
+	uint8_t* annotations; // Node.annotation
+	uint32_t count;
+} FlatAst;
+
+extern void flat_ast_build(FlatAst* ast, Node* root);
+extern void flat_ast_free(FlatAst* ast);
+
+extern uint32_t flat_ast_child(const FlatAst* ast, uint32_t node, uint32_t i);
+
+// Prints the subtree at node like ast_print, without recursing.
+extern void flat_ast_print(const FlatAst* ast, uint32_t node, int pad);
+
+#endif // FLATAST_H
@@ -0,0 +1,243 @@
+#include "fold.h"
+#include "vm.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+
+typedef struct Folder_t {
+	Interner* strings;
+	int folded;
+} Folder;
+
+static int _is_constant(Node* nd) {
+	return nd != NULL && (nd->type == NT_NUMBER || nd->type == NT_STRING || nd->type == NT_BOOL || nd->type == NT_NIL);
+}
+
+static int _is_number(Node* nd, double value) {
+	return nd != NULL && nd->type == NT_NUMBER && nd->value == value;
+}
+
+// Whether nd is a zero of the given sign. Only x + -0 and x - +0 are x for
+// every x, as -0 + +0 is +0.
+static int _is_zero(Node* nd, int negative) {
+	return _is_number(nd, 0) && (signbit(nd->value) != 0) == negative;
+}
+
+// Whether nd always evaluates to a number (or fails), whatever its operands.
+static int _is_numeric(Node* nd) {
+	if (nd == NULL) return 0;
+	switch (nd->type) {
+		case NT_NUMBER:
+		case NT_UNARY_MINUS:
+		case NT_UNARY_BITNOT:
+		case NT_BINARY_SUB:
+		case NT_BINARY_MUL:
+		case NT_BINARY_DIV:
+		case NT_BINARY_MOD:
+		case NT_BINARY_LSH:
+		case NT_BINARY_RSH:
+		case NT_BINARY_BITAND:
+		case NT_BINARY_BITOR:
+		case NT_BINARY_BITXOR: return 1;
+		case NT_BINARY_ADD: return _is_numeric(nd->children[0]) && _is_numeric(nd->children[1]);
+		default: return 0;
+	}
+}
+
+static int _truthy(Node* nd) {
+	return !(nd->type == NT_NIL || (nd->type == NT_BOOL && !nd->boolean));
+}
+
+static Node* _number(Folder* f, Node* nd, double value) {
+	nd->type = NT_NUMBER;
+	nd->value = value;
+	nd->childCount = 0;
+	f->folded++;
+	return nd;
+}
+
+static Node* _bool(Folder* f, Node* nd, int value) {
+	nd->type = NT_BOOL;
+	nd->boolean = value != 0;
+	nd->childCount = 0;
+	f->folded++;
+	return nd;
+}
+
+static Node* _replace(Folder* f, Node* nd, Node* with) {
+	(void) nd;
+	f->folded++;
+	return with;
+}
+
+static Node* _concat(Folder* f, Node* nd, Node* a, Node* b) {
+	char left[32], right[32];
+	const char* as = left;
+	const char* bs = right;
+	int alen, blen;
+	if (a->type == NT_STRING) {
+		as = a->string;
+		alen = intern_length(as);
+	} else alen = snprintf(left, sizeof(left), VM_NUMBER_FORMAT, a->value);
+	if (b->type == NT_STRING) {
+		bs = b->string;
+		blen = intern_length(bs);
+	} else blen = snprintf(right, sizeof(right), VM_NUMBER_FORMAT, b->value);
+
+	char* buf = (char*) malloc(alen + blen + 1);
+	memcpy(buf, as, alen);
+	memcpy(buf + alen, bs, blen);
+	nd->type = NT_STRING;
+	nd->string = interner_intern(f->strings, buf, alen + blen);
+	nd->childCount = 0;
+	free(buf);
+	f->folded++;
+	return nd;
+}
+
+static int _equals(Node* a, Node* b) {
+	if (a->type != b->type) return 0;
+	switch (a->type) {
+		case NT_NIL: return 1;
+		case NT_NUMBER: return a->value == b->value;
+		case NT_BOOL: return a->boolean == b->boolean;
+		default: return a->string == b->string; // interned
+	}
+}
+
+static Node* _fold_binary(Folder* f, Node* nd) {
+	Node* a = nd->children[0];
+	Node* b = nd->children[1];
+	if (a == NULL || b == NULL) return nd;
+
+	// identities, only where the other side is known to be a number so
+	// string concatenation and type errors are left to the VM
+	switch (nd->type) {
+		case NT_BINARY_ADD:
+			if (_is_zero(b, 1) && _is_numeric(a)) return _replace(f, nd, a);
+			if (_is_zero(a, 1) && _is_numeric(b)) return _replace(f, nd, b);
+			break;
+		case NT_BINARY_SUB:
+			if (_is_zero(b, 0) && _is_numeric(a)) return _replace(f, nd, a);
+			break;
+		case NT_BINARY_MUL:
+			if (_is_number(b, 1) && _is_numeric(a)) return _replace(f, nd, a);
+			if (_is_number(a, 1) && _is_numeric(b)) return _replace(f, nd, b);
+			break;
+		case NT_BINARY_DIV:
+			if (_is_number(b, 1) && _is_numeric(a)) return _replace(f, nd, a);
+			break;
+		default: break;
+	}
+
+	if (!_is_constant(a) || !_is_constant(b)) return nd;
+
+	switch (nd->type) {
+		case NT_BINARY_EQUALITY: return _bool(f, nd, _equals(a, b));
+		case NT_BINARY_INEQUALITY: return _bool(f, nd, !_equals(a, b));
+		case NT_BINARY_ADD:
+			if ((a->type == NT_STRING && (b->type == NT_STRING || b->type == NT_NUMBER)) || (a->type == NT_NUMBER && b->type == NT_STRING))
+				return _concat(f, nd, a, b);
+			break;
+		case NT_BINARY_LESS:
+		case NT_BINARY_LESSEQUALS:
+		case NT_BINARY_GREATER:
+		case NT_BINARY_GREATEREQUALS:
+			if (a->type == NT_STRING && b->type == NT_STRING) {
+				int cmp = strcmp(a->string, b->string);
+				switch (nd->type) {
+					case NT_BINARY_LESS: return _bool(f, nd, cmp < 0);
+					case NT_BINARY_LESSEQUALS: return _bool(f, nd, cmp <= 0);
+					case NT_BINARY_GREATER: return _bool(f, nd, cmp > 0);
+					default: return _bool(f, nd, cmp >= 0);
+				}
+			}
+			break;
+		default: break;
+	}
+
+	// everything else only works on numbers, mismatches fail at run time
+	if (a->type != NT_NUMBER || b->type != NT_NUMBER) return nd;
+	double x = a->value, y = b->value;
+	switch (nd->type) {
+		case NT_BINARY_ADD: return _number(f, nd, x + y);
+		case NT_BINARY_SUB: return _number(f, nd, x - y);
+		case NT_BINARY_MUL: return _number(f, nd, x * y);
+		case NT_BINARY_DIV: return _number(f, nd, x / y);
+		case NT_BINARY_MOD: return _number(f, nd, fmod(x, y));
+		case NT_BINARY_LSH: return _number(f, nd, (double) (int64_t) ((uint64_t) vm_to_int(x) << (vm_to_int(y) & 63)));
+		case NT_BINARY_RSH: return _number(f, nd, (double) (vm_to_int(x) >> (vm_to_int(y) & 63)));
+		case NT_BINARY_BITAND: return _number(f, nd, (double) (vm_to_int(x) & vm_to_int(y)));
+		case NT_BINARY_BITOR: return _number(f, nd, (double) (vm_to_int(x) | vm_to_int(y)));
+		case NT_BINARY_BITXOR: return _number(f, nd, (double) (vm_to_int(x) ^ vm_to_int(y)));
+		case NT_BINARY_LESS: return _bool(f, nd, x < y);
+		case NT_BINARY_LESSEQUALS: return _bool(f, nd, x <= y);
+		case NT_BINARY_GREATER: return _bool(f, nd, x > y);
+		case NT_BINARY_GREATEREQUALS: return _bool(f, nd, x >= y);
+		default: return nd;
+	}
+}
+
+static Node* _fold(Folder* f, Node* nd) {
+	if (nd == NULL) return NULL;
+	for (int i = 0; i < nd->childCount; i++) {
+		nd->children[i] = _fold(f, nd->children[i]);
+	}
+
+	switch (nd->type) {
+		case NT_UNARY_MINUS: {
+			Node* a = nd->children[0];
+			if (a != NULL && a->type == NT_NUMBER) return _number(f, nd, -a->value);
+		} break;
+		case NT_UNARY_BITNOT: {
+			Node* a = nd->children[0];
+			if (a != NULL && a->type == NT_NUMBER) return _number(f, nd, (double) ~vm_to_int(a->value));
+		} break;
+		case NT_UNARY_NOT: {
+			Node* a = nd->children[0];
+			if (_is_constant(a)) return _bool(f, nd, !_truthy(a));
+		} break;
+		case NT_BINARY_LOGICAND: {
+			// the value of and/or is the operand that decided it
+			Node* a = nd->children[0];
+			if (_is_constant(a)) return _replace(f, nd, _truthy(a) ? nd->children[1] : a);
+		} break;
+		case NT_BINARY_LOGICOR: {
+			Node* a = nd->children[0];
+			if (_is_constant(a)) return _replace(f, nd, _truthy(a) ? a : nd->children[1]);
+		} break;
+		case NT_TERNARY: {
+			Node* cond = nd->children[0];
+			if (_is_constant(cond)) return _replace(f, nd, _truthy(cond) ? nd->children[1] : nd->children[2]);
+		} break;
+		case NT_BINARY_ADD:
+		case NT_BINARY_SUB:
+		case NT_BINARY_MUL:
+		case NT_BINARY_DIV:
+		case NT_BINARY_MOD:
+		case NT_BINARY_LSH:
+		case NT_BINARY_RSH:
+		case NT_BINARY_BITAND:
+		case NT_BINARY_BITOR:
+		case NT_BINARY_BITXOR:
+		case NT_BINARY_EQUALITY:
+		case NT_BINARY_INEQUALITY:
+		case NT_BINARY_LESS:
+		case NT_BINARY_LESSEQUALS:
+		case NT_BINARY_GREATER:
+		case NT_BINARY_GREATEREQUALS: return _fold_binary(f, nd);
+		default: break;
+	}
+	return nd;
+}
+
+int ast_fold(Node* root, Interner* strings) {
+	Folder f;
+	f.strings = strings;
+	f.folded = 0;
+	_fold(&f, root);
+	return f.folded;
+}
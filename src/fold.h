@@ -0,0 +1,13 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include "ast.h"
+#include "intern.h"
+
+// Folds constant subexpressions in place: arithmetic, bitwise ops,
+// comparisons, string concatenation, and/or and ternaries with a constant
+// condition, plus x * 1, x / 1, x - 0 and x + -0 on numbers. Results match
+// what the VM would compute at run time. Returns the number of folded nodes.
+extern int ast_fold(Node* root, Interner* strings);
+
+#endif // FOLD_H
@@ -0,0 +1,293 @@
+#include "gc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vm.h"
+
+const double GC_PAUSE_BOUNDS[GC_PAUSE_BUCKETS - 1] = { 50e-6, 100e-6, 250e-6, 500e-6, 1e-3, 5e-3, 10e-3 };
+
+static void _push(List*** items, int* count, int* capacity, List* list) {
+	if (*count >= *capacity) {
+		*capacity = *capacity > 0 ? *capacity * 2 : 64;
+		*items = (List**) realloc(*items, sizeof(List*) * *capacity);
+	}
+	(*items)[(*count)++] = list;
+}
+
+static size_t _list_bytes(List* list) {
+	return sizeof(List) + sizeof(Object) * list->capacity;
+}
+
+void gc_new(Heap* heap) {
+	memset(heap, 0, sizeof(Heap));
+	heap->nursery = (List*) malloc(sizeof(List) * GC_NURSERY_LISTS);
+	heap->nextMajor = GC_MIN_MAJOR;
+	heap->phase = GC_IDLE;
+	heap->epoch = 1;
+	heap->sweep = &heap->old;
+}
+
+void gc_free(Heap* heap) {
+	for (int i = 0; i < heap->nurseryUsed; i++) {
+		if (!(heap->nursery[i].gcFlags & GC_FORWARDED)) free(heap->nursery[i].items);
+	}
+	free(heap->nursery);
+	List* list = heap->old;
+	while (list != NULL) {
+		List* next = list->next;
+		free(list->items);
+		free(list);
+		list = next;
+	}
+	free(heap->remembered);
+	free(heap->grey);
+}
+
+// Lists reaching the old space while a cycle runs survive it, and get
+// scanned when marking still has to see their items.
+static void _link_old(Heap* heap, List* list, int scan) {
+	list->next = heap->old;
+	heap->old = list;
+	list->gcMark = heap->phase != GC_IDLE ? heap->epoch : 0;
+	if (scan && heap->phase == GC_MARK) _push(&heap->grey, &heap->numGrey, &heap->greyCap, list);
+}
+
+List* gc_alloc_list(Heap* heap) {
+	List* list;
+	if (heap->nurseryUsed < GC_NURSERY_LISTS) {
+		list = &heap->nursery[heap->nurseryUsed++];
+		list->gcFlags = GC_YOUNG;
+		list->next = NULL;
+		if (heap->nurseryUsed == GC_NURSERY_LISTS) heap->pending = 1;
+	} else {
+		// full, the VM hasn't reached a safepoint yet
+		list = (List*) malloc(sizeof(List));
+		list->gcFlags = 0;
+		_link_old(heap, list, 0);
+		heap->oldBytes += sizeof(List);
+	}
+	list->items = NULL;
+	list->count = 0;
+	list->capacity = 0;
+	list->shape = NULL;
+	return list;
+}
+
+static void _grey(Heap* heap, Object value) {
+	if (!obj_in_heap(value)) return;
+	List* list = (List*) obj_as_ptr(value);
+	if (list->gcMark == heap->epoch) return;
+	list->gcMark = heap->epoch;
+	_push(&heap->grey, &heap->numGrey, &heap->greyCap, list);
+}
+
+void gc_mark_string(SmolVM* vm, const char* str) {
+	// the program's strings have lower ids and are never freed
+	if (intern_id(str) >= vm->strings.base) ((InternHeader*) INTERN_HEADER(str))->mark = vm->heap.epoch;
+}
+
+// Greys a list or marks a string.
+static void _reach(SmolVM* vm, Object value) {
+	if (obj_is(value, OT_STRING)) gc_mark_string(vm, (const char*) obj_as_ptr(value));
+	else _grey(&vm->heap, value);
+}
+
+void gc_note_string(SmolVM* vm, size_t bytes) {
+	Heap* heap = &vm->heap;
+	heap->oldBytes += bytes;
+	heap->newStrings += bytes;
+	// a script that only builds strings must still get collections
+	if (heap->newStrings > GC_NURSERY_BYTES) heap->pending = 1;
+}
+
+void gc_barrier_slow(Heap* heap, List* list, List* value) {
+	if (value->gcFlags & GC_YOUNG) {
+		if (!(list->gcFlags & GC_REMEMBERED)) {
+			list->gcFlags |= GC_REMEMBERED;
+			_push(&heap->remembered, &heap->numRemembered, &heap->rememberedCap, list);
+		}
+	} else if (heap->phase == GC_MARK && list->gcMark == heap->epoch) {
+		// list may be scanned already, so value must not stay white
+		_grey(heap, obj_ptr(OT_LIST, value));
+	}
+}
+
+// One past the last register any frame uses.
+static Object* _stack_top(SmolVM* vm) {
+	Object* top = vm->stack + 1;
+	for (int i = 0; i < vm->numFrames; i++) {
+		Object* end = vm->frames[i].base + vm->frames[i].fn->numRegisters;
+		if (end > top) top = end;
+	}
+	return top;
+}
+
+// Points slot at the old copy of a young list, promoting it first.
+static void _forward(Heap* heap, Object* slot, size_t* promoted) {
+	if (!obj_in_heap(*slot)) return;
+	List* list = (List*) obj_as_ptr(*slot);
+	if (!(list->gcFlags & GC_YOUNG)) return;
+	if (!(list->gcFlags & GC_FORWARDED)) {
+		List* copy = (List*) malloc(sizeof(List));
+		*copy = *list;
+		copy->gcFlags = 0;
+		_link_old(heap, copy, 1);
+		size_t bytes = _list_bytes(copy);
+		heap->oldBytes += bytes;
+		heap->stats.bytesPromoted += bytes;
+		*promoted += copy->count;
+		list->gcFlags |= GC_FORWARDED;
+		list->next = copy;
+	}
+	*slot = obj_ptr(obj_type(*slot), list->next);
+}
+
+// Promotes every young list reachable from the roots and the remembered
+// set, then frees the rest of the nursery. Returns the promoted items.
+static size_t _minor(SmolVM* vm) {
+	Heap* heap = &vm->heap;
+	size_t promoted = 0;
+	List* scanned = heap->old;
+
+	Object* top = _stack_top(vm);
+	for (Object* slot = vm->stack + 1; slot < top; slot++) _forward(heap, slot, &promoted);
+	for (int i = 0; i < vm->numGlobals; i++) _forward(heap, &vm->globals[i], &promoted);
+	for (int i = 0; i < heap->numRemembered; i++) {
+		List* list = heap->remembered[i];
+		list->gcFlags &= ~GC_REMEMBERED;
+		for (int j = 0; j < list->count; j++) _forward(heap, &list->items[j], &promoted);
+	}
+	heap->numRemembered = 0;
+
+	// promoted lists are pushed in front of the old space, scan them until
+	// a pass promotes nothing more
+	while (heap->old != scanned) {
+		List* first = heap->old;
+		for (List* list = first; list != scanned; list = list->next) {
+			for (int j = 0; j < list->count; j++) _forward(heap, &list->items[j], &promoted);
+		}
+		scanned = first;
+	}
+
+	for (int i = 0; i < heap->nurseryUsed; i++) {
+		List* list = &heap->nursery[i];
+		if (list->gcFlags & GC_FORWARDED) continue;
+		heap->stats.bytesFreed += _list_bytes(list);
+		free(list->items);
+	}
+	heap->nurseryUsed = 0;
+	heap->youngBytes = 0;
+	heap->newStrings = 0;
+	heap->pending = 0;
+	heap->stats.minor++;
+	return promoted;
+}
+
+static size_t _grey_roots(SmolVM* vm) {
+	Object* top = _stack_top(vm);
+	for (Object* slot = vm->stack + 1; slot < top; slot++) _reach(vm, *slot);
+	for (int i = 0; i < vm->numGlobals; i++) _reach(vm, vm->globals[i]);
+	return (size_t) (top - vm->stack) + vm->numGlobals;
+}
+
+// Field names live as long as the shapes adding them.
+static void _mark_shape_names(SmolVM* vm) {
+	int count = 1, capacity = 64;
+	const Shape** stack = (const Shape**) malloc(sizeof(Shape*) * capacity);
+	stack[0] = vm->shapes;
+	while (count > 0) {
+		const Shape* shape = stack[--count];
+		if (shape->name != NULL) gc_mark_string(vm, shape->name);
+		if (count + shape->numChildren > capacity) {
+			while (count + shape->numChildren > capacity) capacity *= 2;
+			stack = (const Shape**) realloc(stack, sizeof(Shape*) * capacity);
+		}
+		for (int i = 0; i < shape->numChildren; i++) stack[count++] = shape->children[i];
+	}
+	free(stack);
+}
+
+// Frees the strings marking did not reach, all at once as they are not
+// linked like lists.
+static void _sweep_strings(SmolVM* vm) {
+	Heap* heap = &vm->heap;
+	_mark_shape_names(vm);
+	size_t freed = interner_sweep(&vm->strings, heap->epoch);
+	heap->oldBytes -= freed;
+	heap->stats.bytesFreed += freed;
+}
+
+// Marks or sweeps about budget slots and lists. Registers and globals
+// change without a barrier, so marking only ends once rescanning them
+// finds nothing new.
+static void _major_step(SmolVM* vm, size_t budget) {
+	Heap* heap = &vm->heap;
+	if (heap->phase == GC_IDLE) {
+		if (heap->oldBytes < heap->nextMajor) return;
+		heap->phase = GC_MARK;
+		heap->epoch = heap->epoch == 1 ? 2 : 1;
+		heap->stats.majorCycles++;
+		_grey_roots(vm);
+	}
+	heap->stats.steps++;
+
+	size_t work = 0;
+	if (heap->phase == GC_MARK) {
+		for (;;) {
+			while (heap->numGrey > 0 && work < budget) {
+				List* list = heap->grey[--heap->numGrey];
+				for (int i = 0; i < list->count; i++) _reach(vm, list->items[i]);
+				work += list->count + 1;
+			}
+			if (heap->numGrey > 0) return;
+			work += _grey_roots(vm);
+			if (heap->numGrey == 0) break;
+			if (work >= budget) return;
+		}
+		_sweep_strings(vm);
+		heap->phase = GC_SWEEP;
+		heap->sweep = &heap->old;
+	}
+
+	while (*heap->sweep != NULL && work < budget) {
+		List* list = *heap->sweep;
+		if (list->gcMark == heap->epoch) {
+			heap->sweep = &list->next;
+		} else {
+			*heap->sweep = list->next;
+			size_t bytes = _list_bytes(list);
+			heap->oldBytes -= bytes;
+			heap->stats.bytesFreed += bytes;
+			free(list->items);
+			free(list);
+		}
+		work++;
+	}
+	if (*heap->sweep == NULL) {
+		heap->phase = GC_IDLE;
+		heap->nextMajor = heap->oldBytes * 2 > GC_MIN_MAJOR ? heap->oldBytes * 2 : GC_MIN_MAJOR;
+	}
+}
+
+static double _now(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void gc_collect(SmolVM* vm) {
+	GcStats* stats = &vm->heap.stats;
+	double start = _now();
+	size_t promoted = _minor(vm);
+	// keep marking ahead of what the minor collections promote
+	_major_step(vm, GC_STEP_WORK + 2 * promoted);
+	double pause = _now() - start;
+
+	int bucket = 0;
+	while (bucket < GC_PAUSE_BUCKETS - 1 && pause > GC_PAUSE_BOUNDS[bucket]) bucket++;
+	stats->pauses[bucket]++;
+	stats->totalPause += pause;
+	if (pause > stats->maxPause) stats->maxPause = pause;
+}
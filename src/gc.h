@@ -0,0 +1,89 @@
+#ifndef GC_H
+#define GC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct List_t;
+struct SmolVM_t;
+
+// Lists, and objects, which are lists too, start in the nursery, a
+// bump-allocated array of headers. A minor collection promotes the ones still
+// reachable into the old space, a linked list of malloc'd headers, which a
+// major cycle marks and sweeps a budget at a time after the minor
+// collections. Collections only run at safepoints in vm_run, so natives and
+// VM helpers can hold List pointers.
+// Strings made at run time sit in the isolate's interner layer and count as
+// old space. When marking ends, the ones it did not reach are swept.
+// Each can be overridden when building, SMOL_GC_STRESS shrinks them all.
+#ifndef GC_NURSERY_LISTS
+#define GC_NURSERY_LISTS 4096
+#endif
+#ifndef GC_NURSERY_BYTES
+#define GC_NURSERY_BYTES (1 << 20) // of items held by young lists
+#endif
+#ifndef GC_MIN_MAJOR
+#define GC_MIN_MAJOR (4 << 20) // old space bytes before the first major cycle
+#endif
+#ifndef GC_STEP_WORK
+#define GC_STEP_WORK 32768 // slots marked or lists swept per step
+#endif
+
+// List.gcFlags
+#define GC_YOUNG 0x01
+#define GC_FORWARDED 0x02 // promoted, List.next is the old copy
+#define GC_REMEMBERED 0x04 // in Heap.remembered
+
+enum GcPhase {
+	GC_IDLE = 0,
+	GC_MARK,
+	GC_SWEEP
+};
+
+// Pauses up to GC_PAUSE_BOUNDS[i] seconds count in pauses[i], longer ones
+// in the last bucket.
+#define GC_PAUSE_BUCKETS 8
+extern const double GC_PAUSE_BOUNDS[GC_PAUSE_BUCKETS - 1];
+
+typedef struct GcStats_t {
+	uint64_t minor, majorCycles, steps;
+	uint64_t bytesPromoted, bytesFreed;
+	uint64_t pauses[GC_PAUSE_BUCKETS];
+	double totalPause, maxPause;
+} GcStats;
+
+typedef struct Heap_t {
+	struct List_t* nursery;
+	int nurseryUsed;
+	size_t youngBytes;
+	struct List_t* old;
+	size_t oldBytes, nextMajor;
+	int pending; // the nursery is full, collect at the next safepoint
+	size_t newStrings; // bytes of strings made since the last collection
+
+	// old lists holding young ones
+	struct List_t** remembered;
+	int numRemembered, rememberedCap;
+
+	int phase;
+	unsigned char epoch; // the List.gcMark of marked lists this cycle
+	struct List_t** grey;
+	int numGrey, greyCap;
+	struct List_t** sweep; // link to the next list to sweep
+
+	GcStats stats;
+} Heap;
+
+extern void gc_new(Heap* heap);
+// Frees every list.
+extern void gc_free(Heap* heap);
+extern struct List_t* gc_alloc_list(Heap* heap);
+// Runs a minor collection and one step of the major cycle.
+extern void gc_collect(struct SmolVM_t* vm);
+extern void gc_barrier_slow(Heap* heap, struct List_t* list, struct List_t* value);
+// Counts a string the isolate made, of intern_size bytes.
+extern void gc_note_string(struct SmolVM_t* vm, size_t bytes);
+// Keeps str alive through the current major cycle.
+extern void gc_mark_string(struct SmolVM_t* vm, const char* str);
+
+#endif // GC_H
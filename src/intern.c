@@ -0,0 +1,137 @@
+#include "intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+uint32_t intern_hash_bytes(const char* str, int len) {
+	uint32_t h = 2166136261u; // FNV-1a
+	for (int i = 0; i < len; i++) {
+		h ^= (uint8_t) str[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+void interner_new(Interner* in) {
+	in->capacity = INTERN_INITIAL_CAPACITY;
+	in->slots = (const char**) calloc(in->capacity, sizeof(const char*));
+	in->stringsCap = INTERN_INITIAL_CAPACITY;
+	in->strings = (const char**) malloc(sizeof(const char*) * in->stringsCap);
+	in->count = 0;
+	in->lock = NULL;
+	in->parent = NULL;
+	in->base = 0;
+	in->layer = 0;
+	arena_new(&in->arena, ARENA_DEFAULT_BLOCK_SIZE);
+}
+
+void interner_new_layer(Interner* in, const Interner* parent) {
+	interner_new(in);
+	in->parent = parent;
+	in->base = interner_ids(parent);
+	in->layer = 1;
+}
+
+void interner_free(Interner* in) {
+	if (in->layer) {
+		for (int i = 0; i < in->count; i++) free((void*) INTERN_HEADER(in->strings[i]));
+	}
+	free(in->slots);
+	free(in->strings);
+	in->slots = NULL;
+	in->strings = NULL;
+	in->count = 0;
+	in->capacity = 0;
+	arena_free(&in->arena);
+}
+
+// Rebuilds the slots from the strings.
+static void _interner_rehash(Interner* in, int cap) {
+	const char** slots = (const char**) calloc(cap, sizeof(const char*));
+	for (int i = 0; i < in->count; i++) {
+		const char* s = in->strings[i];
+		uint32_t j = intern_hash(s) & (cap - 1);
+		while (slots[j] != NULL) j = (j + 1) & (cap - 1);
+		slots[j] = s;
+	}
+	free(in->slots);
+	in->slots = slots;
+	in->capacity = cap;
+}
+
+// The slot holding str or the empty slot where it would go.
+static uint32_t _interner_find(const Interner* in, const char* str, int len, uint32_t hash) {
+	uint32_t mask = in->capacity - 1;
+	uint32_t i = hash & mask;
+	while (in->slots[i] != NULL) {
+		const char* s = in->slots[i];
+		if (intern_hash(s) == hash && intern_length(s) == len && memcmp(s, str, len) == 0) break;
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+static const char* _interner_intern(Interner* in, const char* str, int len, uint32_t hash) {
+	for (const Interner* p = in->parent; p != NULL; p = p->parent) {
+		const char* s = p->slots[_interner_find(p, str, len, hash)];
+		if (s != NULL) return s;
+	}
+	uint32_t i = _interner_find(in, str, len, hash);
+	if (in->slots[i] != NULL) return in->slots[i];
+
+	size_t size = intern_size(len);
+	InternHeader* hdr = (InternHeader*) (in->layer ? malloc(size) : arena_alloc(&in->arena, size));
+	hdr->hash = hash;
+	hdr->length = len;
+	hdr->id = in->base + in->count;
+	hdr->mark = 0;
+	char* s = (char*) (hdr + 1);
+	memcpy(s, str, len);
+	s[len] = '\0';
+
+	if (in->count >= in->stringsCap) {
+		in->stringsCap *= 2;
+		in->strings = (const char**) realloc(in->strings, sizeof(const char*) * in->stringsCap);
+	}
+	in->strings[in->count++] = s;
+	in->slots[i] = s;
+
+	// keep the load factor under 1/2
+	if (in->count * 2 > in->capacity) _interner_rehash(in, in->capacity * 2);
+	return s;
+}
+
+const char* interner_intern(Interner* in, const char* str, int len) {
+	uint32_t hash = intern_hash_bytes(str, len);
+	if (in->lock == NULL) return _interner_intern(in, str, len, hash);
+	mutex_lock(in->lock);
+	const char* s = _interner_intern(in, str, len, hash);
+	mutex_unlock(in->lock);
+	return s;
+}
+
+const char* interner_get(const Interner* in, int id) {
+	if (id < in->base) return in->parent != NULL ? interner_get(in->parent, id) : NULL;
+	if (id >= interner_ids(in)) return NULL;
+	return in->strings[id - in->base];
+}
+
+size_t interner_sweep(Interner* in, unsigned char mark) {
+	size_t freed = 0;
+	int live = 0;
+	for (int i = 0; i < in->count; i++) {
+		InternHeader* hdr = (InternHeader*) INTERN_HEADER(in->strings[i]);
+		if (hdr->mark != mark) {
+			freed += intern_size(hdr->length);
+			free(hdr);
+			continue;
+		}
+		hdr->id = in->base + live;
+		in->strings[live++] = in->strings[i];
+	}
+	in->count = live;
+	int cap = in->capacity;
+	while (cap > INTERN_INITIAL_CAPACITY && in->count * 8 < cap) cap /= 2;
+	_interner_rehash(in, cap);
+	return freed;
+}
@@ -0,0 +1,59 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "thread.h"
+
+#define INTERN_INITIAL_CAPACITY 256
+
+// Every interned string is stored once, NUL-terminated, right after this
+// header. The returned `const char*` is canonical: two interned strings are
+// equal if and only if their pointers are equal.
+typedef struct InternHeader_t {
+	uint32_t hash;
+	int length;
+	int id;
+	unsigned char mark; // for interner_sweep
+} InternHeader;
+
+// A layer sits on top of a parent interner that no longer changes: strings
+// the parent has resolve to the parent's copy, new ones are added to the
+// layer with ids following the parent's, so threads can share the parent
+// without locking. A layer's strings are malloc'd one by one so
+// interner_sweep can free them.
+typedef struct Interner_t {
+	const char** slots; // open addressing, linear probing
+	int capacity;
+	const char** strings; // indexed by id - base
+	int count, stringsCap;
+	Arena arena;
+	SmolMutex* lock; // set while several threads intern, NULL otherwise
+	const struct Interner_t* parent;
+	int base; // the parent's id count
+	int layer;
+} Interner;
+
+extern void interner_new(Interner* in);
+extern void interner_new_layer(Interner* in, const Interner* parent);
+extern void interner_free(Interner* in);
+
+extern const char* interner_intern(Interner* in, const char* str, int len);
+extern const char* interner_get(const Interner* in, int id);
+// Frees the strings of a layer whose mark is not mark and renumbers the
+// rest. Returns the bytes freed.
+extern size_t interner_sweep(Interner* in, unsigned char mark);
+// One past the largest id, counting the parents.
+#define interner_ids(in) ((in)->base + (in)->count)
+
+extern uint32_t intern_hash_bytes(const char* str, int len);
+
+#define INTERN_HEADER(s) ((const InternHeader*) ((s) - sizeof(InternHeader)))
+#define intern_id(s) (INTERN_HEADER(s)->id)
+#define intern_length(s) (INTERN_HEADER(s)->length)
+#define intern_hash(s) (INTERN_HEADER(s)->hash)
+#define intern_size(len) (sizeof(InternHeader) + (len) + 1)
+
+#endif // INTERN_H
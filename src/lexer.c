@@ -1,6 +1,5 @@
 #include "lexer.h"
 
-#include <ctype.h>
 #include <memory.h>
 #include <string.h>
 #include <stdlib.h>
@@ -10,37 +9,13 @@
 
 DEF_DYN_ARRAY(Token);
 
-static const char* KEYWORDS[] = {
-	"return",
-	"continue",
-	"break",
-	"for",
-	"in",
-	"if",
-	"else",
-	"elif",
-	"fun",
-	"let",
-	"or",
-	"and",
-	"int",
-	"double",
-	"string",
-	"bool",
-	"true",
-	"false",
-	"nil"
-};
-
 const char* TOKENS[] = {
 	"TT_SEMICOLON",
 	"TT_ID",
 	"TT_NUMBER",
 	"TT_STRING",
-	"TT_BOOL",
 	"TT_LBRACE",
 	"TT_RBRACE",
-	"TT_KEYWORD",
 	"TT_LPAREN",
 	"TT_RPAREN",
 	"TT_RBRACKET",
@@ -75,218 +50,302 @@ const char* TOKENS[] = {
 	"TT_COMPNOTEQUALS",
 	"TT_LOGICOR",
 	"TT_LOGICAND",
-	"TT_EOF"
+	"TT_EOF",
+
+	"TT_KW_RETURN",
+	"TT_KW_CONTINUE",
+	"TT_KW_BREAK",
+	"TT_KW_FOR",
+	"TT_KW_IN",
+	"TT_KW_IF",
+	"TT_KW_ELSE",
+	"TT_KW_ELIF",
+	"TT_KW_FUN",
+	"TT_KW_LET",
+	"TT_KW_OR",
+	"TT_KW_AND",
+	"TT_KW_INT",
+	"TT_KW_DOUBLE",
+	"TT_KW_STRING",
+	"TT_KW_BOOL",
+	"TT_KW_TRUE",
+	"TT_KW_FALSE",
+	"TT_KW_NIL"
 };
 
-int is_keyword(const char* id) {
-	for (int i = 0; i < 18; i++) {
-		if (strcmp(KEYWORDS[i], id) == 0) return 1; // Keywords ARE case sensitive
+// Keywords ARE case sensitive. Dispatches on length and first character, and
+// on a later one where two keywords share both, so at most one memcmp runs
+// per identifier.
+int lexer_keyword(const char* id, int len) {
+#define KW(str, tt) if (memcmp(id, str, len) == 0) return tt; break
+	switch (len) {
+		case 2:
+			switch (id[0]) {
+				case 'i':
+					if (id[1] == 'n') { KW("in", TT_KW_IN); }
+					KW("if", TT_KW_IF);
+				case 'o': KW("or", TT_KW_OR);
+			}
+			break;
+		case 3:
+			switch (id[0]) {
+				case 'a': KW("and", TT_KW_AND);
+				case 'f':
+					if (id[1] == 'o') { KW("for", TT_KW_FOR); }
+					KW("fun", TT_KW_FUN);
+				case 'i': KW("int", TT_KW_INT);
+				case 'l': KW("let", TT_KW_LET);
+				case 'n': KW("nil", TT_KW_NIL);
+			}
+			break;
+		case 4:
+			switch (id[0]) {
+				case 'b': KW("bool", TT_KW_BOOL);
+				case 'e':
+					if (id[2] == 's') { KW("else", TT_KW_ELSE); }
+					KW("elif", TT_KW_ELIF);
+				case 't': KW("true", TT_KW_TRUE);
+			}
+			break;
+		case 5:
+			switch (id[0]) {
+				case 'b': KW("break", TT_KW_BREAK);
+				case 'f': KW("false", TT_KW_FALSE);
+			}
+			break;
+		case 6:
+			switch (id[0]) {
+				case 'd': KW("double", TT_KW_DOUBLE);
+				case 'r': KW("return", TT_KW_RETURN);
+				case 's': KW("string", TT_KW_STRING);
+			}
+			break;
+		case 8:
+			switch (id[0]) {
+				case 'c': KW("continue", TT_KW_CONTINUE);
+			}
+			break;
 	}
-	return 0;
+#undef KW
+	return TT_ID;
 }
 
-int _scan_identifier(char c) {
-	return isalpha(c) || c == '_' || isdigit(c);
+void print_token(Token tok) {
+	switch (tok.type) {
+		case TT_ID:
+		case TT_STRING: printf("%s(\'%s\') ", TOKENS[tok.type], tok.string); break;
+		case TT_NUMBER: printf("%s(%g) ", TOKENS[tok.type], tok.number); break;
+		default: printf("%s() ", TOKENS[tok.type]); break;
+	}
 }
 
-int _scan_number(char c) {
-	return c == '.' || isdigit(c) || isxdigit(c) || c == 'x' || c == 'X';
+void token_init(Token* tok, int type, int start) {
+	tok->start = start;
+	tok->length = 0;
+	tok->string = NULL;
+	tok->type = type;
+	tok->line = 0;
+	tok->column = 0;
 }
 
-void print_token(Token tok) {
-	if (tok.lexeme == NULL) printf("%s() ", TOKENS[tok.type]);
-	else printf("%s(\'%s\') ", TOKENS[tok.type], tok.lexeme);
+// Decodes escapes into out (at least len bytes), returning the decoded length.
+static int _decode_string(const char* str, int len, char* out) {
+	int i = 0;
+	for (int j = 0; j < len; j++) {
+		if (str[j] != '\\' || j + 1 >= len) {
+			out[i++] = str[j];
+			continue;
+		}
+		char es = str[++j];
+		switch (es) {
+			case 't': out[i++] = '\t'; break;
+			case 'n': out[i++] = '\n'; break;
+			case 'f': out[i++] = '\f'; break;
+			case 'r': out[i++] = '\r'; break;
+			case 'a': out[i++] = '\a'; break;
+			case 'b': out[i++] = '\b'; break;
+			case '\\': out[i++] = '\\'; break;
+			case 'x': {
+				char hex[3] = { 0 };
+				for (int k = 0; k < 2 && j + 1 < len; k++) hex[k] = str[++j];
+				out[i++] = (char) strtol(hex, NULL, 16);
+			} break;
+			default: out[i++] = es; break;
+		}
+	}
+	return i;
 }
 
-void token_init(Token* tok) {
-	tok->lexeme = (char*) malloc(sizeof(char) * LEX_MAX_LEXEME_SIZE);
-	tok->line = 0;
-	tok->column = 0;
-	memset(tok->lexeme, 0, sizeof(char) * LEX_MAX_LEXEME_SIZE);
+static double _parse_number(const char* str, int len) {
+	char buf[64];
+	if (len > 63) len = 63;
+	memcpy(buf, str, len);
+	buf[len] = '\0';
+	return strtod(buf, NULL);
 }
 
-int lexer_lex(const char* input, Token** out) {
-	TokenArray ret;
-	TokenArray_new(&ret);
+static void _lexer_init(Lexer* lx, Scanner* sc, Interner* strings) {
+	lx->sc = sc;
+	lx->strings = strings;
+	lx->scratch = NULL;
+	lx->scratchCap = 0;
+}
 
-	Scanner* sc = scanner_new(input);
+void lexer_new(Lexer* lx, const char* input, Interner* strings) {
+	_lexer_init(lx, scanner_new(input), strings);
+}
 
-#define PUSH(tp, tok)  tok.line = sc->line, tok.column = sc->column, tok.type = tp, TokenArray_push(&ret, tok)
-#define SPUSH(tp) { Token tok; tok.lexeme = NULL; tok.type = tp; tok.line = sc->line; tok.column = sc->column; TokenArray_push(&ret, tok); }
+void lexer_new_buffer(Lexer* lx, const char* buf, int size, Interner* strings) {
+	_lexer_init(lx, scanner_new_buffer(buf, size), strings);
+}
 
-	while (scanner_peek(sc) != '\0') {
-		char c = scanner_peek(sc);
-		if (isalpha(c) || c == '_') { // ID
-			Token tok; token_init(&tok);
-			scanner_read(sc, _scan_identifier, tok.lexeme);
+void lexer_new_reader(Lexer* lx, ScannerReader reader, void* user, Interner* strings) {
+	_lexer_init(lx, scanner_new_reader(reader, user), strings);
+}
+
+void lexer_free(Lexer* lx) {
+	scanner_free(lx->sc);
+	free(lx->scratch);
+	lx->sc = NULL;
+	lx->scratch = NULL;
+}
+
+// Operators and punctuation, c has been scanned.
+static int _lex_punct(Scanner* sc, char c) {
+#define FOLLOWED(ch, tt) if (scanner_peek(sc) == ch) { scanner_scan(sc); return tt; }
+	switch (c) {
+		case '{': return TT_LBRACE;
+		case '}': return TT_RBRACE;
+		case '(': return TT_LPAREN;
+		case ')': return TT_RPAREN;
+		case '[': return TT_LBRACKET;
+		case ']': return TT_RBRACKET;
+		case '?': return TT_QUESTION;
+		case ':': return TT_COLON;
+		case ';': return TT_SEMICOLON;
+		case '^': return TT_BITXOR;
+		case ',': return TT_COMMA;
+		case '%': return TT_PERCENT;
+		case '~': return TT_BITNOT;
+		case '.': FOLLOWED('.', TT_DOTS); return TT_POINT;
+		case '|': FOLLOWED('|', TT_LOGICOR); return TT_BITOR;
+		case '&': FOLLOWED('&', TT_LOGICAND); return TT_BITAND;
+		case '<':
+			FOLLOWED('<', TT_LSHIFT);
+			FOLLOWED('=', TT_LESSEQUALS);
+			return TT_LESS;
+		case '>':
+			FOLLOWED('>', TT_RSHIFT);
+			FOLLOWED('=', TT_GREATEREQUALS);
+			return TT_GREATER;
+		case '=': FOLLOWED('=', TT_COMPEQUALS); return TT_EQUALS;
+		case '+': FOLLOWED('=', TT_PLUSEQUALS); return TT_PLUS;
+		case '-': FOLLOWED('=', TT_MINUSEQUALS); return TT_MINUS;
+		case '*': FOLLOWED('=', TT_MULEQUALS); return TT_ASTERISK;
+		case '/': FOLLOWED('=', TT_DIVEQUALS); return TT_SLASH;
+		default: FOLLOWED('=', TT_COMPNOTEQUALS); return TT_EXCLAMATION; // '!'
+	}
+#undef FOLLOWED
+}
 
-			if (is_keyword(tok.lexeme)) {
-				if (strcmp(tok.lexeme, "true") == 0 || strcmp(tok.lexeme, "false") == 0)
-					tok.type = TT_BOOL;
-				else
-					tok.type = TT_KEYWORD;
-			} else tok.type = TT_ID;
-			TokenArray_push(&ret, tok);
-		} else if (isdigit(c)) { // NUMBER
-			Token tok; token_init(&tok);
-			scanner_read(sc, _scan_number, tok.lexeme);
-			tok.type = TT_NUMBER;
-			TokenArray_push(&ret, tok);
-		} else if (c == '\'') { // STRING
-			scanner_scan(sc);
-			
-			Token tok; token_init(&tok);
-			tok.type = TT_STRING;
+int lexer_next(Lexer* lx, Token* out) {
+	Scanner* sc = lx->sc;
 
-			int i = 0;
-			while (scanner_peek(sc) != '\'' && scanner_peek(sc) != '\0') {
-				if (scanner_peek(sc) == '\\') {
+	for (;;) {
+		// nothing before the current token is needed anymore
+		scanner_mark(sc);
+		char c = scanner_peek(sc);
+		int start = sc->base + sc->pos, line = sc->line, column = sc->column;
+		token_init(out, TT_EOF, start);
+		out->line = line;
+		out->column = column;
+
+		switch (SCANNER_CLASS[(unsigned char) c] & CK_MASK) {
+			case CK_END:
+				return 0;
+			case CK_SPACE:
+				scanner_skip_space(sc);
+				continue;
+			case CK_ALPHA: {
+				out->length = scanner_read_ident(sc);
+				const char* lexeme = sc->buffer + sc->mark;
+				out->type = lexer_keyword(lexeme, out->length);
+				if (out->type == TT_ID) out->string = interner_intern(lx->strings, lexeme, out->length);
+				return 1;
+			}
+			case CK_DIGIT:
+				// a '.' followed by another one starts a range, not a fraction
+				while (scanner_read_while(sc, CC_NUMBER), scanner_peek(sc) == '.' && scanner_peek_next(sc) != '.') {
 					scanner_scan(sc);
-					char es = scanner_scan(sc);
-					switch (es) {
-						case 't': tok.lexeme[i] = '\t'; break;
-						case 'n': tok.lexeme[i] = '\n'; break;
-						case 'f': tok.lexeme[i] = '\f'; break;
-						case 'r': tok.lexeme[i] = '\r'; break;
-						case 'a': tok.lexeme[i] = '\a'; break;
-						case 'b': tok.lexeme[i] = '\b'; break;
-						case '\\': tok.lexeme[i] = '\\'; break;
-						case 'x': {
-							char hex[2];
-							hex[0] = scanner_scan(sc);
-							hex[1] = scanner_scan(sc);
-							int code = strtol(hex, NULL, 16);
-							tok.lexeme[i] = '\x00' + code;
-						} break;
-						default: tok.lexeme[i] = es; break;
-					}
-				} else {
-					tok.lexeme[i] = scanner_scan(sc);
 				}
-				i++;
-			}
-			scanner_scan(sc);
-			TokenArray_push(&ret, tok);
-		} else if (c == '{') {
-			scanner_scan(sc);
-			SPUSH(TT_LBRACE);
-		} else if (c == '}') {
-			scanner_scan(sc);
-			SPUSH(TT_RBRACE);
-		} else if (c == '(') {
-			scanner_scan(sc);
-			SPUSH(TT_LPAREN);
-		} else if (c == ')') {
-			scanner_scan(sc);
-			SPUSH(TT_RPAREN);
-		} else if (c == '[') {
-			scanner_scan(sc);
-			SPUSH(TT_LBRACKET);
-		} else if (c == ']') {
-			scanner_scan(sc);
-			SPUSH(TT_RBRACKET);
-		} else if (c == '?') {
-			scanner_scan(sc);
-			SPUSH(TT_QUESTION);
-		} else if (c == ':') {
-			scanner_scan(sc);
-			SPUSH(TT_COLON);
-		} else if (c == ';') {
-			scanner_scan(sc);
-			SPUSH(TT_SEMICOLON);
-		} else if (c == '.') {
-			scanner_scan(sc);
-			if (scanner_peek(sc) == '.') {
-				scanner_scan(sc);
-				SPUSH(TT_DOTS);
-			} else SPUSH(TT_POINT);
-		} else if (c == '|') {
-			scanner_scan(sc);
-			if (scanner_peek(sc) == '|') {
-				scanner_scan(sc);
-				SPUSH(TT_LOGICOR);
-			} else SPUSH(TT_BITOR);
-		} else if (c == '&') {
-			scanner_scan(sc);
-			if (scanner_peek(sc) == '&') {
-				scanner_scan(sc);
-				SPUSH(TT_LOGICAND);
-			} else SPUSH(TT_BITAND);
-		} else if (c == '<') {
-			scanner_scan(sc);
-			if (scanner_peek(sc) == '<') {
+				out->type = TT_NUMBER;
+				out->length = sc->base + sc->pos - start;
+				out->number = _parse_number(sc->buffer + sc->mark, out->length);
+				return 1;
+			case CK_QUOTE: {
 				scanner_scan(sc);
-				SPUSH(TT_LSHIFT);
-			} else if (scanner_peek(sc) == '=') {
-				scanner_scan(sc);
-				SPUSH(TT_LESSEQUALS);
-			} else SPUSH(TT_LESS);
-		} else if (c == '>') {
-			scanner_scan(sc);
-			if (scanner_peek(sc) == '>') {
-				scanner_scan(sc);
-				SPUSH(TT_RSHIFT);
-			} else if (scanner_peek(sc) == '=') {
-				scanner_scan(sc);
-				SPUSH(TT_GREATEREQUALS);
-			} else SPUSH(TT_GREATER);
-		} else if (c == '=') {
-			scanner_scan(sc);
-			if (scanner_peek(sc) == '=') {
-				scanner_scan(sc);
-				SPUSH(TT_COMPEQUALS);
-			} else SPUSH(TT_EQUALS);
-		} else if (c == '+') {
-			scanner_scan(sc);
-			if (scanner_peek(sc) == '=') {
-				scanner_scan(sc);
-				SPUSH(TT_PLUSEQUALS);
-			} else SPUSH(TT_PLUS);
-		} else if (c == '-') {
-			scanner_scan(sc);
-			if (scanner_peek(sc) == '=') {
-				scanner_scan(sc);
-				SPUSH(TT_MINUSEQUALS);
-			} else SPUSH(TT_MINUS);
-		} else if (c == '*') {
-			scanner_scan(sc);
-			if (scanner_peek(sc) == '=') {
+				scanner_mark(sc);
+				out->type = TT_STRING;
+				out->start = sc->base + sc->pos;
+
+				int escaped = 0;
+				for (;;) {
+					scanner_read_string(sc);
+					char e = scanner_peek(sc);
+					if (e == '\'' || e == '\0') break;
+					if (scanner_scan(sc) == '\\' && scanner_peek(sc) != '\0') {
+						escaped = 1;
+						scanner_scan(sc);
+					}
+				}
+				out->length = sc->pos - sc->mark;
+				if (escaped) {
+					if (lx->scratchCap < out->length) {
+						lx->scratchCap = out->length * 2;
+						lx->scratch = (char*) realloc(lx->scratch, lx->scratchCap);
+					}
+					int len = _decode_string(sc->buffer + sc->mark, out->length, lx->scratch);
+					out->string = interner_intern(lx->strings, lx->scratch, len);
+				} else out->string = interner_intern(lx->strings, sc->buffer + sc->mark, out->length);
+
 				scanner_scan(sc);
-				SPUSH(TT_MULEQUALS);
-			} else SPUSH(TT_ASTERISK);
-		} else if (c == '/') {
-			scanner_scan(sc);
-			if (scanner_peek(sc) == '=') {
+				return 1;
+			}
+			case CK_PUNCT:
 				scanner_scan(sc);
-				SPUSH(TT_DIVEQUALS);
-			} else SPUSH(TT_SLASH);
-		} else if (c == '^') {
-			scanner_scan(sc);
-			SPUSH(TT_BITXOR);
-		} else if (c == ',') {
-			scanner_scan(sc);
-			SPUSH(TT_COMMA);
-		} else if (c == '%') {
-			scanner_scan(sc);
-			SPUSH(TT_PERCENT);
-		} else if (c == '~') {
-			scanner_scan(sc);
-			SPUSH(TT_BITNOT);
-		} else if (c == '!') {
-			scanner_scan(sc);
-			if (scanner_peek(sc) == '=') {
+				out->type = _lex_punct(sc, c);
+				return 1;
+			default:
 				scanner_scan(sc);
-				SPUSH(TT_COMPNOTEQUALS);
-			} else SPUSH(TT_EXCLAMATION);
-		} else {
-			scanner_scan(sc);
+				continue;
 		}
 	}
+}
 
-	scanner_free(sc);
+static int _lex_all(Lexer* lx, Token** out) {
+	TokenArray ret;
+	TokenArray_new(&ret);
 
-	SPUSH(TT_EOF);
+	Token tok;
+	while (lexer_next(lx, &tok)) {
+		TokenArray_push(&ret, tok);
+	}
+	TokenArray_push(&ret, tok);
+
+	lexer_free(lx);
 
 	*out = ret.data;
 	return ret.len;
-}
\ No newline at end of file
+}
+
+int lexer_lex(const char* input, Interner* strings, Token** out) {
+	Lexer lx;
+	lexer_new(&lx, input, strings);
+	return _lex_all(&lx, out);
+}
+
+int lexer_lex_buffer(const char* buf, int size, Interner* strings, Token** out) {
+	Lexer lx;
+	lexer_new_buffer(&lx, buf, size, strings);
+	return _lex_all(&lx, out);
+}
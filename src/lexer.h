@@ -2,16 +2,15 @@
 #define LEXER_H
 
 #include "scanner.h"
+#include "intern.h"
 
 enum TokenType {
 	TT_SEMICOLON = 0,
 	TT_ID,
 	TT_NUMBER,
 	TT_STRING,
-	TT_BOOL,
 	TT_LBRACE,
 	TT_RBRACE,
-	TT_KEYWORD,
 	TT_LPAREN,
 	TT_RPAREN,
 	TT_RBRACKET,
@@ -46,21 +45,71 @@ enum TokenType {
 	TT_COMPNOTEQUALS,
 	TT_LOGICOR,
 	TT_LOGICAND,
-	TT_EOF
+	TT_EOF,
+
+	// keywords
+	TT_KW_RETURN,
+	TT_KW_CONTINUE,
+	TT_KW_BREAK,
+	TT_KW_FOR,
+	TT_KW_IN,
+	TT_KW_IF,
+	TT_KW_ELSE,
+	TT_KW_ELIF,
+	TT_KW_FUN,
+	TT_KW_LET,
+	TT_KW_OR,
+	TT_KW_AND,
+	TT_KW_INT,
+	TT_KW_DOUBLE,
+	TT_KW_STRING,
+	TT_KW_BOOL,
+	TT_KW_TRUE,
+	TT_KW_FALSE,
+	TT_KW_NIL
 };
 
+#define TT_IS_KEYWORD(t) ((t) >= TT_KW_RETURN && (t) <= TT_KW_NIL)
+
 extern const char* TOKENS[];
 
-#define LEX_MAX_LEXEME_SIZE 65536
+// Tokens don't own their text: [start, start + length) is a span into the
+// source that was lexed. String literals span their contents (without the
+// quotes). Identifiers and string literals (escape decoded) are interned, so
+// `string` can be compared by pointer, and numbers are converted while
+// lexing, so tokens stay usable after a streaming lexer dropped their text.
 typedef struct Token_t {
-	char* lexeme;
+	int start, length;
+	union {
+		const char* string;
+		double number;
+	};
 	int type;
 	int line, column;
 } Token;
 
-extern void token_init(Token* tok);
+extern void token_init(Token* tok, int type, int start);
+extern int lexer_keyword(const char* id, int len);
 
 extern void print_token(Token tok);
-extern int lexer_lex(const char* input, Token** out);
+
+typedef struct Lexer_t {
+	Scanner* sc;
+	Interner* strings;
+	char* scratch;
+	int scratchCap;
+} Lexer;
+
+extern void lexer_new(Lexer* lx, const char* input, Interner* strings);
+extern void lexer_new_buffer(Lexer* lx, const char* buf, int size, Interner* strings);
+extern void lexer_new_reader(Lexer* lx, ScannerReader reader, void* user, Interner* strings);
+extern void lexer_free(Lexer* lx);
+
+// Lexes the next token into out. Returns 0 once out is the TT_EOF token.
+extern int lexer_next(Lexer* lx, Token* out);
+
+// Lexes everything into *out (ending with TT_EOF), returns the token count.
+extern int lexer_lex(const char* input, Interner* strings, Token** out);
+extern int lexer_lex_buffer(const char* buf, int size, Interner* strings, Token** out);
 
 #endif // LEXER_H
\ No newline at end of file
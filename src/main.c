@@ -1,27 +1,276 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "ast.h"
+#include "build.h"
+#include "cache.h"
+#include "compiler.h"
+#include "flatast.h"
+#include "fold.h"
+#include "source.h"
 
-int main(int argc, char** argv) {
-	const char* code =
-		"for item in ['a', 'b', 'c'] { print(item); }";
-	Token* tokens;
-	int tokenCount = lexer_lex(code, &tokens);
+enum {
+	MODE_TOKENS = 0,
+	MODE_AST,
+	MODE_BYTECODE,
+	MODE_RUN
+};
+
+static int stats = 0;
+static int useCache = 1;
+static int jobs = 0;
+static int split = 0;
+static CompileOptions options;
+
+static void _usage(const char* prog) {
+	printf("Usage: %s [options] [script...]\n", prog);
+	printf("Runs each script, reads stdin when no script (or '-') is given.\n\n");
+	printf("Options:\n");
+	printf("  --tokens    Print the token stream\n");
+	printf("  --ast       Print the syntax tree\n");
+	printf("  --bytecode  Print the compiled bytecode\n");
+	printf("  --stats     Report executed instructions, instructions/sec and GC pauses\n");
+	printf("  --no-cache  Don't read or write compiled .smolc files\n");
+	printf("  --inlining  Report which calls get inlined while compiling, implies\n");
+	printf("              --no-cache\n");
+	printf("  --jobs N    Compile the scripts on N threads before running them in order\n");
+	printf("  --split     With --jobs, also compile large scripts in parallel, split at\n");
+	printf("              their top level functions\n");
+	printf("  --help      Show this message\n");
+}
 
-	printf("Parsed: %s\n", code);
-	for (int i = 0; i < tokenCount; i++) {
-		print_token(tokens[i]);
+static double _now(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void _print_gc_stats(const GcStats* gc) {
+	fprintf(stderr, "gc: %llu minor, %llu major cycles in %llu steps, %.3f s paused, longest %.3f ms\n",
+		(unsigned long long) gc->minor, (unsigned long long) gc->majorCycles, (unsigned long long) gc->steps,
+		gc->totalPause, gc->maxPause * 1e3);
+	fprintf(stderr, "gc: %llu bytes promoted, %llu freed\n", (unsigned long long) gc->bytesPromoted, (unsigned long long) gc->bytesFreed);
+	fprintf(stderr, "gc pauses:");
+	for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+		if (i < GC_PAUSE_BUCKETS - 1) fprintf(stderr, " <=%gms: %llu", GC_PAUSE_BOUNDS[i] * 1e3, (unsigned long long) gc->pauses[i]);
+		else fprintf(stderr, " more: %llu\n", (unsigned long long) gc->pauses[i]);
 	}
-	printf("\n");
+}
 
-	Parser p;
-	parser_new(&p, tokens, tokenCount);
+static int _run(Program* program) {
+	SmolVM vm;
+	vm_new(&vm, program);
+	double start = _now();
+	int ok = vm_run(&vm);
+	double elapsed = _now() - start;
+	if (stats) {
+		fprintf(stderr, "%llu instructions in %.3f s, %.1f M instructions/s\n",
+			(unsigned long long) vm.instructions, elapsed, elapsed > 0 ? vm.instructions / elapsed / 1e6 : 0.0);
+		fprintf(stderr, "%llu instructions quickened, %llu deoptimized\n", (unsigned long long) vm.quickened, (unsigned long long) vm.deopts);
+		fprintf(stderr, "%llu field accesses hit their inline cache, %llu missed\n", (unsigned long long) vm.cacheHits, (unsigned long long) vm.cacheMisses);
+		_print_gc_stats(&vm.heap.stats);
+	}
+	vm_free(&vm);
+	return ok;
+}
+
+static int _execute(Program* program, int mode) {
+	if (mode == MODE_BYTECODE) {
+		program_disassemble(program);
+		return 1;
+	}
+	return _run(program);
+}
+
+// Prints tokens or the tree, or compiles the script into *program.
+static int _process(Lexer* lx, int mode, Program** program) {
+	*program = NULL;
+	if (mode == MODE_TOKENS) {
+		Token tok;
+		while (lexer_next(lx, &tok)) {
+			print_token(tok);
+		}
+		print_token(tok);
+		printf("\n");
+		return 1;
+	}
 
+	Parser p;
+	parser_new_stream(&p, lx);
 	Node* nd = ast_parse_program(&p);
-	ast_print(nd, 0);
+	int ok = p.errors == 0;
+	if (mode == MODE_AST) {
+		FlatAst flat;
+		flat_ast_build(&flat, nd);
+		flat_ast_print(&flat, 0, 0);
+		flat_ast_free(&flat);
+	} else if (ok) {
+		ast_fold(nd, lx->strings);
+		*program = compile_program(nd, lx->strings, NULL, &options);
+		ok = *program != NULL;
+	}
+	parser_free(&p);
+	return ok;
+}
+
+static int _process_stream(FILE* fp, int mode, Interner* strings) {
+	Lexer lx;
+	Program* program;
+	lexer_new_reader(&lx, scanner_file_reader, fp, strings);
+	int ok = _process(&lx, mode, &program);
+	lexer_free(&lx);
+	if (program != NULL) {
+		ok = _execute(program, mode);
+		program_free(program);
+	}
+	return ok;
+}
+
+// Runs path from its .smolc when it matches the source, otherwise compiles
+// it and writes the cache for the next run.
+static int _process_file(SourceFile* src, const char* path, int mode, Interner* strings) {
+	Program* program = NULL;
+	char* cachePath = NULL;
+	uint64_t hash = 0;
+	int ok = 1;
+
+	if (useCache && mode >= MODE_BYTECODE) {
+		size_t len = strlen(path);
+		cachePath = (char*) malloc(len + 2);
+		memcpy(cachePath, path, len);
+		memcpy(cachePath + len, "c", 2);
+		hash = cache_hash(src->data, src->size);
+		program = cache_load(cachePath, hash, src->size, strings);
+	}
+
+	if (program == NULL) {
+		Lexer lx;
+		lexer_new_buffer(&lx, src->data, (int) src->size, strings);
+		ok = _process(&lx, mode, &program);
+		lexer_free(&lx);
+		if (program != NULL && cachePath != NULL) cache_write(program, cachePath, hash, src->size);
+	}
+
+	if (program != NULL) {
+		ok = _execute(program, mode);
+		program_free(program);
+	}
+	free(cachePath);
+	return ok;
+}
+
+static int _process_path(const char* path, int mode, Interner* strings) {
+	SourceFile src;
+	int ok = 1;
+	if (strcmp(path, "-") == 0) {
+		// pipes and stdin are lexed as they arrive
+		ok = _process_stream(stdin, mode, strings);
+	} else if (source_open(&src, path)) {
+		ok = _process_file(&src, path, mode, strings);
+		source_close(&src);
+	} else {
+		FILE* fp = fopen(path, "rb");
+		if (fp == NULL) {
+			fprintf(stderr, "Could not open %s\n", path);
+			return 0;
+		}
+		ok = _process_stream(fp, mode, strings);
+		fclose(fp);
+	}
+	return ok;
+}
+
+// --jobs: compiles every regular file on the pool first, then reports and
+// runs them in the order given. Streams are still handled in their turn.
+static int _process_batch(const char** paths, int numPaths, int mode, Interner* strings) {
+	BuildUnit* units = (BuildUnit*) malloc(sizeof(BuildUnit) * numPaths);
+	SourceFile* sources = (SourceFile*) malloc(sizeof(SourceFile) * numPaths);
+	char** cachePaths = (char**) calloc(numPaths, sizeof(char*));
+	int* unitOf = (int*) malloc(sizeof(int) * numPaths);
+	int numUnits = 0;
+
+	for (int i = 0; i < numPaths; i++) {
+		unitOf[i] = -1;
+		if (strcmp(paths[i], "-") == 0 || !source_open(&sources[i], paths[i])) continue;
+		if (useCache) {
+			size_t len = strlen(paths[i]);
+			cachePaths[i] = (char*) malloc(len + 2);
+			memcpy(cachePaths[i], paths[i], len);
+			memcpy(cachePaths[i] + len, "c", 2);
+		}
+		unitOf[i] = numUnits;
+		build_unit_new(&units[numUnits], paths[i], sources[i].data, sources[i].size, cachePaths[i]);
+		units[numUnits++].options = options;
+	}
+
+	double start = _now();
+	build_run(units, numUnits, jobs, split);
+	if (stats) fprintf(stderr, "compiled %d scripts in %.3f s on %d threads\n", numUnits, _now() - start, jobs);
+
+	int status = 0;
+	for (int i = 0; i < numPaths; i++) {
+		if (unitOf[i] < 0) {
+			if (!_process_path(paths[i], mode, strings)) status = 1;
+			continue;
+		}
+		BuildUnit* unit = &units[unitOf[i]];
+		error_sink_flush(&unit->errors, stdout);
+		if (unit->program == NULL || !_execute(unit->program, mode)) status = 1;
+		build_unit_free(unit);
+		source_close(&sources[i]);
+		free(cachePaths[i]);
+	}
+	free(unitOf);
+	free(cachePaths);
+	free(sources);
+	free(units);
+	return status;
+}
+
+int main(int argc, char** argv) {
+	int mode = MODE_RUN;
+	const char** paths = (const char**) malloc(sizeof(const char*) * (argc + 1));
+	int numPaths = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--tokens") == 0) mode = MODE_TOKENS;
+		else if (strcmp(argv[i], "--ast") == 0) mode = MODE_AST;
+		else if (strcmp(argv[i], "--bytecode") == 0) mode = MODE_BYTECODE;
+		else if (strcmp(argv[i], "--stats") == 0) stats = 1;
+		else if (strcmp(argv[i], "--no-cache") == 0) useCache = 0;
+		else if (strcmp(argv[i], "--split") == 0) split = 1;
+		else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) jobs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--inlining") == 0) {
+			options.reportInlining = 1;
+			useCache = 0;
+		} else if (strcmp(argv[i], "--help") == 0) {
+			_usage(argv[0]);
+			free(paths);
+			return 0;
+		} else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+			fprintf(stderr, "Unknown option: %s\n", argv[i]);
+			_usage(argv[0]);
+			free(paths);
+			return 1;
+		} else paths[numPaths++] = argv[i];
+	}
+	if (numPaths == 0) paths[numPaths++] = "-";
+
+	Interner strings;
+	interner_new(&strings);
+
+	int status = 0;
+	if (jobs > 0 && mode >= MODE_BYTECODE) {
+		status = _process_batch(paths, numPaths, mode, &strings);
+	} else {
+		for (int i = 0; i < numPaths; i++) {
+			if (!_process_path(paths[i], mode, &strings)) status = 1;
+		}
+	}
 
-	free(tokens);
-	node_free(nd);
-	return 0;
-}
\ No newline at end of file
+	interner_free(&strings);
+	free(paths);
+	return status;
+}
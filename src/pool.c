@@ -0,0 +1,177 @@
+#include "pool.h"
+
+#include <stdlib.h>
+
+typedef struct Worker_t {
+	Pool* pool;
+	int index;
+} Worker;
+
+// The worker running on this thread, -1 outside of the pool.
+static _Thread_local int workerIndex = -1;
+
+static void _queue_push(PoolQueue* q, PoolTask task) {
+	mutex_lock(&q->lock);
+	if (q->count == q->capacity) {
+		int cap = q->capacity > 0 ? q->capacity * 2 : 64;
+		PoolTask* tasks = (PoolTask*) malloc(sizeof(PoolTask) * cap);
+		for (int i = 0; i < q->count; i++) {
+			tasks[i] = q->tasks[(q->head + i) % q->capacity];
+		}
+		free(q->tasks);
+		q->tasks = tasks;
+		q->capacity = cap;
+		q->head = 0;
+	}
+	q->tasks[(q->head + q->count++) % q->capacity] = task;
+	mutex_unlock(&q->lock);
+}
+
+static int _queue_pop(PoolQueue* q, PoolTask* out, int steal) {
+	mutex_lock(&q->lock);
+	int ok = q->count > 0;
+	if (ok && steal) {
+		*out = q->tasks[q->head];
+		q->head = (q->head + 1) % q->capacity;
+		q->count--;
+	} else if (ok) {
+		*out = q->tasks[(q->head + --q->count) % q->capacity];
+	}
+	mutex_unlock(&q->lock);
+	return ok;
+}
+
+// Own queue first (newest task, still warm in cache), then the oldest task
+// of another worker.
+static int _take(Pool* pool, int self, PoolTask* out) {
+	if (_queue_pop(&pool->queues[self], out, 0)) return 1;
+	for (int i = 1; i < pool->numWorkers; i++) {
+		if (_queue_pop(&pool->queues[(self + i) % pool->numWorkers], out, 1)) {
+			mutex_lock(&pool->lock);
+			pool->steals++;
+			mutex_unlock(&pool->lock);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void* _worker(void* arg) {
+	Worker* w = (Worker*) arg;
+	Pool* pool = w->pool;
+	workerIndex = w->index;
+	for (;;) {
+		mutex_lock(&pool->lock);
+		while (pool->queued == 0 && !pool->stop) cond_wait(&pool->wake, &pool->lock);
+		if (pool->queued == 0 && pool->stop) {
+			mutex_unlock(&pool->lock);
+			break;
+		}
+		mutex_unlock(&pool->lock);
+
+		PoolTask task;
+		if (!_take(pool, w->index, &task)) continue; // raced with another worker or a push
+		mutex_lock(&pool->lock);
+		pool->queued--;
+		mutex_unlock(&pool->lock);
+
+		task.fn(pool, task.arg);
+
+		mutex_lock(&pool->lock);
+		if (--pool->pending == 0) cond_broadcast(&pool->done);
+		mutex_unlock(&pool->lock);
+	}
+	free(w);
+	return NULL;
+}
+
+void pool_new(Pool* pool, int numWorkers) {
+	pool->numWorkers = 0;
+	pool->numThreads = 0;
+	pool->threads = NULL;
+	pool->queues = NULL;
+	pool->nextQueue = 0;
+	pool->queued = 0;
+	pool->pending = 0;
+	pool->stop = 0;
+	pool->steals = 0;
+	mutex_new(&pool->lock);
+	cond_new(&pool->wake);
+	cond_new(&pool->done);
+	if (numWorkers <= 0) return;
+
+	pool->threads = (SmolThread*) malloc(sizeof(SmolThread) * numWorkers);
+	pool->queues = (PoolQueue*) calloc(numWorkers, sizeof(PoolQueue));
+	for (int i = 0; i < numWorkers; i++) {
+		mutex_new(&pool->queues[i].lock);
+	}
+	// set before any worker runs, a queue whose thread didn't start still
+	// gets stolen from
+	pool->numWorkers = numWorkers;
+	int started = 0;
+	for (int i = 0; i < numWorkers; i++) {
+		Worker* w = (Worker*) malloc(sizeof(Worker));
+		w->pool = pool;
+		w->index = i;
+		if (thread_start(&pool->threads[started], _worker, w)) started++;
+		else free(w);
+	}
+	pool->numThreads = started;
+	if (started == 0) {
+		for (int i = 0; i < numWorkers; i++) {
+			mutex_free(&pool->queues[i].lock);
+		}
+		free(pool->queues);
+		free(pool->threads);
+		pool->queues = NULL;
+		pool->threads = NULL;
+		pool->numWorkers = 0;
+	}
+}
+
+void pool_free(Pool* pool) {
+	pool_wait(pool);
+	mutex_lock(&pool->lock);
+	pool->stop = 1;
+	cond_broadcast(&pool->wake);
+	mutex_unlock(&pool->lock);
+	for (int i = 0; i < pool->numThreads; i++) {
+		thread_join(pool->threads[i]);
+	}
+	for (int i = 0; i < pool->numWorkers; i++) {
+		free(pool->queues[i].tasks);
+		mutex_free(&pool->queues[i].lock);
+	}
+	free(pool->queues);
+	free(pool->threads);
+	cond_free(&pool->done);
+	cond_free(&pool->wake);
+	mutex_free(&pool->lock);
+}
+
+void pool_submit(Pool* pool, PoolTaskFn fn, void* arg) {
+	if (pool->numWorkers == 0) {
+		fn(pool, arg);
+		return;
+	}
+
+	PoolTask task = { fn, arg };
+	mutex_lock(&pool->lock);
+	int q = workerIndex >= 0 && workerIndex < pool->numWorkers ? workerIndex : pool->nextQueue++ % pool->numWorkers;
+	pool->pending++;
+	pool->queued++;
+	mutex_unlock(&pool->lock);
+
+	// a worker woken before the push just retries
+	_queue_push(&pool->queues[q], task);
+
+	mutex_lock(&pool->lock);
+	cond_broadcast(&pool->wake);
+	mutex_unlock(&pool->lock);
+}
+
+void pool_wait(Pool* pool) {
+	mutex_lock(&pool->lock);
+	while (pool->pending > 0) cond_wait(&pool->done, &pool->lock);
+	mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,47 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "thread.h"
+
+struct Pool_t;
+
+typedef void (*PoolTaskFn)(struct Pool_t* pool, void* arg);
+
+typedef struct PoolTask_t {
+	PoolTaskFn fn;
+	void* arg;
+} PoolTask;
+
+// One worker's deque: the owner pushes and pops at the tail, idle workers
+// steal from the head.
+typedef struct PoolQueue_t {
+	SmolMutex lock;
+	PoolTask* tasks;
+	int head, count, capacity;
+} PoolQueue;
+
+// Work-stealing thread pool. Tasks may submit more tasks, which go to the
+// submitting worker's own queue. Without SMOL_THREADS (or with no workers)
+// tasks run inside pool_submit.
+typedef struct Pool_t {
+	int numWorkers, numThreads;
+	SmolThread* threads;
+	PoolQueue* queues;
+	int nextQueue; // round robin for tasks submitted from outside
+
+	SmolMutex lock; // guards the counters below
+	SmolCond wake, done;
+	int queued, pending; // waiting in queues, submitted but not finished
+	int stop;
+	int steals;
+} Pool;
+
+extern void pool_new(Pool* pool, int numWorkers);
+// Waits for every task, then stops the workers.
+extern void pool_free(Pool* pool);
+extern void pool_submit(Pool* pool, PoolTaskFn fn, void* arg);
+// Returns once every task submitted so far (and the tasks they submitted)
+// finished.
+extern void pool_wait(Pool* pool);
+
+#endif // POOL_H
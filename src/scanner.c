@@ -1,42 +1,179 @@
 #include "scanner.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <memory.h>
 
+#include "simd.h"
+
+#define NO CK_OTHER
+#define EN (CK_END | CC_STRING_END)
+#define SP (CK_SPACE | CC_SPACE)
+#define NL (CK_SPACE | CC_SPACE)
+#define AL (CK_ALPHA | CC_IDENT)
+#define HX (CK_ALPHA | CC_IDENT | CC_NUMBER)
+#define DG (CK_DIGIT | CC_IDENT | CC_NUMBER)
+#define QU (CK_QUOTE | CC_STRING_END)
+#define BS (CK_OTHER | CC_STRING_END)
+#define PU CK_PUNCT
+
+// bytes from 0x80 on are CK_OTHER
+const unsigned char SCANNER_CLASS[256] = {
+	EN, NO, NO, NO, NO, NO, NO, NO, NO, SP, NL, SP, SP, SP, NO, NO, // 0x00
+	NO, NO, NO, NO, NO, NO, NO, NO, NO, NO, NO, NO, NO, NO, NO, NO, // 0x10
+	SP, PU, NO, NO, NO, PU, PU, QU, PU, PU, PU, PU, PU, PU, PU, PU, // 0x20
+	DG, DG, DG, DG, DG, DG, DG, DG, DG, DG, PU, PU, PU, PU, PU, PU, // 0x30
+	NO, HX, HX, HX, HX, HX, HX, AL, AL, AL, AL, AL, AL, AL, AL, AL, // 0x40
+	AL, AL, AL, AL, AL, AL, AL, AL, HX, AL, AL, PU, BS, PU, PU, AL, // 0x50
+	NO, HX, HX, HX, HX, HX, HX, AL, AL, AL, AL, AL, AL, AL, AL, AL, // 0x60
+	AL, AL, AL, AL, AL, AL, AL, AL, HX, AL, AL, PU, PU, PU, PU, NO, // 0x70
+};
+
+#undef NO
+#undef EN
+#undef SP
+#undef NL
+#undef AL
+#undef HX
+#undef DG
+#undef QU
+#undef BS
+#undef PU
+
 Scanner* scanner_new(const char* buf) {
+	return scanner_new_buffer(buf, strlen(buf));
+}
+
+Scanner* scanner_new_buffer(const char* buf, int size) {
+	Scanner* scan = (Scanner*) malloc(sizeof(Scanner));
+	scan->buffer = buf;
+	scan->size = size;
+	scan->pos = 0;
+	scan->line = 1;
+	scan->column = 0;
+	scan->reader = NULL;
+	scan->user = NULL;
+	scan->chunk = NULL;
+	scan->capacity = size;
+	scan->base = 0;
+	scan->mark = 0;
+	return scan;
+}
+
+Scanner* scanner_new_reader(ScannerReader reader, void* user) {
 	Scanner* scan = (Scanner*) malloc(sizeof(Scanner));
-	scan->size = strlen(buf);
-	scan->buffer = (char*) malloc(sizeof(char) * scan->size);
+	scan->size = 0;
+	scan->capacity = SCANNER_CHUNK_SIZE;
+	scan->chunk = (char*) malloc(sizeof(char) * scan->capacity);
+	scan->buffer = scan->chunk;
 	scan->pos = 0;
-	scan->line = 0;
+	scan->line = 1;
 	scan->column = 0;
-	strcpy(scan->buffer, buf);
+	scan->reader = reader;
+	scan->user = user;
+	scan->base = 0;
+	scan->mark = 0;
 	return scan;
 }
 
 void scanner_free(Scanner* scanner) {
 	scanner->pos = 0;
+	free(scanner->chunk);
 	free(scanner);
 }
 
+// Pulls the next chunk from the reader, dropping what precedes the mark.
+static int _scanner_fill(Scanner* s) {
+	if (s->reader == NULL) return 0;
+
+	if (s->mark > 0) {
+		memmove(s->chunk, s->chunk + s->mark, s->size - s->mark);
+		s->base += s->mark;
+		s->pos -= s->mark;
+		s->size -= s->mark;
+		s->mark = 0;
+	}
+	if (s->size == s->capacity) {
+		s->capacity *= 2;
+		s->chunk = (char*) realloc(s->chunk, sizeof(char) * s->capacity);
+		s->buffer = s->chunk;
+	}
+
+	int n = s->reader(s->user, s->chunk + s->size, s->capacity - s->size);
+	if (n <= 0) {
+		s->reader = NULL;
+		return 0;
+	}
+	s->size += n;
+	return 1;
+}
+
 char scanner_scan(Scanner* s) {
-	if (s->pos >= s->size) return '\0';
-	if (s->buffer[s->column++] == '\n') {
+	if (s->pos >= s->size && !_scanner_fill(s)) return '\0';
+	if (s->buffer[s->pos] == '\n') {
 		s->line++;
 		s->column = 0;
-	}
+	} else s->column++;
 	return s->buffer[s->pos++];
 }
 
 char scanner_peek(Scanner* s) {
-	if (s->pos >= s->size) return '\0';
+	if (s->pos >= s->size && !_scanner_fill(s)) return '\0';
 	return s->buffer[s->pos];
 }
 
-void scanner_read(Scanner* s, ScannerCallback whileCond, char* out) {
-	int i = 0;
-	while (scanner_peek(s) != '\0' && whileCond(scanner_peek(s))) {
-		out[i++] = scanner_scan(s);
+char scanner_peek_next(Scanner* s) {
+	while (s->pos + 1 >= s->size) {
+		if (!_scanner_fill(s)) return '\0';
 	}
-}
\ No newline at end of file
+	return s->buffer[s->pos + 1];
+}
+
+void scanner_mark(Scanner* s) {
+	s->mark = s->pos;
+}
+
+int scanner_refill(Scanner* s) {
+	return s->pos < s->size || _scanner_fill(s);
+}
+
+static void _scanner_skip(Scanner* s, size_t n, const SimdLines* lines) {
+	s->pos += (int) n;
+	if (lines != NULL && lines->count > 0) {
+		s->line += lines->count;
+		s->column = (int) (n - lines->lineStart);
+	} else s->column += (int) n;
+}
+
+int scanner_span_space(Scanner* s) {
+	int start = s->base + s->pos;
+	do {
+		SimdLines lines = { 0, 0 };
+		size_t n = simd_span_space(s->buffer + s->pos, s->size - s->pos, &lines);
+		_scanner_skip(s, n, &lines);
+	} while (s->pos >= s->size && _scanner_fill(s));
+	return s->base + s->pos - start;
+}
+
+int scanner_span_ident(Scanner* s) {
+	int start = s->base + s->pos;
+	do {
+		_scanner_skip(s, simd_span_ident(s->buffer + s->pos, s->size - s->pos), NULL);
+	} while (s->pos >= s->size && _scanner_fill(s));
+	return s->base + s->pos - start;
+}
+
+int scanner_span_string(Scanner* s) {
+	int start = s->base + s->pos;
+	do {
+		SimdLines lines = { 0, 0 };
+		size_t n = simd_span_string(s->buffer + s->pos, s->size - s->pos, &lines);
+		_scanner_skip(s, n, &lines);
+	} while (s->pos >= s->size && _scanner_fill(s));
+	return s->base + s->pos - start;
+}
+
+int scanner_file_reader(void* user, char* buf, int size) {
+	return (int) fread(buf, sizeof(char), size, (FILE*) user);
+}
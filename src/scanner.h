@@ -1,20 +1,119 @@
 #ifndef SCANNER_H
 #define SCANNER_H
 
+#define SCANNER_CHUNK_SIZE 65536
+
+// Fills buf with at most size bytes, returning how many were read (0 at end).
+typedef int (*ScannerReader)(void* user, char* buf, int size);
+
+// Scans either a caller-owned buffer in place (it must outlive the scanner)
+// or, with a reader, its own chunk buffer.
 typedef struct Scanner_t {
-	char* buffer;
+	const char* buffer;
 	int pos, size;
-	int line, column;
+	int line, column; // line counts from 1, column from 0
+
+	// Streaming input: buffer holds a window of the stream that starts at
+	// absolute offset `base`. Refills keep everything from `mark` on.
+	ScannerReader reader;
+	void* user;
+	char* chunk;
+	int capacity, base, mark;
 } Scanner;
 
 extern Scanner* scanner_new(const char* buf);
+extern Scanner* scanner_new_buffer(const char* buf, int size);
+extern Scanner* scanner_new_reader(ScannerReader reader, void* user);
 extern void scanner_free(Scanner* scanner);
 
 extern char scanner_scan(Scanner* s);
 extern char scanner_peek(Scanner* s);
+extern char scanner_peek_next(Scanner* s);
+extern void scanner_mark(Scanner* s);
+
+// SCANNER_CLASS[c] holds the kind of token c starts in its low bits and the
+// CC_* flags above them, so the lexer dispatches once per token.
+enum CharKind {
+	CK_OTHER = 0, // skipped
+	CK_END, // '\0'
+	CK_SPACE,
+	CK_ALPHA, // letters and '_'
+	CK_DIGIT,
+	CK_QUOTE,
+	CK_PUNCT // operators and punctuation
+};
+
+#define CK_MASK 0x07
+#define CC_SPACE 0x08
+#define CC_IDENT 0x10 // continues an identifier
+#define CC_NUMBER 0x20 // continues a number, except for '.'
+#define CC_STRING_END 0x40 // stops the plain run of a string literal
+
+extern const unsigned char SCANNER_CLASS[256];
+
+// Makes sure s->pos is inside the buffer, returns 0 at the end of input.
+extern int scanner_refill(Scanner* s);
+
+// Advances over bytes whose class has any of the flags, returning how many
+// it passed. Only meant for runs without newlines (numbers).
+static inline int scanner_read_while(Scanner* s, unsigned char flags) {
+	int start = s->base + s->pos;
+	do {
+		const unsigned char* buf = (const unsigned char*) s->buffer;
+		int pos = s->pos, size = s->size;
+		while (pos < size && (SCANNER_CLASS[buf[pos]] & flags)) pos++;
+		s->column += pos - s->pos;
+		s->pos = pos;
+	} while (s->pos >= s->size && scanner_refill(s));
+	return s->base + s->pos - start;
+}
+
+// Runs longer than this go to the simd.h kernels, most identifiers and
+// whitespace are shorter than a vector.
+#define SCANNER_SHORT_RUN 16
+
+extern int scanner_span_space(Scanner* s);
+extern int scanner_span_ident(Scanner* s);
+extern int scanner_span_string(Scanner* s);
+
+// Scans the start of a run over bytes whose class has (want != 0) or lacks
+// (want == 0) any of the flags. Returns 1 when the run ended in the buffer.
+static inline int scanner_short_run(Scanner* s, unsigned char flags, int want) {
+	const unsigned char* buf = (const unsigned char*) s->buffer;
+	int pos = s->pos, end = s->size - pos > SCANNER_SHORT_RUN ? pos + SCANNER_SHORT_RUN : s->size;
+	int line = s->line, column = s->column;
+	while (pos < end && ((SCANNER_CLASS[buf[pos]] & flags) != 0) == want) {
+		if (buf[pos++] == '\n') {
+			line++;
+			column = 0;
+		} else column++;
+	}
+	s->pos = pos;
+	s->line = line;
+	s->column = column;
+	return pos < end;
+}
+
+static inline int scanner_skip_space(Scanner* s) {
+	int start = s->base + s->pos;
+	if (!scanner_short_run(s, CC_SPACE, 1)) scanner_span_space(s);
+	return s->base + s->pos - start;
+}
+
+static inline int scanner_read_ident(Scanner* s) {
+	int start = s->base + s->pos;
+	if (!scanner_short_run(s, CC_IDENT, 1)) scanner_span_ident(s);
+	return s->base + s->pos - start;
+}
 
-typedef int (*ScannerCallback)(char);
+// up to the closing quote, a backslash or the end of input
+static inline int scanner_read_string(Scanner* s) {
+	int start = s->base + s->pos;
+	if (!scanner_short_run(s, CC_STRING_END, 0)) scanner_span_string(s);
+	return s->base + s->pos - start;
+}
 
-extern void scanner_read(Scanner* s, ScannerCallback whileCond, char* out);
+// ScannerReader over a FILE* (files, pipes, stdin).
+extern int scanner_file_reader(void* user, char* buf, int size);
 
-#endif // SCANNER_H
\ No newline at end of file
+#endif // SCANNER_H
@@ -0,0 +1,57 @@
+#include "shape.h"
+
+#include <stdlib.h>
+
+static Shape* _shape_new(const Shape* parent, const char* name) {
+	Shape* shape = (Shape*) malloc(sizeof(Shape));
+	shape->parent = parent;
+	shape->name = name;
+	shape->count = parent != NULL ? parent->count + 1 : 0;
+	shape->children = NULL;
+	shape->numChildren = 0;
+	shape->childrenCap = 0;
+	return shape;
+}
+
+Shape* shape_new_root(void) {
+	return _shape_new(NULL, NULL);
+}
+
+void shape_free(Shape* root) {
+	if (root == NULL) return;
+	// without recursing, a chain is as deep as an object has fields
+	int count = 1, capacity = 64;
+	Shape** stack = (Shape**) malloc(sizeof(Shape*) * capacity);
+	stack[0] = root;
+	while (count > 0) {
+		Shape* shape = stack[--count];
+		if (count + shape->numChildren > capacity) {
+			while (count + shape->numChildren > capacity) capacity *= 2;
+			stack = (Shape**) realloc(stack, sizeof(Shape*) * capacity);
+		}
+		for (int i = 0; i < shape->numChildren; i++) stack[count++] = shape->children[i];
+		free(shape->children);
+		free(shape);
+	}
+	free(stack);
+}
+
+int shape_find(const Shape* shape, const char* name) {
+	for (; shape != NULL && shape->name != NULL; shape = shape->parent) {
+		if (shape->name == name) return shape->count - 1;
+	}
+	return -1;
+}
+
+Shape* shape_add(Shape* shape, const char* name) {
+	for (int i = 0; i < shape->numChildren; i++) {
+		if (shape->children[i]->name == name) return shape->children[i];
+	}
+	if (shape->numChildren >= shape->childrenCap) {
+		shape->childrenCap = shape->childrenCap > 0 ? shape->childrenCap * 2 : 4;
+		shape->children = (Shape**) realloc(shape->children, sizeof(Shape*) * shape->childrenCap);
+	}
+	Shape* child = _shape_new(shape, name);
+	shape->children[shape->numChildren++] = child;
+	return child;
+}
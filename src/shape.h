@@ -0,0 +1,24 @@
+#ifndef SHAPE_H
+#define SHAPE_H
+
+// Hidden classes: objects that got the same fields in the same order share
+// a Shape, so where a field sits in an object only depends on its shape.
+// Shapes form a tree below an empty root, each child adding one field to
+// its parent. They belong to one isolate and live as long as it does.
+typedef struct Shape_t {
+	const struct Shape_t* parent;
+	const char* name; // of the field this shape adds, interned, NULL for the root
+	int count; // fields, name is in slot count - 1
+	struct Shape_t** children;
+	int numChildren, childrenCap;
+} Shape;
+
+extern Shape* shape_new_root(void);
+// Frees root and every shape below it.
+extern void shape_free(Shape* root);
+// The slot of field name, or -1.
+extern int shape_find(const Shape* shape, const char* name);
+// The shape an object of shape gets by adding field name, made on first use.
+extern Shape* shape_add(Shape* shape, const char* name);
+
+#endif // SHAPE_H
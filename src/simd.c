@@ -0,0 +1,155 @@
+#include "simd.h"
+
+#include <stdint.h>
+
+#include "scanner.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+enum {
+	SPAN_SPACE = 0,
+	SPAN_IDENT,
+	SPAN_STRING
+};
+
+static const unsigned char SPAN_FLAGS[] = { CC_SPACE, CC_IDENT, CC_STRING_END };
+
+// offset is where p sits in the whole run, for lines->lineStart
+static size_t _scalar_span(const char* p, size_t n, int kind, SimdLines* lines, size_t offset) {
+	const unsigned char* s = (const unsigned char*) p;
+	unsigned char flags = SPAN_FLAGS[kind];
+	int want = kind != SPAN_STRING;
+	size_t i = 0;
+	while (i < n && ((SCANNER_CLASS[s[i]] & flags) != 0) == want) {
+		if (s[i++] == '\n' && lines != NULL) {
+			lines->count++;
+			lines->lineStart = offset + i;
+		}
+	}
+	return i;
+}
+
+#ifdef SIMD_X86
+// nl holds one bit per byte of the block, the ones before the stop are counted
+static inline void _count_lines(SimdLines* lines, uint32_t nl, size_t offset) {
+	if (lines == NULL || nl == 0) return;
+	lines->count += __builtin_popcount(nl);
+	lines->lineStart = offset + 32 - __builtin_clz(nl);
+}
+
+// unsigned lo <= v <= hi, per byte
+static inline __m128i _sse2_range(__m128i v, char lo, char hi) {
+	__m128i x = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+	return _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8((char) (hi - lo))), x);
+}
+
+// Bytes of v that end the run, newlines go to *nl.
+static inline uint32_t _sse2_stops(__m128i v, int kind, uint32_t* nl) {
+	__m128i match;
+	switch (kind) {
+		case SPAN_SPACE:
+			*nl = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+			match = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _sse2_range(v, '\t', '\r'));
+			return ~(uint32_t) _mm_movemask_epi8(match) & 0xFFFF;
+		case SPAN_IDENT:
+			match = _mm_or_si128(_sse2_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z'), _sse2_range(v, '0', '9'));
+			match = _mm_or_si128(match, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+			return ~(uint32_t) _mm_movemask_epi8(match) & 0xFFFF;
+		default:
+			*nl = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+			match = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\'')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+			match = _mm_or_si128(match, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+			return (uint32_t) _mm_movemask_epi8(match);
+	}
+}
+
+static size_t _sse2_span(const char* p, size_t n, int kind, SimdLines* lines, size_t offset) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		uint32_t nl = 0;
+		uint32_t stops = _sse2_stops(_mm_loadu_si128((const __m128i*) (p + i)), kind, &nl);
+		if (stops != 0) {
+			int len = __builtin_ctz(stops);
+			_count_lines(lines, nl & ((1u << len) - 1), offset + i);
+			return i + len;
+		}
+		_count_lines(lines, nl, offset + i);
+	}
+	return i + _scalar_span(p + i, n - i, kind, lines, offset + i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i _avx2_range(__m256i v, char lo, char hi) {
+	__m256i x = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+	return _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8((char) (hi - lo))), x);
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t _avx2_stops(__m256i v, int kind, uint32_t* nl) {
+	__m256i match;
+	switch (kind) {
+		case SPAN_SPACE:
+			*nl = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+			match = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _avx2_range(v, '\t', '\r'));
+			return ~(uint32_t) _mm256_movemask_epi8(match);
+		case SPAN_IDENT:
+			match = _mm256_or_si256(_avx2_range(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z'), _avx2_range(v, '0', '9'));
+			match = _mm256_or_si256(match, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+			return ~(uint32_t) _mm256_movemask_epi8(match);
+		default:
+			*nl = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+			match = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+			match = _mm256_or_si256(match, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+			return (uint32_t) _mm256_movemask_epi8(match);
+	}
+}
+
+__attribute__((target("avx2")))
+static size_t _avx2_span(const char* p, size_t n, int kind, SimdLines* lines) {
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		uint32_t nl = 0;
+		uint32_t stops = _avx2_stops(_mm256_loadu_si256((const __m256i*) (p + i)), kind, &nl);
+		if (stops != 0) {
+			int len = __builtin_ctz(stops);
+			_count_lines(lines, nl & ((1u << len) - 1), i);
+			return i + len;
+		}
+		_count_lines(lines, nl, i);
+	}
+	// the tail still gets a 16 byte step before going scalar
+	return i + _sse2_span(p + i, n - i, kind, lines, i);
+}
+#endif
+
+static size_t _span(const char* p, size_t n, int kind, SimdLines* lines) {
+#ifdef SIMD_X86
+	if (__builtin_cpu_supports("avx2")) return _avx2_span(p, n, kind, lines);
+	return _sse2_span(p, n, kind, lines, 0);
+#else
+	return _scalar_span(p, n, kind, lines, 0);
+#endif
+}
+
+size_t simd_span_space(const char* p, size_t n, SimdLines* lines) {
+	return _span(p, n, SPAN_SPACE, lines);
+}
+
+size_t simd_span_ident(const char* p, size_t n) {
+	return _span(p, n, SPAN_IDENT, NULL);
+}
+
+size_t simd_span_string(const char* p, size_t n, SimdLines* lines) {
+	return _span(p, n, SPAN_STRING, lines);
+}
+
+const char* simd_level(void) {
+#ifdef SIMD_X86
+	return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#else
+	return "scalar";
+#endif
+}
@@ -0,0 +1,25 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+
+// Vectorized scans over the scanner's byte classes. Each returns the length
+// of the run at the start of p[0, n): whitespace (CC_SPACE), identifier
+// characters (CC_IDENT) or the plain part of a string literal (up to a
+// quote, a backslash or a NUL). x86-64 builds pick AVX2 or SSE2 at runtime,
+// other targets get the scalar loops.
+
+// Newlines inside a run, for line/column tracking without a per byte branch.
+typedef struct SimdLines_t {
+	int count;
+	size_t lineStart; // offset just past the last newline, if count > 0
+} SimdLines;
+
+extern size_t simd_span_space(const char* p, size_t n, SimdLines* lines);
+extern size_t simd_span_ident(const char* p, size_t n);
+extern size_t simd_span_string(const char* p, size_t n, SimdLines* lines);
+
+// "avx2", "sse2" or "scalar"
+extern const char* simd_level(void);
+
+#endif // SIMD_H
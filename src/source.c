@@ -0,0 +1,82 @@
+#define _POSIX_C_SOURCE 200809L
+#include "source.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static int _source_read(SourceFile* src, const char* path) {
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) return 0;
+
+	size_t cap = 65536, len = 0;
+	char* data = (char*) malloc(cap);
+	size_t n;
+	while ((n = fread(data + len, 1, cap - len, fp)) > 0) {
+		len += n;
+		if (len == cap) {
+			cap *= 2;
+			data = (char*) realloc(data, cap);
+		}
+	}
+	fclose(fp);
+
+	if (len == 0) {
+		free(data);
+		data = NULL;
+	}
+	src->data = data;
+	src->size = len;
+	src->mapped = 0;
+	return 1;
+}
+
+int source_open(SourceFile* src, const char* path) {
+	src->data = NULL;
+	src->size = 0;
+	src->mapped = 0;
+
+#ifndef _WIN32
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return 0;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return 0;
+	}
+
+	if (st.st_size == 0) { // can't map an empty file
+		close(fd);
+		return 1;
+	}
+
+	void* data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return _source_read(src, path);
+
+	src->data = (const char*) data;
+	src->size = (size_t) st.st_size;
+	src->mapped = 1;
+	return 1;
+#else
+	return _source_read(src, path);
+#endif
+}
+
+void source_close(SourceFile* src) {
+#ifndef _WIN32
+	if (src->mapped) munmap((void*) src->data, src->size);
+	else
+#endif
+	free((void*) src->data);
+	src->data = NULL;
+	src->size = 0;
+	src->mapped = 0;
+}
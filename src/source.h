@@ -0,0 +1,19 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+
+// A script loaded read-only. Regular files are memory mapped and lexed in
+// place, the data is NOT NUL-terminated (and NULL for empty files).
+typedef struct SourceFile_t {
+	const char* data;
+	size_t size;
+	int mapped;
+} SourceFile;
+
+// Returns 0 if path can't be opened or isn't a regular file; pipes and stdin
+// should be streamed with lexer_new_reader instead.
+extern int source_open(SourceFile* src, const char* path);
+extern void source_close(SourceFile* src);
+
+#endif // SOURCE_H
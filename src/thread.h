@@ -0,0 +1,44 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+// The little of pthreads the compiler needs. Builds without SMOL_THREADS
+// get no-op locks and run everything on the calling thread.
+#if SMOL_THREADS
+#include <pthread.h>
+
+typedef pthread_mutex_t SmolMutex;
+typedef pthread_cond_t SmolCond;
+typedef pthread_t SmolThread;
+
+static inline void mutex_new(SmolMutex* m) { pthread_mutex_init(m, NULL); }
+static inline void mutex_free(SmolMutex* m) { pthread_mutex_destroy(m); }
+static inline void mutex_lock(SmolMutex* m) { pthread_mutex_lock(m); }
+static inline void mutex_unlock(SmolMutex* m) { pthread_mutex_unlock(m); }
+
+static inline void cond_new(SmolCond* c) { pthread_cond_init(c, NULL); }
+static inline void cond_free(SmolCond* c) { pthread_cond_destroy(c); }
+static inline void cond_wait(SmolCond* c, SmolMutex* m) { pthread_cond_wait(c, m); }
+static inline void cond_broadcast(SmolCond* c) { pthread_cond_broadcast(c); }
+
+static inline int thread_start(SmolThread* t, void* (*fn)(void*), void* arg) { return pthread_create(t, NULL, fn, arg) == 0; }
+static inline void thread_join(SmolThread t) { pthread_join(t, NULL); }
+#else
+typedef int SmolMutex;
+typedef int SmolCond;
+typedef int SmolThread;
+
+static inline void mutex_new(SmolMutex* m) { *m = 0; }
+static inline void mutex_free(SmolMutex* m) { (void) m; }
+static inline void mutex_lock(SmolMutex* m) { (void) m; }
+static inline void mutex_unlock(SmolMutex* m) { (void) m; }
+
+static inline void cond_new(SmolCond* c) { *c = 0; }
+static inline void cond_free(SmolCond* c) { (void) c; }
+static inline void cond_wait(SmolCond* c, SmolMutex* m) { (void) c; (void) m; }
+static inline void cond_broadcast(SmolCond* c) { (void) c; }
+
+static inline int thread_start(SmolThread* t, void* (*fn)(void*), void* arg) { (void) t; (void) fn; (void) arg; return 0; }
+static inline void thread_join(SmolThread t) { (void) t; }
+#endif
+
+#endif // THREAD_H
@@ -1 +1,1357 @@
-#include "vm.h"
\ No newline at end of file
+#include "vm.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+const char* INSTRUCTIONS[] = {
+	"NOP",
+
+	"MOVE",
+	"LOADK",
+	"LOADNIL",
+	"LOADBOOL",
+	"GETGLOBAL",
+	"SETGLOBAL",
+
+	"NEWLIST",
+	"APPEND",
+	"RANGE",
+	"GETINDEX",
+	"SETINDEX",
+	"GETFIELD",
+	"SETFIELD",
+
+	"ADD",
+	"SUB",
+	"MUL",
+	"DIV",
+	"MOD",
+	"LSH",
+	"RSH",
+	"BITAND",
+	"BITOR",
+	"BITXOR",
+	"EQ",
+	"NE",
+	"LT",
+	"LE",
+	"GT",
+	"GE",
+
+	"NEG",
+	"NOT",
+	"BITNOT",
+
+	"JMP",
+	"JMPIF",
+	"JMPIFNOT",
+	"JMPNOTNIL",
+
+	"FORPREP",
+	"FORITER",
+	"RANGEPREP",
+	"RANGELOOP",
+
+	"CALL",
+	"RETURN",
+	"TAILCALL",
+
+	"ADDN",
+	"SUBN",
+	"MULN",
+	"DIVN",
+	"MODN",
+	"NEGN",
+	"EQN",
+	"NEN",
+	"LTN",
+	"LEN",
+	"GTN",
+	"GEN",
+	"LSHI",
+	"RSHI",
+	"BITANDI",
+	"BITORI",
+	"BITXORI",
+	"BITNOTI",
+	"CHECK",
+
+	"ADDNN",
+	"CONCAT",
+	"EQNN",
+	"NENN",
+	"LTNN",
+	"LENN",
+	"GTNN",
+	"GENN"
+};
+
+const char* TYPES[] = {
+	"any",
+	"int",
+	"double",
+	"string",
+	"bool"
+};
+
+Function* function_new(const char* name) {
+	Function* fn = (Function*) malloc(sizeof(Function));
+	fn->name = name;
+	fn->codeLen = 0;
+	fn->codeCap = 64;
+	fn->code = (Instruction*) malloc(sizeof(Instruction) * fn->codeCap);
+	fn->lines = (int*) malloc(sizeof(int) * fn->codeCap);
+	fn->numConstants = 0;
+	fn->constantsCap = 16;
+	fn->constants = (Object*) malloc(sizeof(Object) * fn->constantsCap);
+	fn->constantSlots = NULL;
+	fn->constantSlotsCap = 0;
+	fn->numSlotted = 0;
+	fn->numParams = 0;
+	fn->numRegisters = 0;
+	fn->mapped = 0;
+	fn->index = -1;
+	return fn;
+}
+
+void function_free(Function* fn) {
+	if (fn == NULL) return;
+	if (!fn->mapped) {
+		free(fn->code);
+		free(fn->lines);
+	}
+	free(fn->constants);
+	free(fn->constantSlots);
+	free(fn);
+}
+
+int function_emit(Function* fn, Instruction ins, int line) {
+	if (fn->codeLen >= fn->codeCap) {
+		fn->codeCap *= 2;
+		fn->code = (Instruction*) realloc(fn->code, sizeof(Instruction) * fn->codeCap);
+		fn->lines = (int*) realloc(fn->lines, sizeof(int) * fn->codeCap);
+	}
+	fn->code[fn->codeLen] = ins;
+	fn->lines[fn->codeLen] = line;
+	return fn->codeLen++;
+}
+
+static int _constant_equals(Object k, Object value) {
+	if (obj_type(k) != obj_type(value)) return 0;
+	if (obj_is(k, OT_NUMBER)) {
+		// bitwise, so 0 and -0 stay apart
+		double a = obj_as_number(k), b = obj_as_number(value);
+		return memcmp(&a, &b, sizeof(double)) == 0;
+	}
+	return obj_equals(k, value);
+}
+
+static uint32_t _constant_hash(Object value) {
+	uint64_t bits = 0;
+	switch (obj_type(value)) {
+		case OT_NUMBER: {
+			double n = obj_as_number(value);
+			memcpy(&bits, &n, sizeof(bits));
+		} break;
+		case OT_BOOL: bits = (uint64_t) obj_as_bool(value); break;
+		case OT_NIL: break;
+		default: bits = (uint64_t) (uintptr_t) obj_as_ptr(value); break;
+	}
+	bits = (bits ^ (uint64_t) obj_type(value)) * 0x9E3779B97F4A7C15ull;
+	return (uint32_t) (bits >> 32);
+}
+
+// Adds constants [numSlotted, numConstants) to the slots, growing them to
+// stay at most half full.
+static void _slot_constants(Function* fn) {
+	if (fn->numConstants * 2 > fn->constantSlotsCap) {
+		int cap = fn->constantSlotsCap > 0 ? fn->constantSlotsCap : 64;
+		while (fn->numConstants * 2 > cap) cap *= 2;
+		free(fn->constantSlots);
+		fn->constantSlots = (int*) calloc(cap, sizeof(int));
+		fn->constantSlotsCap = cap;
+		fn->numSlotted = 0;
+	}
+	uint32_t mask = fn->constantSlotsCap - 1;
+	for (; fn->numSlotted < fn->numConstants; fn->numSlotted++) {
+		uint32_t i = _constant_hash(fn->constants[fn->numSlotted]) & mask;
+		while (fn->constantSlots[i] != 0) i = (i + 1) & mask;
+		fn->constantSlots[i] = fn->numSlotted + 1;
+	}
+}
+
+int function_constant(Function* fn, Object value) {
+	if (fn->numConstants < 8) {
+		for (int i = 0; i < fn->numConstants; i++) {
+			if (_constant_equals(fn->constants[i], value)) return i;
+		}
+	} else {
+		_slot_constants(fn);
+		uint32_t mask = fn->constantSlotsCap - 1;
+		for (uint32_t i = _constant_hash(value) & mask; fn->constantSlots[i] != 0; i = (i + 1) & mask) {
+			int k = fn->constantSlots[i] - 1;
+			if (_constant_equals(fn->constants[k], value)) return k;
+		}
+	}
+	if (fn->numConstants >= VM_MAX_CONSTANTS) return -1;
+	if (fn->numConstants >= fn->constantsCap) {
+		fn->constantsCap *= 2;
+		fn->constants = (Object*) realloc(fn->constants, sizeof(Object) * fn->constantsCap);
+	}
+	fn->constants[fn->numConstants] = value;
+	return fn->numConstants++;
+}
+
+// Strings inside lists and objects print quoted.
+static void _print_item(Object obj) {
+	if (obj_is(obj, OT_STRING)) printf("'%s'", (const char*) obj_as_ptr(obj));
+	else print_object(obj);
+}
+
+void print_object(Object obj) {
+	switch (obj_type(obj)) {
+		case OT_NIL: printf("nil"); break;
+		case OT_NUMBER: printf(VM_NUMBER_FORMAT, obj_as_number(obj)); break;
+		case OT_BOOL: printf("%s", obj_as_bool(obj) ? "true" : "false"); break;
+		case OT_STRING: printf("%s", (const char*) obj_as_ptr(obj)); break;
+		case OT_LIST: {
+			List* list = (List*) obj_as_ptr(obj);
+			printf("[");
+			for (int i = 0; i < list->count; i++) {
+				if (i > 0) printf(", ");
+				_print_item(list->items[i]);
+			}
+			printf("]");
+		} break;
+		case OT_OBJECT: {
+			List* object = (List*) obj_as_ptr(obj);
+			const char** names = (const char**) malloc(sizeof(const char*) * (object->count > 0 ? object->count : 1));
+			for (const Shape* shape = object->shape; shape->name != NULL; shape = shape->parent) {
+				names[shape->count - 1] = shape->name;
+			}
+			printf("{");
+			for (int i = 0; i < object->count; i++) {
+				if (i > 0) printf(", ");
+				printf("%s: ", names[i]);
+				_print_item(object->items[i]);
+			}
+			printf("}");
+			free(names);
+		} break;
+		case OT_FUNCTION: {
+			const char* name = ((Function*) obj_as_ptr(obj))->name;
+			printf("<fun %s>", name != NULL ? name : "?");
+		} break;
+		case OT_NATIVE: printf("<native %s>", ((const Native*) obj_as_ptr(obj))->name); break;
+	}
+}
+
+void function_disassemble(const Program* prog, Function* fn) {
+	printf("fun %s (%d params, %d registers, %d constants)\n",
+		fn->name != NULL ? fn->name : "<main>", fn->numParams, fn->numRegisters, fn->numConstants);
+	for (int pc = 0; pc < fn->codeLen; pc++) {
+		Instruction ins = fn->code[pc];
+		int op = INS_OP(ins);
+		printf("  %04d  [%3d]  %-10s", pc, fn->lines[pc], op < IT_COUNT ? INSTRUCTIONS[op] : "???");
+		switch (op) {
+			case IT_LOADK:
+				printf("%3d %5d  ; ", INS_A(ins), INS_BX(ins));
+				print_object(fn->constants[INS_BX(ins)]);
+				break;
+			case IT_GETGLOBAL:
+			case IT_SETGLOBAL:
+				printf("%3d %5d  ; %s", INS_A(ins), INS_BX(ins), (int) INS_BX(ins) < prog->numGlobals ? prog->globals[INS_BX(ins)] : "?");
+				break;
+			case IT_JMP:
+			case IT_JMPIF:
+			case IT_JMPIFNOT:
+			case IT_JMPNOTNIL:
+			case IT_FORITER:
+			case IT_RANGEPREP:
+			case IT_RANGELOOP:
+				printf("%3d %5d  ; -> %d", INS_A(ins), INS_SBX(ins), pc + 1 + INS_SBX(ins));
+				break;
+			case IT_GETFIELD:
+				printf("%3d %3d %3d  ; ", INS_A(ins), INS_B(ins), INS_C(ins));
+				print_object(fn->constants[INS_C(ins)]);
+				break;
+			case IT_SETFIELD:
+				printf("%3d %3d %3d  ; ", INS_A(ins), INS_B(ins), INS_C(ins));
+				print_object(fn->constants[INS_B(ins)]);
+				break;
+			case IT_CHECK:
+				printf("%3d %3d      ; %s", INS_A(ins), INS_B(ins), INS_B(ins) < TY_COUNT ? TYPES[INS_B(ins)] : "?");
+				break;
+			default:
+				printf("%3d %3d %3d", INS_A(ins), INS_B(ins), INS_C(ins));
+				break;
+		}
+		printf("\n");
+	}
+	printf("\n");
+}
+
+Program* program_new(Interner* strings) {
+	Program* prog = (Program*) malloc(sizeof(Program));
+	prog->numFunctions = 0;
+	prog->functionsCap = 8;
+	prog->functions = (Function**) malloc(sizeof(Function*) * prog->functionsCap);
+	prog->globals = NULL;
+	prog->numGlobals = 0;
+	prog->globalsCap = 0;
+	prog->globalSlots = NULL;
+	prog->globalSlotsCap = 0;
+	prog->strings = strings;
+	prog->image = NULL;
+	return prog;
+}
+
+void program_free(Program* prog) {
+	if (prog == NULL) return;
+	for (int i = 0; i < prog->numFunctions; i++) {
+		function_free(prog->functions[i]);
+	}
+	free(prog->functions);
+	free(prog->globals);
+	free(prog->globalSlots);
+	if (prog->image != NULL) {
+		source_close(prog->image);
+		free(prog->image);
+	}
+	free(prog);
+}
+
+void program_add_function(Program* prog, Function* fn) {
+	if (prog->numFunctions >= prog->functionsCap) {
+		prog->functionsCap *= 2;
+		prog->functions = (Function**) realloc(prog->functions, sizeof(Function*) * prog->functionsCap);
+	}
+	fn->index = prog->numFunctions;
+	prog->functions[prog->numFunctions++] = fn;
+}
+
+int program_find_global(const Program* prog, const char* name) {
+	if (prog->globalSlotsCap == 0) return -1;
+	uint32_t mask = prog->globalSlotsCap - 1;
+	for (uint32_t i = intern_hash(name) & mask; prog->globalSlots[i] != 0; i = (i + 1) & mask) {
+		if (prog->globals[prog->globalSlots[i] - 1] == name) return prog->globalSlots[i] - 1;
+	}
+	return -1;
+}
+
+static void _slot_global(Program* prog, int slot) {
+	uint32_t mask = prog->globalSlotsCap - 1;
+	uint32_t i = intern_hash(prog->globals[slot]) & mask;
+	while (prog->globalSlots[i] != 0) i = (i + 1) & mask;
+	prog->globalSlots[i] = slot + 1;
+}
+
+int program_global(Program* prog, const char* name) {
+	int slot = program_find_global(prog, name);
+	if (slot >= 0) return slot;
+	if (prog->numGlobals >= VM_MAX_GLOBALS) return -1;
+	if (prog->numGlobals >= prog->globalsCap) {
+		prog->globalsCap = prog->globalsCap > 0 ? prog->globalsCap * 2 : 16;
+		prog->globals = (const char**) realloc(prog->globals, sizeof(const char*) * prog->globalsCap);
+	}
+	slot = prog->numGlobals++;
+	prog->globals[slot] = name;
+	// stay at most half full
+	if (prog->numGlobals * 2 > prog->globalSlotsCap) {
+		free(prog->globalSlots);
+		prog->globalSlotsCap = prog->globalSlotsCap > 0 ? prog->globalSlotsCap * 2 : 32;
+		prog->globalSlots = (int*) calloc(prog->globalSlotsCap, sizeof(int));
+		for (int i = 0; i < prog->numGlobals; i++) _slot_global(prog, i);
+	} else _slot_global(prog, slot);
+	return slot;
+}
+
+void program_disassemble(Program* prog) {
+	for (int i = 0; i < prog->numFunctions; i++) {
+		function_disassemble(prog, prog->functions[i]);
+	}
+}
+
+static const char* _type_name(int type) {
+	switch (type) {
+		case OT_NIL: return "nil";
+		case OT_NUMBER: return "number";
+		case OT_BOOL: return "bool";
+		case OT_STRING: return "string";
+		case OT_LIST: return "list";
+		case OT_FUNCTION: return "function";
+		case OT_NATIVE: return "native";
+		case OT_OBJECT: return "object";
+		default: return "?";
+	}
+}
+
+List* vm_new_list(SmolVM* vm) {
+	return gc_alloc_list(&vm->heap);
+}
+
+List* vm_new_object(SmolVM* vm) {
+	List* object = gc_alloc_list(&vm->heap);
+	object->shape = vm->shapes;
+	return object;
+}
+
+void vm_list_push(SmolVM* vm, List* list, Object value) {
+	if (list->count >= list->capacity) {
+		int capacity = list->capacity > 0 ? list->capacity * 2 : 8;
+		list->items = (Object*) realloc(list->items, sizeof(Object) * capacity);
+		size_t grown = sizeof(Object) * (capacity - list->capacity);
+		list->capacity = capacity;
+		if (list->gcFlags & GC_YOUNG) {
+			vm->heap.youngBytes += grown;
+			if (vm->heap.youngBytes > GC_NURSERY_BYTES) vm->heap.pending = 1;
+		} else vm->heap.oldBytes += grown;
+	}
+	vm_barrier(vm, list, value);
+	list->items[list->count++] = value;
+}
+
+void vm_error(SmolVM* vm, const char* fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	CallFrame* frame = &vm->frames[vm->numFrames - 1];
+	printf("(%d) ", frame->fn->lines[frame->pc - frame->code - 1]);
+	vprintf(fmt, args);
+	printf("\n");
+	va_end(args);
+
+	int callers = vm->numFrames - 1;
+	for (int i = callers; i > 0; i--) {
+		if (callers > 2 * VM_TRACE_FRAMES + 1 && i == callers - VM_TRACE_FRAMES) {
+			printf("  ... %d more frames ...\n", callers - 2 * VM_TRACE_FRAMES);
+			i = VM_TRACE_FRAMES + 1;
+			continue;
+		}
+		frame = &vm->frames[i];
+		CallFrame* caller = &vm->frames[i - 1];
+		printf("  in %s called from line %d\n", frame->fn->name, caller->fn->lines[caller->pc - caller->code - 1]);
+	}
+}
+
+static int _native_print(SmolVM* vm, Object* args, int numArgs, Object* result) {
+	(void) vm;
+	(void) result;
+	for (int i = 0; i < numArgs; i++) {
+		if (i > 0) printf(" ");
+		print_object(args[i]);
+	}
+	printf("\n");
+	return 1;
+}
+
+static int _native_len(SmolVM* vm, Object* args, int numArgs, Object* result) {
+	if (numArgs == 1 && obj_is(args[0], OT_LIST)) {
+		*result = obj_number(((List*) obj_as_ptr(args[0]))->count);
+		return 1;
+	}
+	if (numArgs == 1 && obj_is(args[0], OT_STRING)) {
+		*result = obj_number(intern_length((const char*) obj_as_ptr(args[0])));
+		return 1;
+	}
+	vm_error(vm, "len() expects a list or a string.");
+	return 0;
+}
+
+static int _native_push(SmolVM* vm, Object* args, int numArgs, Object* result) {
+	if (numArgs < 1 || !obj_is(args[0], OT_LIST)) {
+		vm_error(vm, "push() expects a list.");
+		return 0;
+	}
+	for (int i = 1; i < numArgs; i++) {
+		vm_list_push(vm, (List*) obj_as_ptr(args[0]), args[i]);
+	}
+	*result = args[0];
+	return 1;
+}
+
+static int _native_clock(SmolVM* vm, Object* args, int numArgs, Object* result) {
+	(void) vm;
+	(void) args;
+	(void) numArgs;
+	*result = obj_number((double) clock() / CLOCKS_PER_SEC);
+	return 1;
+}
+
+static int _native_object(SmolVM* vm, Object* args, int numArgs, Object* result) {
+	(void) args;
+	(void) numArgs;
+	*result = obj_ptr(OT_OBJECT, vm_new_object(vm));
+	return 1;
+}
+
+static const Native NATIVES[] = {
+	{ "print", _native_print },
+	{ "len", _native_len },
+	{ "push", _native_push },
+	{ "clock", _native_clock },
+	{ "object", _native_object }
+};
+
+// Interns a string made at run time into the isolate's layer, where the
+// GC frees it once unreachable.
+static const char* _intern(SmolVM* vm, const char* str, int len) {
+	int count = vm->strings.count;
+	const char* s = interner_intern(&vm->strings, str, len);
+	if (vm->strings.count > count) gc_note_string(vm, intern_size(len));
+	return s;
+}
+
+void vm_define_native(SmolVM* vm, const Native* native) {
+	// interning finds the program's copy of the name when it uses it
+	const char* name = _intern(vm, native->name, (int) strlen(native->name));
+	int slot = program_find_global(vm->program, name);
+	if (slot >= 0) vm->globals[slot] = obj_ptr(OT_NATIVE, native);
+}
+
+const Native* vm_find_native(const char* name) {
+	for (size_t i = 0; i < sizeof(NATIVES) / sizeof(NATIVES[0]); i++) {
+		if (strcmp(NATIVES[i].name, name) == 0) return &NATIVES[i];
+	}
+	return NULL;
+}
+
+void vm_new(SmolVM* vm, const Program* program) {
+	vm->program = program;
+	interner_new_layer(&vm->strings, program->strings);
+	vm->numGlobals = program->numGlobals;
+	vm->globals = (Object*) malloc(sizeof(Object) * (vm->numGlobals > 0 ? vm->numGlobals : 1));
+	for (int i = 0; i < vm->numGlobals; i++) {
+		vm->globals[i] = obj_nil();
+	}
+	vm->stack = (Object*) malloc(sizeof(Object) * VM_STACK_SIZE);
+	vm->numFrames = 0;
+	vm->code = (IsolateCode*) calloc(program->numFunctions > 0 ? program->numFunctions : 1, sizeof(IsolateCode));
+	gc_new(&vm->heap);
+	vm->shapes = shape_new_root();
+	vm->instructions = 0;
+	vm->quickened = 0;
+	vm->deopts = 0;
+	vm->cacheHits = 0;
+	vm->cacheMisses = 0;
+	for (size_t i = 0; i < sizeof(NATIVES) / sizeof(NATIVES[0]); i++) {
+		vm_define_native(vm, &NATIVES[i]);
+	}
+}
+
+void vm_free(SmolVM* vm) {
+	gc_free(&vm->heap);
+	for (int i = 0; i < vm->program->numFunctions; i++) {
+		IsolateCode* ic = &vm->code[i];
+		if (ic->fields != NULL) {
+			for (int pc = 0; pc < vm->program->functions[i]->codeLen; pc++) free(ic->fields[pc]);
+			free(ic->fields);
+		}
+		free(ic->code);
+		free(ic->deopts);
+	}
+	free(vm->code);
+	shape_free(vm->shapes);
+	free(vm->globals);
+	free(vm->stack);
+	interner_free(&vm->strings);
+}
+
+static const char* _concat(SmolVM* vm, Object a, Object b) {
+	char left[32], right[32];
+	const char* as = left;
+	const char* bs = right;
+	int alen, blen;
+	if (obj_is(a, OT_STRING)) {
+		as = (const char*) obj_as_ptr(a);
+		alen = intern_length(as);
+	} else alen = snprintf(left, sizeof(left), VM_NUMBER_FORMAT, obj_as_number(a));
+	if (obj_is(b, OT_STRING)) {
+		bs = (const char*) obj_as_ptr(b);
+		blen = intern_length(bs);
+	} else blen = snprintf(right, sizeof(right), VM_NUMBER_FORMAT, obj_as_number(b));
+
+	char* buf = (char*) malloc(alen + blen + 1);
+	memcpy(buf, as, alen);
+	memcpy(buf + alen, bs, blen);
+	const char* str = _intern(vm, buf, alen + blen);
+	free(buf);
+	return str;
+}
+
+static inline int _concatenates(Object a, Object b) {
+	return (obj_is(a, OT_STRING) && (obj_is(b, OT_STRING) || obj_is(b, OT_NUMBER))) || (obj_is(a, OT_NUMBER) && obj_is(b, OT_STRING));
+}
+
+static int _has_type(Object obj, int type) {
+	switch (type) {
+		case TY_INT: {
+			if (!obj_is(obj, OT_NUMBER)) return 0;
+			double n = obj_as_number(obj);
+			return n == floor(n) && fabs(n) < 9223372036854775808.0;
+		}
+		case TY_DOUBLE: return obj_is(obj, OT_NUMBER);
+		case TY_STRING: return obj_is(obj, OT_STRING);
+		case TY_BOOL: return obj_is(obj, OT_BOOL);
+		default: return 1;
+	}
+}
+
+// Slow path of IT_ADD, the VM handles two numbers inline.
+static int _add(SmolVM* vm, Object* dst, Object a, Object b) {
+	int ta = obj_type(a), tb = obj_type(b);
+	if (_concatenates(a, b)) {
+		*dst = obj_ptr(OT_STRING, _concat(vm, a, b));
+		return 1;
+	}
+	if (ta == OT_LIST && tb == OT_LIST) {
+		List* left = (List*) obj_as_ptr(a);
+		List* right = (List*) obj_as_ptr(b);
+		List* list = vm_new_list(vm);
+		for (int i = 0; i < left->count; i++) vm_list_push(vm, list, left->items[i]);
+		for (int i = 0; i < right->count; i++) vm_list_push(vm, list, right->items[i]);
+		*dst = obj_ptr(OT_LIST, list);
+		return 1;
+	}
+	vm_error(vm, "Cannot add %s and %s.", _type_name(ta), _type_name(tb));
+	return 0;
+}
+
+static int _compare(SmolVM* vm, int op, Object a, Object b, int* result) {
+	int cmp;
+	if (obj_is(a, OT_STRING) && obj_is(b, OT_STRING)) cmp = strcmp((const char*) obj_as_ptr(a), (const char*) obj_as_ptr(b));
+	else {
+		vm_error(vm, "Cannot compare %s and %s.", _type_name(obj_type(a)), _type_name(obj_type(b)));
+		return 0;
+	}
+	switch (op) {
+		case IT_LT: *result = cmp < 0; break;
+		case IT_LE: *result = cmp <= 0; break;
+		case IT_GT: *result = cmp > 0; break;
+		default: *result = cmp >= 0; break;
+	}
+	return 1;
+}
+
+static int _check_range(SmolVM* vm, Object* r) {
+	if (!obj_is(r[0], OT_NUMBER) || !obj_is(r[1], OT_NUMBER) || !obj_is(r[2], OT_NUMBER)) {
+		vm_error(vm, "A range needs numbers, got %s..%s..%s.",
+			_type_name(obj_type(r[0])), _type_name(obj_type(r[1])), _type_name(obj_type(r[2])));
+		return 0;
+	}
+	if (obj_as_number(r[2]) == 0) {
+		vm_error(vm, "A range can't have a step of 0.");
+		return 0;
+	}
+	return 1;
+}
+
+static inline int _in_range(double value, double limit, double step) {
+	return step > 0 ? value < limit : value > limit;
+}
+
+static int _range_list(SmolVM* vm, Object* dst, Object* r) {
+	if (!_check_range(vm, r)) return 0;
+	double limit = obj_as_number(r[1]), step = obj_as_number(r[2]);
+	List* list = vm_new_list(vm);
+	for (double value = obj_as_number(r[0]); _in_range(value, limit, step); value += step) {
+		vm_list_push(vm, list, obj_number(value));
+	}
+	*dst = obj_ptr(OT_LIST, list);
+	return 1;
+}
+
+static int _get_field(SmolVM* vm, FieldCache* fc, Object* dst, Object obj, const char* name);
+
+static int _get_index(SmolVM* vm, Object* dst, Object obj, Object key) {
+	// also field accesses past the 8-bit constant range
+	if (obj_is(key, OT_STRING) && (obj_is(obj, OT_OBJECT) || strcmp((const char*) obj_as_ptr(key), "length") == 0))
+		return _get_field(vm, NULL, dst, obj, (const char*) obj_as_ptr(key));
+	if (!obj_is(key, OT_NUMBER)) {
+		vm_error(vm, "Cannot index with a %s.", _type_name(obj_type(key)));
+		return 0;
+	}
+	int i = (int) obj_as_number(key);
+	if (obj_is(obj, OT_LIST)) {
+		List* list = (List*) obj_as_ptr(obj);
+		if (i < 0 || i >= list->count) {
+			vm_error(vm, "Index %d out of range.", i);
+			return 0;
+		}
+		*dst = list->items[i];
+		return 1;
+	}
+	if (obj_is(obj, OT_STRING)) {
+		const char* str = (const char*) obj_as_ptr(obj);
+		if (i < 0 || i >= intern_length(str)) {
+			vm_error(vm, "Index %d out of range.", i);
+			return 0;
+		}
+		*dst = obj_ptr(OT_STRING, _intern(vm, str + i, 1));
+		return 1;
+	}
+	vm_error(vm, "Cannot index a %s.", _type_name(obj_type(obj)));
+	return 0;
+}
+
+// Adds what a field access on an object of shape found to its cache,
+// unless the cache is full.
+static void _cache_field(SmolVM* vm, FieldCache* fc, const Shape* shape, Shape* next, int slot) {
+	vm->cacheMisses++;
+	if (fc == NULL || fc->count >= VM_CACHE_WAYS) return;
+	fc->shapes[fc->count] = shape;
+	fc->next[fc->count] = next;
+	fc->slots[fc->count] = slot;
+	fc->count++;
+}
+
+// Slow path of IT_GETFIELD, fc is the instruction's cache or NULL.
+static int _get_field(SmolVM* vm, FieldCache* fc, Object* dst, Object obj, const char* name) {
+	if (obj_is(obj, OT_OBJECT)) {
+		List* object = (List*) obj_as_ptr(obj);
+		int slot = shape_find(object->shape, name);
+		if (slot >= 0) {
+			_cache_field(vm, fc, object->shape, NULL, slot);
+			*dst = object->items[slot];
+			return 1;
+		}
+	} else if (strcmp(name, "length") == 0 && (obj_is(obj, OT_LIST) || obj_is(obj, OT_STRING))) {
+		*dst = obj_number(obj_is(obj, OT_LIST) ? ((List*) obj_as_ptr(obj))->count : intern_length((const char*) obj_as_ptr(obj)));
+		return 1;
+	}
+	if (obj_is(obj, OT_OBJECT)) vm_error(vm, "The object has no field '%s'.", name);
+	else vm_error(vm, "A %s has no field '%s'.", _type_name(obj_type(obj)), name);
+	return 0;
+}
+
+// Slow path of IT_SETFIELD, adding the field when the object lacks it.
+static int _set_field(SmolVM* vm, FieldCache* fc, Object obj, const char* name, Object value) {
+	if (!obj_is(obj, OT_OBJECT)) {
+		vm_error(vm, "Cannot set field '%s' of a %s.", name, _type_name(obj_type(obj)));
+		return 0;
+	}
+	List* object = (List*) obj_as_ptr(obj);
+	Shape* shape = object->shape;
+	int slot = shape_find(shape, name);
+	if (slot >= 0) {
+		_cache_field(vm, fc, shape, NULL, slot);
+		vm_barrier(vm, object, value);
+		object->items[slot] = value;
+		return 1;
+	}
+	Shape* next = shape_add(shape, name);
+	_cache_field(vm, fc, shape, next, shape->count);
+	vm_list_push(vm, object, value);
+	object->shape = next;
+	return 1;
+}
+
+// The cache of the field access at.
+static inline FieldCache* _field_cache(SmolVM* vm, const CallFrame* frame, const Instruction* at) {
+	IsolateCode* ic = &vm->code[frame->fn->index];
+	int i = (int) (at - ic->code);
+	if (ic->fields == NULL) ic->fields = (FieldCache**) calloc(frame->fn->codeLen, sizeof(FieldCache*));
+	if (ic->fields[i] == NULL) ic->fields[i] = (FieldCache*) calloc(1, sizeof(FieldCache));
+	return ic->fields[i];
+}
+
+static inline const Instruction* _isolate_code(SmolVM* vm, const Function* fn) {
+	IsolateCode* ic = &vm->code[fn->index];
+	if (ic->code == NULL) {
+		ic->code = (Instruction*) malloc(sizeof(Instruction) * fn->codeLen);
+		memcpy(ic->code, fn->code, sizeof(Instruction) * fn->codeLen);
+		ic->deopts = (unsigned char*) calloc(fn->codeLen, 1);
+	}
+	return ic->code;
+}
+
+// Rewrites the instruction at to op, unless it fell back too often.
+static inline void _quicken(SmolVM* vm, const CallFrame* frame, const Instruction* at, int op) {
+	IsolateCode* ic = &vm->code[frame->fn->index];
+	int i = (int) (at - ic->code);
+	if (ic->deopts[i] >= VM_MAX_DEOPTS) return;
+	ic->code[i] = (ic->code[i] & ~(Instruction) 0xFF) | (Instruction) op;
+	vm->quickened++;
+}
+
+static void _deopt(SmolVM* vm, const CallFrame* frame, const Instruction* at, int op) {
+	IsolateCode* ic = &vm->code[frame->fn->index];
+	int i = (int) (at - ic->code);
+	ic->code[i] = (ic->code[i] & ~(Instruction) 0xFF) | (Instruction) op;
+	ic->deopts[i]++;
+	vm->deopts++;
+}
+
+// SMOL_COMPUTED_GOTO selects labels-as-values dispatch, a jump table indexed
+// by opcode with an indirect jump at the end of every handler. Otherwise the
+// loop uses a plain switch.
+#if defined(SMOL_COMPUTED_GOTO) && SMOL_COMPUTED_GOTO && defined(__GNUC__)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+#if VM_COMPUTED_GOTO
+#define VM_LOOP VM_NEXT;
+#define VM_CASE(op) L_##op:
+#define VM_NEXT do { count++; ins = *pc++; goto *labels[INS_OP(ins)]; } while (0)
+#define VM_DEFAULT L_INVALID:
+#define VM_END
+#else
+// VM_NEXT must leave loops and do { } while (0)s inside a handler too
+#define VM_LOOP for (;;) { dispatch: count++; ins = *pc++; switch (INS_OP(ins)) {
+#define VM_CASE(op) case op:
+#define VM_NEXT goto dispatch
+#define VM_DEFAULT default:
+#define VM_END } }
+#endif
+
+#define VM_FAIL(...) do { frame->pc = pc; vm_error(vm, __VA_ARGS__); goto error; } while (0)
+#define VM_CHECK(expr) do { frame->pc = pc; if (!(expr)) goto error; } while (0)
+// Lists only move here, after instructions that allocate
+#define VM_SAFEPOINT do { if (vm->heap.pending) gc_collect(vm); } while (0)
+#define VM_QUICKEN(op) _quicken(vm, frame, pc - 1, op)
+// goes back to the generic op and runs the instruction again
+#define VM_DEOPT(op) do { _deopt(vm, frame, pc - 1, op); pc--; count--; VM_NEXT; } while (0)
+// Quickened comparisons also run the JMPIFNOT testing their result.
+#define VM_BRANCH_ON(result) do { \
+		Instruction next = *pc; \
+		if (INS_OP(next) == IT_JMPIFNOT && INS_A(next) == INS_A(ins)) { \
+			count++; \
+			pc++; \
+			if (!(result)) pc += INS_SBX(next); \
+		} \
+	} while (0)
+#define VM_BOTH_NUMBERS(b, c) (obj_is(*(b), OT_NUMBER) && obj_is(*(c), OT_NUMBER))
+
+#define RA (&base[INS_A(ins)])
+#define RB (&base[INS_B(ins)])
+#define RC (&base[INS_C(ins)])
+#define NB obj_as_number(*b)
+#define NC obj_as_number(*c)
+// the operands of the bitwise ops and shifts
+#define IB vm_to_int(NB)
+#define IC vm_to_int(NC)
+
+#define VM_ARITH(op, expr) VM_CASE(op) { \
+		Object* b = RB; \
+		Object* c = RC; \
+		if (!obj_is(*b, OT_NUMBER) || !obj_is(*c, OT_NUMBER)) \
+			VM_FAIL("Cannot apply %s to %s and %s.", INSTRUCTIONS[op], _type_name(obj_type(*b)), _type_name(obj_type(*c))); \
+		*RA = obj_number(expr); \
+		VM_NEXT; \
+	}
+
+#define VM_BITWISE(op, expr) VM_ARITH(op, (double) (expr))
+
+#define VM_COMPARE(op, quick, cmp) VM_CASE(op) { \
+		Object* b = RB; \
+		Object* c = RC; \
+		int result; \
+		if (VM_BOTH_NUMBERS(b, c)) { \
+			result = obj_as_number(*b) cmp obj_as_number(*c); \
+			VM_QUICKEN(quick); \
+		} else VM_CHECK(_compare(vm, op, *b, *c, &result)); \
+		*RA = obj_bool(result); \
+		VM_NEXT; \
+	} \
+	VM_CASE(quick) { \
+		Object* b = RB; \
+		Object* c = RC; \
+		if (VM_BOTH_NUMBERS(b, c)) { \
+			int result = obj_as_number(*b) cmp obj_as_number(*c); \
+			*RA = obj_bool(result); \
+			VM_BRANCH_ON(result); \
+			VM_NEXT; \
+		} \
+		VM_DEOPT(op); \
+	}
+
+#define VM_EQUALS(op, quick, cmp, negate) VM_CASE(op) { \
+		Object* b = RB; \
+		Object* c = RC; \
+		if (VM_BOTH_NUMBERS(b, c)) VM_QUICKEN(quick); \
+		*RA = obj_bool(negate obj_equals(*b, *c)); \
+		VM_NEXT; \
+	} \
+	VM_CASE(quick) { \
+		Object* b = RB; \
+		Object* c = RC; \
+		if (VM_BOTH_NUMBERS(b, c)) { \
+			int result = obj_as_number(*b) cmp obj_as_number(*c); \
+			*RA = obj_bool(result); \
+			VM_BRANCH_ON(result); \
+			VM_NEXT; \
+		} \
+		VM_DEOPT(op); \
+	}
+
+// Typed forms trust the compiler about the operand types.
+
+#define VM_TYPED(op, expr) VM_CASE(op) { \
+		Object* b = RB; \
+		Object* c = RC; \
+		*RA = obj_number(expr); \
+		VM_NEXT; \
+	}
+
+#define VM_TYPED_COMPARE(op, cmp) VM_CASE(op) { \
+		Object* b = RB; \
+		Object* c = RC; \
+		int result = NB cmp NC; \
+		*RA = obj_bool(result); \
+		VM_BRANCH_ON(result); \
+		VM_NEXT; \
+	}
+
+int vm_run(SmolVM* vm) {
+#if VM_COMPUTED_GOTO
+	static const void* labels[256] = {
+		[IT_NOP] = &&L_IT_NOP,
+		[IT_MOVE] = &&L_IT_MOVE,
+		[IT_LOADK] = &&L_IT_LOADK,
+		[IT_LOADNIL] = &&L_IT_LOADNIL,
+		[IT_LOADBOOL] = &&L_IT_LOADBOOL,
+		[IT_GETGLOBAL] = &&L_IT_GETGLOBAL,
+		[IT_SETGLOBAL] = &&L_IT_SETGLOBAL,
+		[IT_NEWLIST] = &&L_IT_NEWLIST,
+		[IT_APPEND] = &&L_IT_APPEND,
+		[IT_RANGE] = &&L_IT_RANGE,
+		[IT_GETINDEX] = &&L_IT_GETINDEX,
+		[IT_SETINDEX] = &&L_IT_SETINDEX,
+		[IT_GETFIELD] = &&L_IT_GETFIELD,
+		[IT_SETFIELD] = &&L_IT_SETFIELD,
+		[IT_ADD] = &&L_IT_ADD,
+		[IT_SUB] = &&L_IT_SUB,
+		[IT_MUL] = &&L_IT_MUL,
+		[IT_DIV] = &&L_IT_DIV,
+		[IT_MOD] = &&L_IT_MOD,
+		[IT_LSH] = &&L_IT_LSH,
+		[IT_RSH] = &&L_IT_RSH,
+		[IT_BITAND] = &&L_IT_BITAND,
+		[IT_BITOR] = &&L_IT_BITOR,
+		[IT_BITXOR] = &&L_IT_BITXOR,
+		[IT_EQ] = &&L_IT_EQ,
+		[IT_NE] = &&L_IT_NE,
+		[IT_LT] = &&L_IT_LT,
+		[IT_LE] = &&L_IT_LE,
+		[IT_GT] = &&L_IT_GT,
+		[IT_GE] = &&L_IT_GE,
+		[IT_NEG] = &&L_IT_NEG,
+		[IT_NOT] = &&L_IT_NOT,
+		[IT_BITNOT] = &&L_IT_BITNOT,
+		[IT_JMP] = &&L_IT_JMP,
+		[IT_JMPIF] = &&L_IT_JMPIF,
+		[IT_JMPIFNOT] = &&L_IT_JMPIFNOT,
+		[IT_JMPNOTNIL] = &&L_IT_JMPNOTNIL,
+		[IT_FORPREP] = &&L_IT_FORPREP,
+		[IT_FORITER] = &&L_IT_FORITER,
+		[IT_RANGEPREP] = &&L_IT_RANGEPREP,
+		[IT_RANGELOOP] = &&L_IT_RANGELOOP,
+		[IT_CALL] = &&L_IT_CALL,
+		[IT_RETURN] = &&L_IT_RETURN,
+		[IT_TAILCALL] = &&L_IT_TAILCALL,
+		[IT_ADDN] = &&L_IT_ADDN,
+		[IT_SUBN] = &&L_IT_SUBN,
+		[IT_MULN] = &&L_IT_MULN,
+		[IT_DIVN] = &&L_IT_DIVN,
+		[IT_MODN] = &&L_IT_MODN,
+		[IT_NEGN] = &&L_IT_NEGN,
+		[IT_EQN] = &&L_IT_EQN,
+		[IT_NEN] = &&L_IT_NEN,
+		[IT_LTN] = &&L_IT_LTN,
+		[IT_LEN] = &&L_IT_LEN,
+		[IT_GTN] = &&L_IT_GTN,
+		[IT_GEN] = &&L_IT_GEN,
+		[IT_LSHI] = &&L_IT_LSHI,
+		[IT_RSHI] = &&L_IT_RSHI,
+		[IT_BITANDI] = &&L_IT_BITANDI,
+		[IT_BITORI] = &&L_IT_BITORI,
+		[IT_BITXORI] = &&L_IT_BITXORI,
+		[IT_BITNOTI] = &&L_IT_BITNOTI,
+		[IT_CHECK] = &&L_IT_CHECK,
+		[IT_ADDNN] = &&L_IT_ADDNN,
+		[IT_CONCAT] = &&L_IT_CONCAT,
+		[IT_EQNN] = &&L_IT_EQNN,
+		[IT_NENN] = &&L_IT_NENN,
+		[IT_LTNN] = &&L_IT_LTNN,
+		[IT_LENN] = &&L_IT_LENN,
+		[IT_GTNN] = &&L_IT_GTNN,
+		[IT_GENN] = &&L_IT_GENN,
+		[IT_QUICK_END ... 255] = &&L_INVALID
+	};
+#endif
+
+	Function* fn = vm->program->functions[0];
+	Object* globals = vm->globals;
+
+	vm->numFrames = 1;
+	CallFrame* frame = &vm->frames[0];
+	frame->fn = fn;
+	frame->base = vm->stack + 1;
+	frame->code = _isolate_code(vm, fn);
+	frame->pc = frame->code;
+	if (fn->numRegisters + 1 > VM_STACK_SIZE) {
+		printf("(0) Stack overflow.\n");
+		return 0;
+	}
+	for (int i = 0; i < fn->numRegisters; i++) {
+		frame->base[i] = obj_nil();
+	}
+
+	// hot state lives in locals, frame is only written on calls and errors
+	const Instruction* pc = frame->pc;
+	Object* base = frame->base;
+	const Object* k = fn->constants;
+	uint64_t count = 0;
+	Instruction ins;
+	int ok = 1;
+
+	VM_LOOP
+		VM_CASE(IT_NOP) VM_NEXT;
+		VM_CASE(IT_MOVE) {
+			*RA = *RB;
+			VM_NEXT;
+		}
+		VM_CASE(IT_LOADK) {
+			*RA = k[INS_BX(ins)];
+			VM_NEXT;
+		}
+		VM_CASE(IT_LOADNIL) {
+			*RA = obj_nil();
+			VM_NEXT;
+		}
+		VM_CASE(IT_LOADBOOL) {
+			*RA = obj_bool(INS_B(ins));
+			VM_NEXT;
+		}
+		VM_CASE(IT_GETGLOBAL) {
+			*RA = globals[INS_BX(ins)];
+			VM_NEXT;
+		}
+		VM_CASE(IT_SETGLOBAL) {
+			globals[INS_BX(ins)] = *RA;
+			VM_NEXT;
+		}
+		VM_CASE(IT_NEWLIST) {
+			*RA = obj_ptr(OT_LIST, vm_new_list(vm));
+			VM_SAFEPOINT;
+			VM_NEXT;
+		}
+		VM_CASE(IT_APPEND) {
+			vm_list_push(vm, (List*) obj_as_ptr(*RA), *RB);
+			VM_SAFEPOINT;
+			VM_NEXT;
+		}
+		VM_CASE(IT_RANGE) {
+			VM_CHECK(_range_list(vm, RA, RB));
+			VM_SAFEPOINT;
+			VM_NEXT;
+		}
+		VM_CASE(IT_GETINDEX) {
+			Object* b = RB;
+			Object* c = RC;
+			if (obj_is(*b, OT_LIST) && obj_is(*c, OT_NUMBER)) {
+				List* list = (List*) obj_as_ptr(*b);
+				int i = (int) obj_as_number(*c);
+				if (i >= 0 && i < list->count) {
+					*RA = list->items[i];
+					VM_NEXT;
+				}
+			}
+			VM_CHECK(_get_index(vm, RA, *b, *c));
+			VM_SAFEPOINT;
+			VM_NEXT;
+		}
+		VM_CASE(IT_SETINDEX) {
+			Object* a = RA;
+			Object* b = RB;
+			if (obj_is(*a, OT_OBJECT) && obj_is(*b, OT_STRING)) {
+				VM_CHECK(_set_field(vm, NULL, *a, (const char*) obj_as_ptr(*b), *RC));
+				VM_SAFEPOINT;
+				VM_NEXT;
+			}
+			if (!obj_is(*a, OT_LIST)) VM_FAIL("Cannot index-assign a %s.", _type_name(obj_type(*a)));
+			if (!obj_is(*b, OT_NUMBER)) VM_FAIL("Cannot index with a %s.", _type_name(obj_type(*b)));
+			List* list = (List*) obj_as_ptr(*a);
+			int i = (int) obj_as_number(*b);
+			if (i < 0 || i >= list->count) VM_FAIL("Index %d out of range.", i);
+			vm_barrier(vm, list, *RC);
+			list->items[i] = *RC;
+			VM_NEXT;
+		}
+		VM_CASE(IT_GETFIELD) {
+			Object b = *RB;
+			FieldCache* fc = NULL;
+			int hit = -1;
+			if (obj_is(b, OT_OBJECT)) {
+				List* object = (List*) obj_as_ptr(b);
+				fc = _field_cache(vm, frame, pc - 1);
+				for (int i = 0; i < fc->count && hit < 0; i++) {
+					if (fc->shapes[i] == object->shape) hit = i;
+				}
+				if (hit >= 0) {
+					vm->cacheHits++;
+					*RA = object->items[fc->slots[hit]];
+				}
+			}
+			if (hit < 0) VM_CHECK(_get_field(vm, fc, RA, b, (const char*) obj_as_ptr(k[INS_C(ins)])));
+			VM_NEXT;
+		}
+		VM_CASE(IT_SETFIELD) {
+			Object a = *RA;
+			FieldCache* fc = NULL;
+			int hit = -1;
+			if (obj_is(a, OT_OBJECT)) {
+				List* object = (List*) obj_as_ptr(a);
+				fc = _field_cache(vm, frame, pc - 1);
+				for (int i = 0; i < fc->count && hit < 0; i++) {
+					if (fc->shapes[i] == object->shape) hit = i;
+				}
+				if (hit >= 0) {
+					vm->cacheHits++;
+					if (fc->next[hit] != NULL) {
+						vm_list_push(vm, object, *RC);
+						object->shape = fc->next[hit];
+					} else {
+						vm_barrier(vm, object, *RC);
+						object->items[fc->slots[hit]] = *RC;
+					}
+				}
+			}
+			if (hit < 0) VM_CHECK(_set_field(vm, fc, a, (const char*) obj_as_ptr(k[INS_B(ins)]), *RC));
+			// a may have moved from here on
+			VM_SAFEPOINT;
+			VM_NEXT;
+		}
+		VM_CASE(IT_ADD) {
+			Object* b = RB;
+			Object* c = RC;
+			if (VM_BOTH_NUMBERS(b, c)) {
+				*RA = obj_number(obj_as_number(*b) + obj_as_number(*c));
+				VM_QUICKEN(IT_ADDNN);
+			} else {
+				int concat = _concatenates(*b, *c);
+				VM_CHECK(_add(vm, RA, *b, *c));
+				if (concat) VM_QUICKEN(IT_CONCAT);
+				VM_SAFEPOINT;
+			}
+			VM_NEXT;
+		}
+		VM_CASE(IT_ADDNN) {
+			Object* b = RB;
+			Object* c = RC;
+			if (VM_BOTH_NUMBERS(b, c)) {
+				*RA = obj_number(obj_as_number(*b) + obj_as_number(*c));
+				VM_NEXT;
+			}
+			VM_DEOPT(IT_ADD);
+		}
+		VM_CASE(IT_CONCAT) {
+			Object* b = RB;
+			Object* c = RC;
+			if (_concatenates(*b, *c)) {
+				*RA = obj_ptr(OT_STRING, _concat(vm, *b, *c));
+				VM_SAFEPOINT;
+				VM_NEXT;
+			}
+			VM_DEOPT(IT_ADD);
+		}
+		VM_ARITH(IT_SUB, NB - NC)
+		VM_ARITH(IT_MUL, NB * NC)
+		VM_ARITH(IT_DIV, NB / NC)
+		VM_ARITH(IT_MOD, fmod(NB, NC))
+		VM_BITWISE(IT_LSH, (int64_t) ((uint64_t) IB << (IC & 63)))
+		VM_BITWISE(IT_RSH, IB >> (IC & 63))
+		VM_BITWISE(IT_BITAND, IB & IC)
+		VM_BITWISE(IT_BITOR, IB | IC)
+		VM_BITWISE(IT_BITXOR, IB ^ IC)
+		VM_EQUALS(IT_EQ, IT_EQNN, ==, )
+		VM_EQUALS(IT_NE, IT_NENN, !=, !)
+		VM_COMPARE(IT_LT, IT_LTNN, <)
+		VM_COMPARE(IT_LE, IT_LENN, <=)
+		VM_COMPARE(IT_GT, IT_GTNN, >)
+		VM_COMPARE(IT_GE, IT_GENN, >=)
+		VM_CASE(IT_NEG) {
+			Object* b = RB;
+			if (!obj_is(*b, OT_NUMBER)) VM_FAIL("Cannot negate a %s.", _type_name(obj_type(*b)));
+			*RA = obj_number(-obj_as_number(*b));
+			VM_NEXT;
+		}
+		VM_CASE(IT_NOT) {
+			*RA = obj_bool(!obj_truthy(*RB));
+			VM_NEXT;
+		}
+		VM_CASE(IT_BITNOT) {
+			Object* b = RB;
+			if (!obj_is(*b, OT_NUMBER)) VM_FAIL("Cannot apply BITNOT to a %s.", _type_name(obj_type(*b)));
+			*RA = obj_number((double) ~vm_to_int(obj_as_number(*b)));
+			VM_NEXT;
+		}
+		VM_CASE(IT_JMP) {
+			pc += INS_SBX(ins);
+			VM_NEXT;
+		}
+		VM_CASE(IT_JMPIF) {
+			if (obj_truthy(*RA)) pc += INS_SBX(ins);
+			VM_NEXT;
+		}
+		VM_CASE(IT_JMPIFNOT) {
+			if (!obj_truthy(*RA)) pc += INS_SBX(ins);
+			VM_NEXT;
+		}
+		VM_CASE(IT_JMPNOTNIL) {
+			if (!obj_is(*RA, OT_NIL)) pc += INS_SBX(ins);
+			VM_NEXT;
+		}
+		VM_CASE(IT_FORPREP) {
+			Object* a = RA;
+			if (!obj_is(*a, OT_LIST)) VM_FAIL("Cannot iterate over a %s.", _type_name(obj_type(*a)));
+			a[1] = obj_number(0);
+			VM_NEXT;
+		}
+		VM_CASE(IT_FORITER) {
+			Object* a = RA;
+			// FORPREP set both up, unless the code came from a tampered cache
+			if (!obj_is(*a, OT_LIST)) VM_FAIL("Cannot iterate over a %s.", _type_name(obj_type(*a)));
+			if (!obj_is(a[1], OT_NUMBER) || !(obj_as_number(a[1]) >= 0)) VM_FAIL("Invalid loop index.");
+			double index = obj_as_number(a[1]);
+			List* list = (List*) obj_as_ptr(*a);
+			if (index < list->count) {
+				a[2] = list->items[(int) index];
+				a[3] = a[1];
+				a[1] = obj_number(index + 1);
+			} else pc += INS_SBX(ins);
+			VM_NEXT;
+		}
+		VM_CASE(IT_RANGEPREP) {
+			Object* a = RA;
+			VM_CHECK(_check_range(vm, a));
+			if (_in_range(obj_as_number(a[0]), obj_as_number(a[1]), obj_as_number(a[2]))) a[3] = a[0];
+			else pc += INS_SBX(ins);
+			VM_NEXT;
+		}
+		VM_CASE(IT_RANGELOOP) {
+			Object* a = RA;
+			double step = obj_as_number(a[2]);
+			double value = obj_as_number(a[0]) + step;
+			if (_in_range(value, obj_as_number(a[1]), step)) {
+				a[0] = a[3] = obj_number(value);
+				pc += INS_SBX(ins);
+			}
+			VM_NEXT;
+		}
+		VM_CASE(IT_CALL) {
+			Object* callee = RA;
+			int numArgs = INS_B(ins);
+			frame->pc = pc;
+			if (obj_is(*callee, OT_FUNCTION)) {
+				Function* target = (Function*) obj_as_ptr(*callee);
+				Object* args = callee + 1;
+				if (vm->numFrames >= VM_MAX_FRAMES || args + target->numRegisters > vm->stack + VM_STACK_SIZE)
+					VM_FAIL("Stack overflow.");
+				// the collector scans every register, stale ones included
+				for (int i = numArgs; i < target->numRegisters; i++) {
+					args[i] = obj_nil();
+				}
+				frame = &vm->frames[vm->numFrames++];
+				frame->fn = target;
+				frame->base = args;
+				frame->code = _isolate_code(vm, target);
+				pc = frame->code;
+				base = args;
+				k = target->constants;
+			} else if (obj_is(*callee, OT_NATIVE)) {
+				Object result = obj_nil();
+				if (!((const Native*) obj_as_ptr(*callee))->fn(vm, callee + 1, numArgs, &result)) goto error;
+				*callee = result;
+				VM_SAFEPOINT;
+			} else VM_FAIL("Cannot call a %s.", _type_name(obj_type(*callee)));
+			VM_NEXT;
+		}
+		VM_CASE(IT_RETURN) {
+			if (INS_B(ins)) base[-1] = *RA;
+			else base[-1] = obj_nil();
+			if (--vm->numFrames == 0) goto done;
+			frame = &vm->frames[vm->numFrames - 1];
+			pc = frame->pc;
+			base = frame->base;
+			k = frame->fn->constants;
+			VM_NEXT;
+		}
+		VM_CASE(IT_TAILCALL) {
+			Object* callee = RA;
+			int numArgs = INS_B(ins);
+			frame->pc = pc;
+			if (obj_is(*callee, OT_FUNCTION)) {
+				// the callee takes over this frame, returning to its caller
+				Function* target = (Function*) obj_as_ptr(*callee);
+				if (base + target->numRegisters > vm->stack + VM_STACK_SIZE) VM_FAIL("Stack overflow.");
+				memmove(base, callee + 1, sizeof(Object) * numArgs);
+				for (int i = numArgs; i < target->numRegisters; i++) {
+					base[i] = obj_nil();
+				}
+				frame->fn = target;
+				frame->code = _isolate_code(vm, target);
+				pc = frame->code;
+				k = target->constants;
+				VM_NEXT;
+			}
+			if (!obj_is(*callee, OT_NATIVE)) VM_FAIL("Cannot call a %s.", _type_name(obj_type(*callee)));
+			Object result = obj_nil();
+			if (!((const Native*) obj_as_ptr(*callee))->fn(vm, callee + 1, numArgs, &result)) goto error;
+			base[-1] = result;
+			if (--vm->numFrames == 0) goto done;
+			frame = &vm->frames[vm->numFrames - 1];
+			pc = frame->pc;
+			base = frame->base;
+			k = frame->fn->constants;
+			VM_SAFEPOINT;
+			VM_NEXT;
+		}
+		VM_TYPED(IT_ADDN, NB + NC)
+		VM_TYPED(IT_SUBN, NB - NC)
+		VM_TYPED(IT_MULN, NB * NC)
+		VM_TYPED(IT_DIVN, NB / NC)
+		VM_TYPED(IT_MODN, fmod(NB, NC))
+		VM_CASE(IT_NEGN) {
+			*RA = obj_number(-obj_as_number(*RB));
+			VM_NEXT;
+		}
+		VM_TYPED_COMPARE(IT_EQN, ==)
+		VM_TYPED_COMPARE(IT_NEN, !=)
+		VM_TYPED_COMPARE(IT_LTN, <)
+		VM_TYPED_COMPARE(IT_LEN, <=)
+		VM_TYPED_COMPARE(IT_GTN, >)
+		VM_TYPED_COMPARE(IT_GEN, >=)
+		VM_TYPED(IT_LSHI, (double) (int64_t) ((uint64_t) IB << (IC & 63)))
+		VM_TYPED(IT_RSHI, (double) (IB >> (IC & 63)))
+		VM_TYPED(IT_BITANDI, (double) (IB & IC))
+		VM_TYPED(IT_BITORI, (double) (IB | IC))
+		VM_TYPED(IT_BITXORI, (double) (IB ^ IC))
+		VM_CASE(IT_BITNOTI) {
+			*RA = obj_number((double) ~vm_to_int(obj_as_number(*RB)));
+			VM_NEXT;
+		}
+		VM_CASE(IT_CHECK) {
+			Object a = *RA;
+			if (!_has_type(a, INS_B(ins))) {
+				if (obj_is(a, OT_NUMBER)) VM_FAIL("Expected %s, got " VM_NUMBER_FORMAT ".", TYPES[INS_B(ins)], obj_as_number(a));
+				VM_FAIL("Expected %s, got %s.", TYPES[INS_B(ins)], _type_name(obj_type(a)));
+			}
+			VM_NEXT;
+		}
+		VM_DEFAULT {
+			VM_FAIL("Invalid instruction %d.", INS_OP(ins));
+		}
+	VM_END
+
+error:
+	ok = 0;
+done:
+	vm->instructions = count;
+	return ok;
+}
@@ -1,15 +1,80 @@
 #ifndef VM_H
 #define VM_H
 
+#include <math.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
+#include "gc.h"
+#include "intern.h"
+#include "shape.h"
+#include "source.h"
+
+enum ObjectType {
+	OT_NIL = 0,
+	OT_NUMBER,
+	OT_BOOL,
+	OT_STRING, // an interned string
+	OT_LIST,
+	OT_FUNCTION,
+	OT_NATIVE,
+	OT_OBJECT // a List of field values, in the order of its shape
+};
+
+// Values are built and inspected only through the obj_* helpers below so
+// the representation can be picked at build time.
+#if SMOL_NAN_BOXING && UINTPTR_MAX == UINT64_MAX
+// 8 bytes: a double, unless all of the quiet NaN bits are set. Boxed values
+// keep their type in the sign bit and bits 48-49, and a bool or a 48-bit
+// pointer in the low bits. Arithmetic only ever produces the canonical NaN,
+// which doesn't have bit 50 set and stays a number.
+typedef uint64_t Object;
+
+#define OBJ_QNAN ((uint64_t) 0x7FFC000000000000)
+#define OBJ_TAG(t) ((((uint64_t) (t) & 4) << 61) | (((uint64_t) (t) & 3) << 48))
+#define OBJ_TAG_MASK (OBJ_QNAN | OBJ_TAG(7))
+#define OBJ_PAYLOAD_MASK ((uint64_t) 0x0000FFFFFFFFFFFF)
+
+static inline Object obj_number(double n) {
+	Object obj;
+	memcpy(&obj, &n, sizeof(obj));
+	return obj;
+}
+
+static inline Object obj_nil(void) { return OBJ_QNAN | OBJ_TAG(OT_NIL); }
+static inline Object obj_bool(int b) { return OBJ_QNAN | OBJ_TAG(OT_BOOL) | (b != 0); }
+static inline Object obj_ptr(int type, const void* p) { return OBJ_QNAN | OBJ_TAG(type) | ((uintptr_t) p & OBJ_PAYLOAD_MASK); }
+
+static inline int obj_is(Object obj, int type) {
+	if (type == OT_NUMBER) return (obj & OBJ_QNAN) != OBJ_QNAN;
+	return (obj & OBJ_TAG_MASK) == (OBJ_QNAN | OBJ_TAG(type));
+}
+
+static inline int obj_type(Object obj) {
+	if ((obj & OBJ_QNAN) != OBJ_QNAN) return OT_NUMBER;
+	return (int) (((obj >> 61) & 4) | ((obj >> 48) & 3));
+}
+
+static inline double obj_as_number(Object obj) {
+	double n;
+	memcpy(&n, &obj, sizeof(n));
+	return n;
+}
+
+static inline int obj_as_bool(Object obj) { return (int) (obj & 1); }
+static inline void* obj_as_ptr(Object obj) { return (void*) (uintptr_t) (obj & OBJ_PAYLOAD_MASK); }
+
+static inline int obj_truthy(Object obj) { return obj != obj_nil() && obj != obj_bool(0); }
+
+static inline int obj_equals(Object a, Object b) {
+	if (obj_is(a, OT_NUMBER) && obj_is(b, OT_NUMBER)) return obj_as_number(a) == obj_as_number(b);
+	return a == b; // strings are interned
+}
+#else
+// 16 bytes: a type tag and a union.
 typedef struct Object_t {
-	enum {
-		OT_NIL = 0,
-		OT_NUMBER,
-		OT_BOOL,
-		OT_STRING
-	} type;
+	int type;
 	union {
 		void* p;
 		double n;
@@ -17,21 +82,337 @@ typedef struct Object_t {
 	};
 } Object;
 
+static inline Object obj_number(double n) {
+	Object obj;
+	obj.type = OT_NUMBER;
+	obj.n = n;
+	return obj;
+}
+
+static inline Object obj_nil(void) {
+	Object obj;
+	obj.type = OT_NIL;
+	obj.p = NULL;
+	return obj;
+}
+
+static inline Object obj_bool(int b) {
+	Object obj;
+	obj.type = OT_BOOL;
+	obj.b = b != 0;
+	return obj;
+}
+
+static inline Object obj_ptr(int type, const void* p) {
+	Object obj;
+	obj.type = type;
+	obj.p = (void*) p;
+	return obj;
+}
+
+static inline int obj_is(Object obj, int type) { return obj.type == type; }
+static inline int obj_type(Object obj) { return obj.type; }
+static inline double obj_as_number(Object obj) { return obj.n; }
+static inline int obj_as_bool(Object obj) { return obj.b; }
+static inline void* obj_as_ptr(Object obj) { return obj.p; }
+
+static inline int obj_truthy(Object obj) { return !(obj.type == OT_NIL || (obj.type == OT_BOOL && !obj.b)); }
+
+static inline int obj_equals(Object a, Object b) {
+	if (a.type != b.type) return 0;
+	switch (a.type) {
+		case OT_NIL: return 1;
+		case OT_NUMBER: return a.n == b.n;
+		case OT_BOOL: return a.b == b.b;
+		default: return a.p == b.p; // strings are interned
+	}
+}
+#endif
+
+// Lists and objects, which the GC moves and frees.
+static inline int obj_in_heap(Object obj) { return obj_is(obj, OT_LIST) || obj_is(obj, OT_OBJECT); }
+
+// The 64-bit int a number stands for in bitwise ops and shifts. Fractions
+// are truncated and numbers past the int64 range wrap modulo 2^64, as JS
+// ToInt32 does for 32 bits. NaN and the infinities are 0.
+static inline int64_t vm_to_int(double n) {
+	if (n >= -9223372036854775808.0 && n < 9223372036854775808.0) return (int64_t) n;
+	if (!isfinite(n)) return 0;
+	double m = fmod(n, 18446744073709551616.0); // exact, |m| < 2^64
+	uint64_t u = (uint64_t) fabs(m);
+	if (m < 0) u = 0 - u;
+	return u <= INT64_MAX ? (int64_t) u : -(int64_t) (UINT64_MAX - u) - 1;
+}
+
 enum InstructionType {
-	IT_NOP = 0
+	IT_NOP = 0,
+
+	IT_MOVE, // a = b
+	IT_LOADK, // a = K[bx]
+	IT_LOADNIL, // a = nil
+	IT_LOADBOOL, // a = b != 0
+	IT_GETGLOBAL, // a = globals[bx]
+	IT_SETGLOBAL, // globals[bx] = a
+
+	IT_NEWLIST, // a = []
+	IT_APPEND, // a.push(b)
+	IT_RANGE, // a = [b, b + 1) by b + 2, as a list
+	IT_GETINDEX, // a = b[c]
+	IT_SETINDEX, // a[b] = c
+	IT_GETFIELD, // a = b.K[c]
+	IT_SETFIELD, // a.K[b] = c
+
+	IT_ADD, // a = b + c
+	IT_SUB,
+	IT_MUL,
+	IT_DIV,
+	IT_MOD,
+	IT_LSH,
+	IT_RSH,
+	IT_BITAND,
+	IT_BITOR,
+	IT_BITXOR,
+	IT_EQ,
+	IT_NE,
+	IT_LT,
+	IT_LE,
+	IT_GT,
+	IT_GE,
+
+	IT_NEG, // a = -b
+	IT_NOT, // a = !b
+	IT_BITNOT, // a = ~b
+
+	IT_JMP, // pc += sbx
+	IT_JMPIF, // if a: pc += sbx
+	IT_JMPIFNOT, // if !a: pc += sbx
+	IT_JMPNOTNIL, // if a != nil: pc += sbx
+
+	IT_FORPREP, // a + 1 = 0
+	IT_FORITER, // if a + 1 < len(a): a + 2 = a[a + 1], a + 3 = a + 1, a + 1 += 1 else pc += sbx
+	// counted loop over a, limit a + 1 (exclusive), step a + 2, variable a + 3
+	IT_RANGEPREP, // if a hasn't passed a + 1: a + 3 = a else pc += sbx
+	IT_RANGELOOP, // a += a + 2; if a hasn't passed a + 1: a + 3 = a, pc += sbx
+
+	IT_CALL, // a = a(a + 1, ..., a + b)
+	IT_RETURN, // return b ? a : nil
+	IT_TAILCALL, // return a(a + 1, ..., a + b) from this frame
+
+	// Unchecked forms the compiler emits for operands of known types: the N
+	// ones for numbers, the I ones for the bitwise ops on numbers. They give
+	// the same results as the checked forms.
+	IT_ADDN,
+	IT_SUBN,
+	IT_MULN,
+	IT_DIVN,
+	IT_MODN,
+	IT_NEGN,
+	IT_EQN,
+	IT_NEN,
+	IT_LTN,
+	IT_LEN,
+	IT_GTN,
+	IT_GEN,
+	IT_LSHI,
+	IT_RSHI,
+	IT_BITANDI,
+	IT_BITORI,
+	IT_BITXORI,
+	IT_BITNOTI,
+	IT_CHECK, // fail unless a is a value of type b
+
+	IT_COUNT,
+
+	// Specialized forms vm_run rewrites ADD and the comparisons to in its
+	// isolate's copy of the code once it saw the operand types. They go
+	// back to the generic form when the types change. Never compiled.
+	IT_ADDNN = IT_COUNT, // a = b + c, two numbers
+	IT_CONCAT, // a = b + c, a string and a string or a number
+	IT_EQNN,
+	IT_NENN,
+	IT_LTNN,
+	IT_LENN,
+	IT_GTNN,
+	IT_GENN,
+
+	IT_QUICK_END
 };
 
-typedef struct Instruction_t {
-	uint8_t type : 8; 
-	union {
-		uint32_t value : 24;
-		struct { uint8_t a, b, c };
-		struct { uint8_t ax; uint16_t bx; };
-	};
-} Instruction;
+extern const char* INSTRUCTIONS[];
+
+// Types of `let` and parameter annotations. An int is a number without a
+// fraction that fits in 64 bits, a double any number. Both are doubles, so
+// int arithmetic is double arithmetic with the int checked, exact up to 2^53.
+enum ValueType {
+	TY_ANY = 0,
+	TY_INT,
+	TY_DOUBLE,
+	TY_STRING,
+	TY_BOOL,
+
+	TY_COUNT
+};
+
+extern const char* TYPES[];
+
+// 32-bit instruction: 8-bit opcode in the low byte, followed by either three
+// 8-bit operands (a, b, c) or an 8-bit a and a 16-bit bx. Jumps store their
+// signed offset in bx with a bias.
+typedef uint32_t Instruction;
+
+#define INS_OP(i) ((i) & 0xFF)
+#define INS_A(i) (((i) >> 8) & 0xFF)
+#define INS_B(i) (((i) >> 16) & 0xFF)
+#define INS_C(i) (((i) >> 24) & 0xFF)
+#define INS_BX(i) ((i) >> 16)
+#define INS_SBX_BIAS 32767
+#define INS_SBX(i) ((int) INS_BX(i) - INS_SBX_BIAS)
+
+#define INS_ABC(op, a, b, c) ((Instruction) (op) | ((Instruction) (a) << 8) | ((Instruction) (b) << 16) | ((Instruction) (c) << 24))
+#define INS_ABX(op, a, bx) ((Instruction) (op) | ((Instruction) (a) << 8) | ((Instruction) (bx) << 16))
+#define INS_ASBX(op, a, sbx) INS_ABX(op, a, (sbx) + INS_SBX_BIAS)
+
+#define VM_MAX_REGISTERS 256
+// times an instruction falls back to its generic form before it stays there
+#define VM_MAX_DEOPTS 4
+// shapes a field access caches before it stops caching
+#define VM_CACHE_WAYS 4
+#define VM_MAX_CONSTANTS 65536
+#define VM_MAX_GLOBALS 65536
+// how numbers print and read when concatenated to strings
+#define VM_NUMBER_FORMAT "%.14g"
+
+typedef struct Function_t {
+	const char* name; // NULL for the top level code
+	Instruction* code;
+	int* lines; // source line of each instruction
+	int codeLen, codeCap;
+	Object* constants;
+	int numConstants, constantsCap;
+	int* constantSlots; // hash of constants + 1 for function_constant, or NULL
+	int constantSlotsCap, numSlotted;
+	int numParams, numRegisters;
+	int mapped; // code and lines point into the Program's image
+	int index; // in Program.functions
+} Function;
 
+// Output of the compiler: every function of a script, functions[0] being
+// the top level code. Nothing changes it once compiled or loaded, so any
+// number of threads can run it at once, each on its own SmolVM.
+typedef struct Program_t {
+	Function** functions;
+	int numFunctions, functionsCap;
+	const char** globals; // the name of each global slot, interned
+	int numGlobals, globalsCap;
+	int* globalSlots; // hash of globals + 1
+	int globalSlotsCap;
+	Interner* strings;
+	SourceFile* image; // the .smolc it was loaded from, NULL when compiled
+} Program;
+
+extern Function* function_new(const char* name);
+extern void function_free(Function* fn);
+extern int function_emit(Function* fn, Instruction ins, int line);
+extern int function_constant(Function* fn, Object value);
+extern void function_disassemble(const Program* prog, Function* fn);
+
+extern Program* program_new(Interner* strings);
+extern void program_free(Program* prog);
+extern void program_add_function(Program* prog, Function* fn);
+// The slot of global name, added if new. -1 when there are too many.
+extern int program_global(Program* prog, const char* name);
+// The slot of global name, or -1.
+extern int program_find_global(const Program* prog, const char* name);
+extern void program_disassemble(Program* prog);
+
+extern void print_object(Object obj);
+
+typedef struct List_t {
+	Object* items;
+	int count, capacity;
+	struct List_t* next; // in the old space, or the copy once promoted
+	unsigned char gcFlags, gcMark;
+	Shape* shape; // of an object, NULL for lists
+} List;
+
+struct SmolVM_t;
+
+// Natives return 0 after reporting an error with vm_error.
+typedef int (*NativeFn)(struct SmolVM_t* vm, Object* args, int numArgs, Object* result);
+
+typedef struct Native_t {
+	const char* name;
+	NativeFn fn;
+} Native;
+
+typedef struct CallFrame_t {
+	Function* fn;
+	const Instruction* code; // the isolate's copy of fn->code
+	const Instruction* pc; // saved when the frame calls or fails
+	Object* base; // register 0, base[-1] receives the return value
+} CallFrame;
+
+// The shapes of the objects a GETFIELD or SETFIELD has seen and the slot
+// of its field in each. When a SETFIELD added the field, next is the shape
+// the object went to.
+typedef struct FieldCache_t {
+	const Shape* shapes[VM_CACHE_WAYS];
+	Shape* next[VM_CACHE_WAYS];
+	int slots[VM_CACHE_WAYS];
+	int count;
+} FieldCache;
+
+// A function's code as one isolate runs it, copied from the Program on the
+// first call so it can be quickened.
+typedef struct IsolateCode_t {
+	Instruction* code;
+	unsigned char* deopts; // per instruction
+	FieldCache** fields; // per instruction, made when it first meets an object
+} IsolateCode;
+
+#define VM_STACK_SIZE 65536
+#define VM_MAX_FRAMES 1024
+// frames an error trace shows at each end, the ones between are counted
+#define VM_TRACE_FRAMES 8
+
+// An isolate: everything one run of a Program writes. Strings built while
+// running go to its own layer over the program's interner.
 typedef struct SmolVM_t {
-	Instruction* program;
+	const Program* program;
+	Interner strings;
+	Object* globals; // by Program slot
+	int numGlobals;
+	Object* stack;
+	CallFrame frames[VM_MAX_FRAMES];
+	int numFrames;
+	IsolateCode* code; // by Function.index
+	Heap heap;
+	Shape* shapes; // the empty root
+	uint64_t instructions; // executed by the last vm_run
+	uint64_t quickened, deopts;
+	uint64_t cacheHits, cacheMisses; // field accesses on objects
 } SmolVM;
 
-#endif // VM_H
\ No newline at end of file
+extern void vm_new(SmolVM* vm, const Program* program);
+extern void vm_free(SmolVM* vm);
+// Binds native to the global of the same name, if the program has one.
+extern void vm_define_native(SmolVM* vm, const Native* native);
+// The built-in native called name, or NULL.
+extern const Native* vm_find_native(const char* name);
+extern List* vm_new_list(SmolVM* vm);
+// An object without fields.
+extern List* vm_new_object(SmolVM* vm);
+// Appends to a list, going through the write barrier.
+extern void vm_list_push(SmolVM* vm, List* list, Object value);
+
+// Must run before storing value into list.
+static inline void vm_barrier(SmolVM* vm, List* list, Object value) {
+	if (list->gcFlags & GC_YOUNG) return;
+	if (obj_in_heap(value)) gc_barrier_slow(&vm->heap, list, (List*) obj_as_ptr(value));
+	else if (vm->heap.phase == GC_MARK && obj_is(value, OT_STRING)) gc_mark_string(vm, (const char*) obj_as_ptr(value));
+}
+extern void vm_error(SmolVM* vm, const char* fmt, ...);
+// Runs the top level code of the program, returns 0 on a runtime error.
+extern int vm_run(SmolVM* vm);
+
+#endif // VM_H